@@ -0,0 +1,101 @@
+#include "acquisition_thread.h"
+#include "cpu_usage.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Empty polls before the consumer sleeps until the next push
+static const int SPIN_POLLS = 64;
+
+AcquisitionThread::AcquisitionThread(FrameSource & source, size_t ring_size)
+  : source_(source), stalls_(nullptr), ring_(ring_size), stop_(false), failed_(false), overflows_(0), cpu_time_(0),
+    waiting_(false) {
+}
+
+AcquisitionThread::~AcquisitionThread() {
+  Stop();
+}
+
+void AcquisitionThread::Start() {
+  stop_ = false;
+  cpu_time_ = 0;
+  thread_ = thread(&AcquisitionThread::Acquire, this);
+}
+
+void AcquisitionThread::Stop() {
+  stop_ = true;
+  if (thread_.joinable())
+    thread_.join();
+}
+
+bool AcquisitionThread::Pop(AcquiredFrame & frame, microseconds wait) {
+  steady_clock::time_point deadline = steady_clock::now() + wait;
+
+  for (int polls = 0; ; polls++) {
+    if (ring_.TryPop(frame))
+      return true;
+
+    // the ring is filled before failed_ is set, so it is empty for good
+    if (failed_ && !ring_.TryPop(frame))
+      rethrow_exception(error_);
+    else if (failed_)
+      return true;
+
+    if (steady_clock::now() >= deadline)
+      return false;
+
+    if (polls < SPIN_POLLS) {
+      this_thread::yield();
+      continue;
+    }
+
+    // announce the wait before the last look at the ring, a push after
+    // that look sees waiting_ and wakes us
+    unique_lock<mutex> lock(wake_mutex_);
+    waiting_ = true;
+    atomic_thread_fence(memory_order_seq_cst);
+    if (ring_.Size() == 0 && !failed_)
+      wake_.wait_until(lock, deadline);
+    waiting_ = false;
+  }
+}
+
+void AcquisitionThread::Notify() {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (waiting_) {
+    lock_guard<mutex> lock(wake_mutex_);
+    wake_.notify_one();
+  }
+}
+
+void AcquisitionThread::Acquire() {
+  try {
+    AcquiredFrame acquired;
+
+    while (!stop_) {
+      if (!stalls_) {
+        source_.GetNextFrame(acquired.frame);
+        acquired.arrival = steady_clock::now();
+      }
+      else if (!stalls_->Grab(source_, acquired.frame, acquired.arrival)) {
+        continue;
+      }
+
+      if (ring_.TryPush(acquired)) {
+        Notify();
+      }
+      else {
+        source_.ReleaseFrame(acquired.frame);
+        overflows_++;
+      }
+
+      // the thread's own clock can only be read from the thread itself
+      cpu_time_ = ThreadCpuTime();
+    }
+  }
+  catch (...) {
+    error_ = current_exception();
+    failed_ = true;
+    Notify();
+  }
+}
@@ -0,0 +1,79 @@
+#ifndef ACQUISITION_THREAD_H
+#define ACQUISITION_THREAD_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include "frame_source.h"
+#include "spsc_ring.h"
+#include "stall_detector.h"
+
+// A frame as handed from the acquisition thread to the consumer
+struct AcquiredFrame {
+  Frame frame;
+  std::chrono::steady_clock::time_point arrival;
+};
+
+// Pulls frames from a source on a dedicated thread and passes them to one
+// consumer through an SpscRing, so that processing and reporting never
+// delay GetNextFrame. The consumer releases the frames it pops. When the
+// ring is full the frame is released right away and counted as an
+// overflow, acquisition never waits for the consumer. A consumer finding
+// the ring empty spins briefly, then sleeps until the next push wakes it.
+class AcquisitionThread {
+ public:
+  AcquisitionThread(FrameSource & source, size_t ring_size);
+  ~AcquisitionThread();
+
+  // Grab frames through the detector, with its timeout, so that a stalled
+  // camera does not hold up Stop. Set before Start.
+  void SetStallDetector(StallDetector * stalls) { stalls_ = stalls; }
+
+  // The source must be acquiring
+  void Start();
+
+  // Let the thread finish its current frame and join it. Frames left in the
+  // ring can still be popped.
+  void Stop();
+
+  // Pop the next frame, waiting up to the given time for one. Returns false
+  // when none arrived. Rethrows the error that ended the acquisition thread
+  // once the ring is empty.
+  bool Pop(AcquiredFrame & frame, std::chrono::microseconds wait = std::chrono::microseconds(100000));
+
+  size_t Occupancy() const { return ring_.Size(); }
+  size_t HighWaterMark() const { return ring_.HighWaterMark(); }
+  size_t Capacity() const { return ring_.Capacity(); }
+  uint64_t Overflows() const { return overflows_; }
+  // Only valid between Start and Stop
+  std::thread::native_handle_type Handle() { return thread_.native_handle(); }
+  // CPU time in ns the thread used up to its last frame
+  int64_t CpuTime() const { return cpu_time_; }
+
+ private:
+  void Acquire();
+
+  // Wake the consumer when it sleeps in Pop
+  void Notify();
+
+  FrameSource & source_;
+  StallDetector * stalls_;
+  SpscRing<AcquiredFrame> ring_;
+  std::thread thread_;
+  std::atomic<bool> stop_;
+  std::atomic<bool> failed_;
+  std::exception_ptr error_;
+  std::atomic<uint64_t> overflows_;
+  std::atomic<int64_t> cpu_time_;
+
+  // set by a consumer about to sleep, so that pushes only take the lock
+  // when someone waits
+  std::mutex wake_mutex_;
+  std::condition_variable wake_;
+  std::atomic<bool> waiting_;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#include <cmath>
+#include "clock_sync.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Samples spanning less host time fit the offset only. A slope fitted over
+// a burst of samples taken back to back turns microseconds of latch jitter
+// into milliseconds once it is extrapolated over a window.
+static const seconds MIN_SLOPE_SPAN(1);
+
+static double HostNs(steady_clock::time_point time) {
+  return double(duration_cast<nanoseconds>(time.time_since_epoch()).count());
+}
+
+ClockSync::ClockSync(size_t max_samples)
+  : max_samples_(max_samples), best_round_trip_(nanoseconds::max()), device_mean_(0), host_mean_(0),
+    slope_(1), fit_error_(0) {
+}
+
+void ClockSync::AddSample(const ClockSample & sample) {
+  // A slow latch request leaves the host time uncertain by half its round
+  // trip, skip samples that took much longer than the best one
+  if (samples_.size() >= 2 && sample.round_trip > 2 * best_round_trip_ + microseconds(50))
+    return;
+
+  best_round_trip_ = min(best_round_trip_, sample.round_trip);
+
+  samples_.push_back(sample);
+  if (samples_.size() > max_samples_)
+    samples_.pop_front();
+
+  Fit();
+}
+
+int64_t ClockSync::ToHost(uint64_t device) const {
+  return int64_t(llround(host_mean_ + slope_ * (double(device) - device_mean_)));
+}
+
+void ClockSync::Fit() {
+  // Work relative to the first sample so that doubles keep ns precision
+  double device_base = double(samples_.front().device);
+  double host_base = HostNs(samples_.front().host);
+  double n = double(samples_.size());
+  double device_sum = 0;
+  double host_sum = 0;
+
+  for (const ClockSample & sample : samples_) {
+    device_sum += double(sample.device) - device_base;
+    host_sum += HostNs(sample.host) - host_base;
+  }
+
+  double device_mean = device_sum / n;
+  double host_mean = host_sum / n;
+  double covariance = 0;
+  double variance = 0;
+
+  for (const ClockSample & sample : samples_) {
+    double device = double(sample.device) - device_base - device_mean;
+    double host = HostNs(sample.host) - host_base - host_mean;
+    covariance += device * host;
+    variance += device * device;
+  }
+
+  // A single sample or a short burst only fixes the offset, assume both
+  // clocks tick alike
+  bool spans = samples_.back().host - samples_.front().host >= MIN_SLOPE_SPAN;
+  slope_ = spans && variance > 0 ? covariance / variance : 1;
+  device_mean_ = device_base + device_mean;
+  host_mean_ = host_base + host_mean;
+
+  double squares = 0;
+  for (const ClockSample & sample : samples_) {
+    double residual = HostNs(sample.host) - double(ToHost(sample.device));
+    squares += residual * residual;
+  }
+  fit_error_ = sqrt(squares / n);
+}
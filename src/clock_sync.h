@@ -0,0 +1,50 @@
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+// Device clock reading paired with the host time it was taken at
+struct ClockSample {
+  uint64_t device;                          // device ticks in nanoseconds
+  std::chrono::steady_clock::time_point host; // midpoint of the latch request
+  std::chrono::nanoseconds round_trip;      // duration of the latch request
+};
+
+// Maps device timestamps onto the host steady clock. A least squares line is
+// fitted through the most recent latch samples, its slope gives the drift of
+// the camera clock against the host clock. Until the samples span a second
+// the slope is taken as 1 and only the offset is fitted.
+class ClockSync {
+ public:
+  explicit ClockSync(size_t max_samples = 64);
+
+  void AddSample(const ClockSample & sample);
+  bool Ready() const { return !samples_.empty(); }
+
+  // Host time in nanoseconds since the steady clock epoch
+  int64_t ToHost(uint64_t device) const;
+
+  // Positive when the device clock runs faster than the host clock
+  double DriftPpm() const { return (1 / slope_ - 1) * 1e6; }
+  // Root mean square distance of the samples from the fitted line in ns
+  double FitError() const { return fit_error_; }
+  size_t Samples() const { return samples_.size(); }
+
+ private:
+  void Fit();
+
+  size_t max_samples_;
+  std::deque<ClockSample> samples_;
+  std::chrono::nanoseconds best_round_trip_;
+
+  // host = host_mean_ + slope_ * (device - device_mean_)
+  double device_mean_;
+  double host_mean_;
+  double slope_;
+  double fit_error_;
+};
+
+#endif
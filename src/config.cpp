@@ -0,0 +1,163 @@
+#include "config.h"
+
+using namespace std;
+
+// Look up a key in the camera specific table first, then in [camera]
+template <class T>
+static T Get(shared_ptr<cpptoml::table> camera, shared_ptr<cpptoml::table> overrides,
+    const string & key, const T & fallback) {
+  if (overrides) {
+    auto value = overrides->get_as<T>(key);
+    if (value)
+      return *value;
+  }
+
+  if (camera)
+    return camera->get_as<T>(key).value_or(fallback);
+
+  return fallback;
+}
+
+TestConfig LoadTestConfig(shared_ptr<cpptoml::table> config) {
+  TestConfig test;
+  shared_ptr<cpptoml::table> table = config->get_table("test");
+
+  test.mode = Get<string>(table, nullptr, "mode", "single");
+  test.loss_budget = Get<double>(table, nullptr, "loss_budget", 0);
+  test.acquisition_thread = Get<bool>(table, nullptr, "acquisition_thread", true);
+  test.ring_size = Get<int>(table, nullptr, "ring_size", 64);
+  test.grab_timeout = Get<double>(table, nullptr, "grab_timeout", 1000);
+  test.stall_incomplete_burst = Get<int>(table, nullptr, "stall_incomplete_burst", 3);
+  test.stall_restart_after = Get<double>(table, nullptr, "stall_restart_after", 0);
+  test.stall_log = Get<string>(table, nullptr, "stall_log", "");
+  test.test_pattern = Get<string>(table, nullptr, "test_pattern", "");
+  test.integrity_log = Get<string>(table, nullptr, "integrity_log", "");
+  test.steady_state = Get<bool>(table, nullptr, "steady_state", false);
+  test.steady_windows = Get<int>(table, nullptr, "steady_windows", 6);
+  test.steady_tolerance = Get<double>(table, nullptr, "steady_tolerance", 0.02);
+  test.confidence_tolerance = Get<double>(table, nullptr, "confidence_tolerance", 0.02);
+  test.max_duration = Get<double>(table, nullptr, "max_duration", 0);
+  test.max_frames = Get<int64_t>(table, nullptr, "max_frames", 0);
+  test.acquisition_policy = Get<string>(table, nullptr, "acquisition_policy", "");
+  test.acquisition_priority = Get<int>(table, nullptr, "acquisition_priority", 0);
+  test.consumer_policy = Get<string>(table, nullptr, "consumer_policy", "");
+  test.consumer_priority = Get<int>(table, nullptr, "consumer_priority", 0);
+  test.lock_memory = Get<bool>(table, nullptr, "lock_memory", false);
+  test.record_path = Get<string>(table, nullptr, "record_path", "");
+  test.record_backend = Get<string>(table, nullptr, "record_backend", "io_uring");
+  test.record_direct = Get<bool>(table, nullptr, "record_direct", true);
+  test.record_buffers = Get<int>(table, nullptr, "record_buffers", 64);
+  test.record_batch = Get<int>(table, nullptr, "record_batch", 8);
+  test.record_threads = Get<int>(table, nullptr, "record_threads", 4);
+  test.record_file_size = Get<double>(table, nullptr, "record_file_size", 1024);
+  test.demosaic = Get<string>(table, nullptr, "demosaic", "");
+  test.image_stats = Get<string>(table, nullptr, "image_stats", "");
+  test.processing_threads = Get<int>(table, nullptr, "processing_threads", 0);
+  test.processing_stripes = Get<int>(table, nullptr, "processing_stripes", 1);
+  test.processing_slots = Get<int>(table, nullptr, "processing_slots", 0);
+  test.warmup = Get<double>(table, nullptr, "warmup", 1);
+  test.duration = Get<double>(table, nullptr, "duration", 10);
+  test.output = Get<string>(table, nullptr, "output", "");
+  test.target_fps = Get<double>(table, nullptr, "target_fps", 0);
+  test.roi_hold = Get<string>(table, nullptr, "roi_hold", "aspect");
+  test.roi_center = Get<bool>(table, nullptr, "roi_center", true);
+  test.roi_output = Get<string>(table, nullptr, "roi_output", "");
+  test.trigger_count = Get<int>(table, nullptr, "trigger_count", 5000);
+  test.trigger_timeout = Get<double>(table, nullptr, "trigger_timeout", 1000);
+  test.trigger_rate_duration = Get<double>(table, nullptr, "trigger_rate_duration", 1);
+  test.trigger_max_rate = Get<double>(table, nullptr, "trigger_max_rate", 0);
+  test.startup_runs = Get<int>(table, nullptr, "startup_runs", 10);
+
+  if (table) {
+    vector<int64_t> counts = table->get_array_of<int64_t>("buffer_counts").value_or(vector<int64_t>());
+    test.buffer_counts.assign(counts.begin(), counts.end());
+    vector<int64_t> cpus = table->get_array_of<int64_t>("acquisition_cpus").value_or(vector<int64_t>());
+    test.acquisition_cpus.assign(cpus.begin(), cpus.end());
+    cpus = table->get_array_of<int64_t>("consumer_cpus").value_or(vector<int64_t>());
+    test.consumer_cpus.assign(cpus.begin(), cpus.end());
+    test.buffer_handling_modes = table->get_array_of<string>("buffer_handling_modes").value_or(vector<string>());
+    test.convert_algorithms = table->get_array_of<string>("convert_algorithms").value_or(vector<string>());
+    test.convert_formats = table->get_array_of<string>("convert_formats").value_or(vector<string>());
+  }
+
+  if (test.convert_formats.empty())
+    test.convert_formats.push_back("BGR8");
+
+  return test;
+}
+
+CameraConfig LoadCameraConfig(shared_ptr<cpptoml::table> config, const string & serial) {
+  CameraConfig camera;
+  shared_ptr<cpptoml::table> table = config->get_table("camera");
+  shared_ptr<cpptoml::table> overrides = table && !serial.empty() ? table->get_table(serial) : nullptr;
+
+  camera.source = Get<string>(table, nullptr, "source", "spinnaker");
+  camera.serial = serial;
+
+  camera.width = Get<int>(table, overrides, "width", 0);
+  camera.height = Get<int>(table, overrides, "height", 0);
+  camera.offset_x = Get<int>(table, overrides, "offset_x", 0);
+  camera.offset_y = Get<int>(table, overrides, "offset_y", 0);
+  camera.exposure_time = Get<int>(table, overrides, "exposure_time", 0);
+  camera.pixel_format = Get<string>(table, overrides, "pixel_format", "");
+  camera.acquisition_mode = Get<string>(table, overrides, "acquisition_mode", "");
+  camera.auto_exposure = Get<string>(table, overrides, "auto_exposure", "");
+  camera.auto_gain = Get<string>(table, overrides, "auto_gain", "");
+  camera.auto_white_balance = Get<string>(table, overrides, "auto_white_balance", "");
+  camera.adc_bit_depth = Get<string>(table, overrides, "adc_bit_depth", "");
+
+  camera.buffer_count_mode = Get<string>(table, overrides, "buffer_count_mode", "");
+  camera.buffer_count = Get<int>(table, overrides, "buffer_count", 0);
+  camera.buffer_handling_mode = Get<string>(table, overrides, "buffer_handling_mode", "");
+  camera.throughput_limit = Get<double>(table, overrides, "throughput_limit", 0);
+  camera.user_set = Get<string>(table, overrides, "user_set", "");
+  camera.user_set_mode = Get<string>(table, overrides, "user_set_mode", "");
+
+  camera.fps = Get<double>(table, overrides, "fps", 0);
+  camera.jitter = Get<double>(table, overrides, "jitter", 0);
+  camera.drop_rate = Get<double>(table, overrides, "drop_rate", 0);
+  camera.incomplete_rate = Get<double>(table, overrides, "incomplete_rate", 0);
+  camera.corrupt_rate = Get<double>(table, overrides, "corrupt_rate", 0);
+  camera.clock_drift = Get<double>(table, overrides, "clock_drift", 0);
+  camera.sensor_width = Get<int>(table, overrides, "sensor_width", 1440);
+  camera.sensor_height = Get<int>(table, overrides, "sensor_height", 1080);
+  camera.trigger_delay = Get<double>(table, overrides, "trigger_delay", 0);
+  camera.stall_every = Get<double>(table, overrides, "stall_every", 0);
+  camera.stall_length = Get<double>(table, overrides, "stall_length", 0);
+
+  camera.replay_path = Get<string>(table, overrides, "replay_path", "");
+  camera.replay_timing = Get<string>(table, overrides, "replay_timing", "original");
+  camera.replay_speed = Get<double>(table, overrides, "replay_speed", 1);
+  camera.replay_read = Get<string>(table, overrides, "replay_read", "mmap");
+  camera.replay_loop = Get<bool>(table, overrides, "replay_loop", true);
+  camera.replay_drop_cache = Get<bool>(table, overrides, "replay_drop_cache", false);
+
+  return camera;
+}
+
+vector<string> LoadCameraSerials(shared_ptr<cpptoml::table> config) {
+  shared_ptr<cpptoml::table> table = config->get_table("camera");
+  vector<string> serials;
+
+  if (!table)
+    return serials;
+
+  // serial numbers may be written as strings or as bare integers
+  if (auto names = table->get_array_of<string>("serials"))
+    serials = *names;
+  else if (auto numbers = table->get_array_of<int64_t>("serials"))
+    for (int64_t number : *numbers)
+      serials.push_back(to_string(number));
+
+  // simulated cameras are named after their index
+  if (serials.empty() && Get<string>(table, nullptr, "source", "") == "synthetic") {
+    int count = Get<int>(table, nullptr, "count", 1);
+    for (int i = 0; i < count; i++)
+      serials.push_back("SIM" + to_string(i));
+  }
+
+  if (serials.empty() && Get<string>(table, nullptr, "source", "") == "replay")
+    serials.push_back("REPLAY");
+
+  return serials;
+}
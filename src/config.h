@@ -0,0 +1,162 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <cstdint>
+#include <limits> // cpptoml.h uses std::numeric_limits without including it
+#include <memory>
+#include <string>
+#include <vector>
+#include "cpptoml/cpptoml.h"
+
+// Settings of the [test] section
+struct TestConfig {
+  std::string mode;   // "single", "multi", "sweep", "buffer_sweep", "roi_search",
+                      // "processing_sweep", "convert_sweep", "trigger" or "startup"
+  double loss_budget; // tolerated share of lost and incomplete frames
+
+  // single camera test: acquire on a thread of its own feeding a frame ring
+  bool acquisition_thread;
+  int ring_size;      // frames the ring holds, rounded up to a power of two
+
+  // stall detection: frames are grabbed with a timeout, stalls are logged
+  // and a camera that stops sending can be restarted
+  double grab_timeout;        // milliseconds, 0 waits for ever
+  int stall_incomplete_burst; // incomplete frames in a row counted as a stall
+  double stall_restart_after; // milliseconds without frames before restarting acquisition, 0 never
+  std::string stall_log;      // file every stall is written to, JSON when ending in .json
+
+  // single camera test: the camera sends a static test pattern and every
+  // frame is checked against it
+  std::string test_pattern;  // "Increment", "SensorTestPattern", ..., empty for the image
+  std::string integrity_log; // file every corrupt frame is written to, JSON when ending in .json
+
+  // single camera test: end warm-up once fps and jitter settle and stop once
+  // mean fps and p99 interval are known well enough, instead of skipping one
+  // second and running until interrupted
+  bool steady_state;
+  int steady_windows;          // windows that have to agree
+  double steady_tolerance;     // relative change of fps and jitter across them
+  double confidence_tolerance; // relative half width of the 95% confidence intervals
+  double max_duration;         // seconds including warm-up, 0 for no limit
+  int64_t max_frames;          // measured frames, 0 for no limit
+
+  // single camera test: scheduling of the thread calling GetNextFrame and of
+  // the consumer, which are one thread without acquisition_thread
+  std::vector<int> acquisition_cpus; // cores to pin to, empty for any
+  std::string acquisition_policy;    // "other", "fifo" or "rr", empty to inherit
+  int acquisition_priority;          // 1 to 99 for "fifo" and "rr"
+  std::vector<int> consumer_cpus;
+  std::string consumer_policy;
+  int consumer_priority;
+  bool lock_memory;                  // mlockall and prefault the stack
+
+  // single camera test: frames written to record_path.<nnnnn>.rec
+  std::string record_path;    // empty for no recording
+  std::string record_backend; // "io_uring" or "pwrite"
+  bool record_direct;         // open files with O_DIRECT
+  int record_buffers;         // aligned buffers, the most writes in flight
+  int record_batch;           // writes submitted at once
+  int record_threads;         // threads of the pwrite backend
+  double record_file_size;    // MB per file
+
+  // single camera test: Bayer frames demosaiced to RGB, or histogram, mean,
+  // range and clipped pixels of 8 bit and unpacked 10 and 12 bit frames
+  std::string demosaic;    // "auto", "avx2", "sse4.1", "neon" or "scalar", empty for none
+  std::string image_stats; // the same for image statistics
+  int processing_threads; // workers sharing the frames, 0 processes on the consumer thread
+  int processing_stripes; // stripes of rows each frame is split into
+  int processing_slots;   // frames copied for processing at once, 0 for four per worker
+
+  // conversion sweep: SDK color processing algorithms, lowest quality first,
+  // and destination formats; all algorithms when empty
+  std::vector<std::string> convert_algorithms;
+  std::vector<std::string> convert_formats;
+
+  // sweeps: every combination of [camera] arrays is measured in turn
+  double warmup;      // seconds skipped before measuring a combination
+  double duration;    // measured seconds per combination
+  std::string output; // result file, JSON when ending in .json, CSV otherwise
+
+  // buffer sweep: combinations of stream buffer count and handling mode
+  std::vector<int> buffer_counts;
+  std::vector<std::string> buffer_handling_modes;
+
+  // ROI search: largest region sustaining target_fps within the loss budget
+  double target_fps;
+  std::string roi_hold;   // "aspect", "width" or "height" kept while searching
+  bool roi_center;        // center the region on the sensor
+  std::string roi_output; // TOML file receiving the winning configuration
+
+  // trigger latency: round trips from software trigger to frame, then the
+  // highest rate triggers are followed at
+  int trigger_count;            // triggers fired one at a time
+  double trigger_timeout;       // milliseconds to wait for a triggered frame
+  double trigger_rate_duration; // seconds each trigger rate is fired for
+  double trigger_max_rate;      // highest rate tried, 0 for no limit
+
+  // startup profile: cold starts from System::GetInstance to the first frame
+  int startup_runs;
+};
+
+// Settings of the [camera] section, merged with the [camera.<serial>]
+// section of the camera they are loaded for
+struct CameraConfig {
+  std::string source; // "spinnaker", "synthetic" or "replay"
+  std::string serial;
+
+  int width;
+  int height;
+  int offset_x;
+  int offset_y;
+  int exposure_time; // in microseconds
+  std::string pixel_format;
+  std::string acquisition_mode;
+  std::string auto_exposure;
+  std::string auto_gain;
+  std::string auto_white_balance;
+  std::string adc_bit_depth;
+
+  // stream settings, left at the SDK defaults when empty or 0
+  std::string buffer_count_mode;    // "Auto" or "Manual"
+  int buffer_count;                 // buffers allocated in manual mode
+  std::string buffer_handling_mode; // "OldestFirst", "NewestOnly", ...
+
+  // user set the applied settings are saved to with "save", becoming the
+  // camera's default, or loaded from with "load" instead of applying them
+  std::string user_set;      // "UserSet1", "UserSet2", empty for none
+  std::string user_set_mode; // "save" or "load"
+
+  // link bytes per second the camera may send, capping the frame rate; set
+  // per camera to share a controller, 0 leaves the device setting
+  double throughput_limit;
+
+  // synthetic source only
+  double fps;             // 0 delivers frames as fast as possible
+  double jitter;          // standard deviation of delivery delay in microseconds
+  double drop_rate;       // probability of a frame being dropped
+  double incomplete_rate; // probability of a frame arriving incomplete
+  double corrupt_rate;    // probability of a byte of a frame being flipped
+  double clock_drift;     // device clock drift against the host clock in ppm
+  int sensor_width;       // largest width, offset_x + width must fit
+  int sensor_height;      // largest height, offset_y + height must fit
+  double trigger_delay;    // microseconds from a software trigger to the start of exposure
+  double stall_every;      // seconds between stalls of the stream, 0 for none
+  double stall_length;     // milliseconds a stall lasts, 0 until acquisition is restarted
+
+  // replay source only
+  std::string replay_path;   // record_path of the recording
+  std::string replay_timing; // "original", "scaled" or "fast"
+  double replay_speed;       // rate factor of scaled timing
+  std::string replay_read;   // "mmap", "pread" or "async"
+  bool replay_loop;          // start over at the end of the recording
+  bool replay_drop_cache;    // evict the recording from the page cache first
+};
+
+TestConfig LoadTestConfig(std::shared_ptr<cpptoml::table> config);
+CameraConfig LoadCameraConfig(std::shared_ptr<cpptoml::table> config, const std::string & serial = "");
+
+// Serial numbers listed in camera.serials, empty when all cameras are used.
+// The synthetic source names camera.count simulated cameras SIM0, SIM1, ...
+std::vector<std::string> LoadCameraSerials(std::shared_ptr<cpptoml::table> config);
+
+#endif
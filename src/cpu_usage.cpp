@@ -0,0 +1,87 @@
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include "cpu_usage.h"
+
+using namespace std;
+
+CoreTimes ReadCoreTimes() {
+  CoreTimes times;
+  ifstream stat("/proc/stat");
+  string line;
+
+  while (getline(stat, line)) {
+    // "cpu" alone is the sum over all cores
+    if (line.compare(0, 3, "cpu") != 0 || line.size() < 4 || line[3] == ' ')
+      continue;
+
+    istringstream fields(line);
+    string name;
+    uint64_t user = 0, nice = 0, system = 0, idle = 0, iowait = 0, irq = 0, softirq = 0, steal = 0;
+    fields >> name >> user >> nice >> system >> idle >> iowait >> irq >> softirq >> steal;
+
+    uint64_t busy = user + nice + system + irq + softirq + steal;
+    times.busy.push_back(busy);
+    times.total.push_back(busy + idle + iowait);
+  }
+
+  return times;
+}
+
+vector<double> CoreUtilisation(const CoreTimes & begin, const CoreTimes & end) {
+  vector<double> utilisation;
+
+  // cores going offline in between change the list, nothing to compare then
+  if (begin.busy.size() != end.busy.size())
+    return utilisation;
+
+  for (size_t i = 0; i < begin.busy.size(); i++) {
+    uint64_t total = end.total[i] - begin.total[i];
+    utilisation.push_back(total ? double(end.busy[i] - begin.busy[i]) / total : 0);
+  }
+
+  return utilisation;
+}
+
+static int64_t Ns(const timeval & time) {
+  return int64_t(time.tv_sec) * 1000000000 + int64_t(time.tv_usec) * 1000;
+}
+
+ProcessUsage ReadProcessUsage() {
+  ProcessUsage usage = ProcessUsage();
+  rusage self;
+
+  if (getrusage(RUSAGE_SELF, &self) != 0)
+    return usage;
+
+  usage.user_time = Ns(self.ru_utime);
+  usage.system_time = Ns(self.ru_stime);
+  usage.voluntary_switches = uint64_t(self.ru_nvcsw);
+  usage.involuntary_switches = uint64_t(self.ru_nivcsw);
+  usage.minor_faults = uint64_t(self.ru_minflt);
+  usage.major_faults = uint64_t(self.ru_majflt);
+  return usage;
+}
+
+ProcessUsage operator-(const ProcessUsage & end, const ProcessUsage & begin) {
+  ProcessUsage usage;
+
+  usage.user_time = end.user_time - begin.user_time;
+  usage.system_time = end.system_time - begin.system_time;
+  usage.voluntary_switches = end.voluntary_switches - begin.voluntary_switches;
+  usage.involuntary_switches = end.involuntary_switches - begin.involuntary_switches;
+  usage.minor_faults = end.minor_faults - begin.minor_faults;
+  usage.major_faults = end.major_faults - begin.major_faults;
+  return usage;
+}
+
+int64_t ThreadCpuTime() {
+  timespec time;
+
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0)
+    return 0;
+
+  return int64_t(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
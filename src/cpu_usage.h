@@ -0,0 +1,38 @@
+#ifndef CPU_USAGE_H
+#define CPU_USAGE_H
+
+#include <cstdint>
+#include <vector>
+
+// Busy and total time of every core in clock ticks since boot, from
+// /proc/stat. Empty where /proc is not available.
+struct CoreTimes {
+  std::vector<uint64_t> busy;
+  std::vector<uint64_t> total;
+};
+
+CoreTimes ReadCoreTimes();
+
+// Busy share of each core between two readings, from 0 to 1
+std::vector<double> CoreUtilisation(const CoreTimes & begin, const CoreTimes & end);
+
+// CPU time and scheduler counters of the whole process, every thread
+// included, from getrusage. Times in ns.
+struct ProcessUsage {
+  int64_t user_time;
+  int64_t system_time;
+  uint64_t voluntary_switches;   // the process waited, for I/O or a lock
+  uint64_t involuntary_switches; // the scheduler took the core away
+  uint64_t minor_faults;
+  uint64_t major_faults;         // the page had to be read from disk
+};
+
+ProcessUsage ReadProcessUsage();
+
+// Both counters and times of end minus begin
+ProcessUsage operator-(const ProcessUsage & end, const ProcessUsage & begin);
+
+// CPU time in ns the calling thread has used, user and system together
+int64_t ThreadCpuTime();
+
+#endif
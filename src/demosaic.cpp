@@ -0,0 +1,379 @@
+#include <cstring>
+#include <random>
+#include "demosaic.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DEMOSAIC_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define DEMOSAIC_NEON
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+
+bool FindBayerPhase(const string & pixel_format, BayerPhase & phase) {
+  if (pixel_format == "BayerRG8")
+    phase = BAYER_RG;
+  else if (pixel_format == "BayerGR8")
+    phase = BAYER_GR;
+  else if (pixel_format == "BayerGB8")
+    phase = BAYER_GB;
+  else if (pixel_format == "BayerBG8")
+    phase = BAYER_BG;
+  else
+    return false;
+
+  return true;
+}
+
+// Colors of row y: whether it holds red rather than blue pixels, and the
+// parity of the columns holding red or blue
+struct BayerRow {
+  bool red;
+  int chroma_parity;
+};
+
+static BayerRow RowOf(BayerPhase phase, int y) {
+  int red_x = phase == BAYER_GR || phase == BAYER_BG ? 1 : 0;
+  int red_y = phase == BAYER_GB || phase == BAYER_BG ? 1 : 0;
+  BayerRow row;
+
+  row.red = (y & 1) == red_y;
+  row.chroma_parity = row.red ? red_x : 1 - red_x;
+  return row;
+}
+
+// Mirror coordinates beyond the edge, which keeps the color of the pixel
+static inline int Mirror(int i, int size) {
+  return i < 0 ? -i : (i >= size ? 2 * size - 2 - i : i);
+}
+
+static inline void DemosaicPixel(const uint8_t * bayer, int width, int height, int x, int y, BayerRow row,
+    uint8_t * rgb) {
+  int left = Mirror(x - 1, width), right = Mirror(x + 1, width);
+  const uint8_t * up = bayer + Mirror(y - 1, height) * width;
+  const uint8_t * center = bayer + y * width;
+  const uint8_t * down = bayer + Mirror(y + 1, height) * width;
+
+  int own = center[x];
+  int chroma, green, other;
+
+  if ((x & 1) == row.chroma_parity) {
+    chroma = own;
+    green = (center[left] + center[right] + up[x] + down[x] + 2) >> 2;
+    other = (up[left] + up[right] + down[left] + down[right] + 2) >> 2;
+  }
+  else {
+    chroma = (center[left] + center[right] + 1) >> 1;
+    green = own;
+    other = (up[x] + down[x] + 1) >> 1;
+  }
+
+  rgb[0] = uint8_t(row.red ? chroma : other);
+  rgb[1] = uint8_t(green);
+  rgb[2] = uint8_t(row.red ? other : chroma);
+}
+
+static void DemosaicRow(const uint8_t * bayer, int width, int height, int y, int x_begin, int x_end, BayerRow row,
+    uint8_t * rgb) {
+  for (int x = x_begin; x < x_end; x++)
+    DemosaicPixel(bayer, width, height, x, y, row, rgb + 3 * (size_t(y) * width + x));
+}
+
+void DemosaicScalar(const uint8_t * bayer, int width, int height, BayerPhase phase, uint8_t * rgb,
+    int row_begin, int row_end) {
+  for (int y = row_begin; y < row_end; y++)
+    DemosaicRow(bayer, width, height, y, 0, width, RowOf(phase, y), rgb);
+}
+
+// The vectorized versions work on the inner rows and columns in chunks and
+// leave the edges and the remainder of each row to DemosaicRow. Per chunk
+// every candidate value is computed for all pixels, the red or blue columns
+// and the green columns then pick theirs with a mask.
+template <int CHUNK, void (*Kernel)(const uint8_t *, int, bool, bool, uint8_t *)>
+static void DemosaicChunks(const uint8_t * bayer, int width, int height, BayerPhase phase, uint8_t * rgb,
+    int row_begin, int row_end) {
+  for (int y = row_begin; y < row_end; y++) {
+    BayerRow row = RowOf(phase, y);
+
+    if (y == 0 || y == height - 1) {
+      DemosaicRow(bayer, width, height, y, 0, width, row, rgb);
+      continue;
+    }
+
+    DemosaicRow(bayer, width, height, y, 0, 1, row, rgb);
+
+    // loads reach one pixel to the right of the chunk
+    int x = 1;
+    for (; x + CHUNK <= width - 1; x += CHUNK) {
+      size_t offset = size_t(y) * width + x;
+      Kernel(bayer + offset, width, row.red, (x & 1) == row.chroma_parity, rgb + 3 * offset);
+    }
+
+    DemosaicRow(bayer, width, height, y, x, width, row, rgb);
+  }
+}
+
+#ifdef DEMOSAIC_X86
+
+// pshufb masks spreading 16 bytes of one channel over the three registers
+// of interleaved RGB
+struct InterleaveMasks {
+  uint8_t mask[3][3][16];
+
+  InterleaveMasks() {
+    for (int out = 0; out < 3; out++)
+      for (int channel = 0; channel < 3; channel++)
+        for (int k = 0; k < 16; k++) {
+          int byte = 16 * out + k;
+          mask[out][channel][k] = byte % 3 == channel ? uint8_t(byte / 3) : 0x80;
+        }
+  }
+};
+
+static const InterleaveMasks INTERLEAVE_MASKS;
+
+__attribute__((target("sse4.1")))
+static inline void StoreRgb(__m128i red, __m128i green, __m128i blue, uint8_t * rgb) {
+  for (int out = 0; out < 3; out++) {
+    const __m128i * masks = reinterpret_cast<const __m128i *>(INTERLEAVE_MASKS.mask[out]);
+    __m128i bytes = _mm_or_si128(_mm_or_si128(
+      _mm_shuffle_epi8(red, _mm_loadu_si128(masks)),
+      _mm_shuffle_epi8(green, _mm_loadu_si128(masks + 1))),
+      _mm_shuffle_epi8(blue, _mm_loadu_si128(masks + 2)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(rgb + 16 * out), bytes);
+  }
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i Load(const uint8_t * p) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i Load256(const uint8_t * p) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+}
+
+// (a + b + c + d + 2) >> 2 in 16 bit lanes
+__attribute__((target("sse4.1")))
+static inline __m128i Mean4(__m128i a, __m128i b, __m128i c, __m128i d) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i two = _mm_set1_epi16(2);
+
+  __m128i low = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+    _mm_add_epi16(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero)));
+  __m128i high = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)),
+    _mm_add_epi16(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(d, zero)));
+
+  return _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(low, two), 2), _mm_srli_epi16(_mm_add_epi16(high, two), 2));
+}
+
+__attribute__((target("sse4.1")))
+static void KernelSse41(const uint8_t * center, int width, bool red_row, bool chroma_even, uint8_t * rgb) {
+  const uint8_t * up = center - width;
+  const uint8_t * down = center + width;
+  __m128i own = Load(center), left = Load(center - 1), right = Load(center + 1);
+  __m128i above = Load(up), below = Load(down);
+
+  __m128i horizontal = _mm_avg_epu8(left, right);
+  __m128i vertical = _mm_avg_epu8(above, below);
+  __m128i cross = Mean4(left, right, above, below);
+  __m128i diagonal = Mean4(Load(up - 1), Load(up + 1), Load(down - 1), Load(down + 1));
+
+  // 0xff where the chunk holds red or blue pixels
+  __m128i chroma = chroma_even ? _mm_set1_epi16(0x00ff) : _mm_set1_epi16(int16_t(0xff00));
+
+  __m128i own_color = _mm_blendv_epi8(horizontal, own, chroma);
+  __m128i green = _mm_blendv_epi8(own, cross, chroma);
+  __m128i other_color = _mm_blendv_epi8(vertical, diagonal, chroma);
+
+  if (red_row)
+    StoreRgb(own_color, green, other_color, rgb);
+  else
+    StoreRgb(other_color, green, own_color, rgb);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i Mean4Avx2(__m256i a, __m256i b, __m256i c, __m256i d) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i two = _mm256_set1_epi16(2);
+
+  // unpacking and packing both work within 128 bit lanes, the byte order
+  // comes out as it went in
+  __m256i low = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero)),
+    _mm256_add_epi16(_mm256_unpacklo_epi8(c, zero), _mm256_unpacklo_epi8(d, zero)));
+  __m256i high = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero)),
+    _mm256_add_epi16(_mm256_unpackhi_epi8(c, zero), _mm256_unpackhi_epi8(d, zero)));
+
+  return _mm256_packus_epi16(_mm256_srli_epi16(_mm256_add_epi16(low, two), 2),
+    _mm256_srli_epi16(_mm256_add_epi16(high, two), 2));
+}
+
+__attribute__((target("avx2")))
+static void KernelAvx2(const uint8_t * center, int width, bool red_row, bool chroma_even, uint8_t * rgb) {
+  const uint8_t * up = center - width;
+  const uint8_t * down = center + width;
+  __m256i own = Load256(center), left = Load256(center - 1), right = Load256(center + 1);
+  __m256i above = Load256(up), below = Load256(down);
+
+  __m256i horizontal = _mm256_avg_epu8(left, right);
+  __m256i vertical = _mm256_avg_epu8(above, below);
+  __m256i cross = Mean4Avx2(left, right, above, below);
+  __m256i diagonal = Mean4Avx2(Load256(up - 1), Load256(up + 1), Load256(down - 1), Load256(down + 1));
+
+  __m256i chroma = chroma_even ? _mm256_set1_epi16(0x00ff) : _mm256_set1_epi16(int16_t(0xff00));
+
+  __m256i own_color = _mm256_blendv_epi8(horizontal, own, chroma);
+  __m256i green = _mm256_blendv_epi8(own, cross, chroma);
+  __m256i other_color = _mm256_blendv_epi8(vertical, diagonal, chroma);
+
+  __m256i red = red_row ? own_color : other_color;
+  __m256i blue = red_row ? other_color : own_color;
+
+  StoreRgb(_mm256_castsi256_si128(red), _mm256_castsi256_si128(green), _mm256_castsi256_si128(blue), rgb);
+  StoreRgb(_mm256_extracti128_si256(red, 1), _mm256_extracti128_si256(green, 1), _mm256_extracti128_si256(blue, 1),
+    rgb + 48);
+}
+
+__attribute__((target("sse4.1")))
+static void DemosaicSse41(const uint8_t * bayer, int width, int height, BayerPhase phase, uint8_t * rgb,
+    int row_begin, int row_end) {
+  DemosaicChunks<16, KernelSse41>(bayer, width, height, phase, rgb, row_begin, row_end);
+}
+
+__attribute__((target("avx2")))
+static void DemosaicAvx2(const uint8_t * bayer, int width, int height, BayerPhase phase, uint8_t * rgb,
+    int row_begin, int row_end) {
+  DemosaicChunks<32, KernelAvx2>(bayer, width, height, phase, rgb, row_begin, row_end);
+}
+
+#endif
+
+#ifdef DEMOSAIC_NEON
+
+// (a + b + c + d + 2) >> 2 in 16 bit lanes
+static inline uint8x16_t Mean4Neon(uint8x16_t a, uint8x16_t b, uint8x16_t c, uint8x16_t d) {
+  uint16x8_t low = vaddq_u16(vaddl_u8(vget_low_u8(a), vget_low_u8(b)), vaddl_u8(vget_low_u8(c), vget_low_u8(d)));
+  uint16x8_t high = vaddq_u16(vaddl_u8(vget_high_u8(a), vget_high_u8(b)),
+    vaddl_u8(vget_high_u8(c), vget_high_u8(d)));
+
+  return vcombine_u8(vrshrn_n_u16(low, 2), vrshrn_n_u16(high, 2));
+}
+
+static void KernelNeon(const uint8_t * center, int width, bool red_row, bool chroma_even, uint8_t * rgb) {
+  const uint8_t * up = center - width;
+  const uint8_t * down = center + width;
+
+  uint8x16_t own = vld1q_u8(center), left = vld1q_u8(center - 1), right = vld1q_u8(center + 1);
+  uint8x16_t above = vld1q_u8(up), below = vld1q_u8(down);
+
+  // vrhadd rounds up like the reference
+  uint8x16_t horizontal = vrhaddq_u8(left, right);
+  uint8x16_t vertical = vrhaddq_u8(above, below);
+  uint8x16_t cross = Mean4Neon(left, right, above, below);
+  uint8x16_t diagonal = Mean4Neon(vld1q_u8(up - 1), vld1q_u8(up + 1), vld1q_u8(down - 1), vld1q_u8(down + 1));
+
+  uint8x16_t chroma = vreinterpretq_u8_u16(vdupq_n_u16(chroma_even ? 0x00ff : 0xff00));
+
+  uint8x16_t own_color = vbslq_u8(chroma, own, horizontal);
+  uint8x16_t green = vbslq_u8(chroma, cross, own);
+  uint8x16_t other_color = vbslq_u8(chroma, diagonal, vertical);
+
+  uint8x16x3_t pixels;
+  pixels.val[0] = red_row ? own_color : other_color;
+  pixels.val[1] = green;
+  pixels.val[2] = red_row ? other_color : own_color;
+  vst3q_u8(rgb, pixels);
+}
+
+static void DemosaicNeon(const uint8_t * bayer, int width, int height, BayerPhase phase, uint8_t * rgb,
+    int row_begin, int row_end) {
+  DemosaicChunks<16, KernelNeon>(bayer, width, height, phase, rgb, row_begin, row_end);
+}
+
+#endif
+
+static bool Supported(const string & instruction_set) {
+#ifdef DEMOSAIC_X86
+  if (instruction_set == "avx2")
+    return __builtin_cpu_supports("avx2");
+  if (instruction_set == "sse4.1")
+    return __builtin_cpu_supports("sse4.1");
+#endif
+#ifdef DEMOSAIC_NEON
+  if (instruction_set == "neon")
+    return true;
+#endif
+  return instruction_set == "scalar";
+}
+
+vector<string> DemosaicInstructionSets() {
+  vector<string> instruction_sets;
+
+  for (const char * name : { "avx2", "sse4.1", "neon", "scalar" })
+    if (Supported(name))
+      instruction_sets.push_back(name);
+
+  return instruction_sets;
+}
+
+DemosaicFunction FindDemosaic(const string & instruction_set) {
+  if (instruction_set == "auto")
+    return FindDemosaic(DemosaicInstructionSets().front());
+
+  if (!Supported(instruction_set))
+    return nullptr;
+
+#ifdef DEMOSAIC_X86
+  if (instruction_set == "avx2")
+    return DemosaicAvx2;
+  if (instruction_set == "sse4.1")
+    return DemosaicSse41;
+#endif
+#ifdef DEMOSAIC_NEON
+  if (instruction_set == "neon")
+    return DemosaicNeon;
+#endif
+  return DemosaicScalar;
+}
+
+bool CheckDemosaic(DemosaicFunction demosaic, int width, int height) {
+  const int sizes[][2] = { { width, height }, { 2, 2 }, { 3, 5 }, { 17, 9 }, { 34, 3 }, { 67, 13 }, { 131, 6 } };
+  mt19937 random(1);
+
+  for (const auto & size : sizes) {
+    if (size[0] < 2 || size[1] < 2)
+      continue;
+
+    size_t pixels = size_t(size[0]) * size[1];
+    vector<uint8_t> bayer(pixels);
+    vector<uint8_t> expected(3 * pixels), actual(3 * pixels);
+
+    for (uint8_t & value : bayer)
+      value = uint8_t(random());
+
+    for (BayerPhase phase : { BAYER_RG, BAYER_GR, BAYER_GB, BAYER_BG }) {
+      DemosaicScalar(bayer.data(), size[0], size[1], phase, expected.data(), 0, size[1]);
+      demosaic(bayer.data(), size[0], size[1], phase, actual.data(), 0, size[1]);
+
+      if (memcmp(expected.data(), actual.data(), expected.size()) != 0)
+        return false;
+
+      // three stripes of uneven height
+      memset(actual.data(), 0, actual.size());
+      int first = size[1] / 3, second = size[1] / 2 + 1;
+      demosaic(bayer.data(), size[0], size[1], phase, actual.data(), 0, first);
+      demosaic(bayer.data(), size[0], size[1], phase, actual.data(), first, second);
+      demosaic(bayer.data(), size[0], size[1], phase, actual.data(), second, size[1]);
+
+      if (memcmp(expected.data(), actual.data(), expected.size()) != 0)
+        return false;
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,38 @@
+#ifndef DEMOSAIC_H
+#define DEMOSAIC_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Position of the red pixel in the 2x2 Bayer tile
+enum BayerPhase { BAYER_RG, BAYER_GR, BAYER_GB, BAYER_BG };
+
+// Bayer tile of an 8 bit Bayer pixel format, false for other formats
+bool FindBayerPhase(const std::string & pixel_format, BayerPhase & phase);
+
+// Bilinear demosaic of rows row_begin to row_end of a width x height Bayer
+// image into interleaved RGB8 at the same rows of rgb. Missing colors are
+// the rounded mean of the two or four nearest pixels of that color, edges
+// are mirrored. Stripes of rows can be converted independently. Needs width
+// and height of at least 2.
+typedef void (*DemosaicFunction)(const uint8_t * bayer, int width, int height, BayerPhase phase, uint8_t * rgb,
+    int row_begin, int row_end);
+
+// One pixel at a time, the reference for the vectorized versions
+void DemosaicScalar(const uint8_t * bayer, int width, int height, BayerPhase phase, uint8_t * rgb,
+    int row_begin, int row_end);
+
+// Instruction sets with a demosaic that this CPU runs, best first
+std::vector<std::string> DemosaicInstructionSets();
+
+// Demosaic for "avx2", "sse4.1", "neon" or "scalar", or for the best one
+// with "auto". nullptr when the CPU or the build lacks it.
+DemosaicFunction FindDemosaic(const std::string & instruction_set);
+
+// Compare demosaic against DemosaicScalar on random images of every phase,
+// of the given size and of odd sizes that exercise the edges, converted
+// whole and in stripes. Returns false on the first difference.
+bool CheckDemosaic(DemosaicFunction demosaic, int width, int height);
+
+#endif
@@ -0,0 +1,64 @@
+#include <algorithm>
+#include <stdexcept>
+#include "demosaic_stage.h"
+#include "report.h"
+
+using namespace std;
+
+DemosaicStage::DemosaicStage(const string & instruction_set, const CameraConfig & camera)
+  : instruction_set_(instruction_set), pixel_format_(camera.pixel_format), frame_pixels_(0) {
+  if (!FindBayerPhase(pixel_format_, phase_))
+    throw runtime_error("Demosaic needs an 8 bit Bayer pixel format, not " + pixel_format_);
+
+  if (instruction_set_ == "auto")
+    instruction_set_ = DemosaicInstructionSets().front();
+
+  demosaic_ = FindDemosaic(instruction_set_);
+  if (!demosaic_)
+    throw runtime_error("Demosaic instruction set not available: " + instruction_set);
+
+  // the vectorized versions have to give the same image as the scalar one
+  if (!CheckDemosaic(demosaic_, camera.width, camera.height))
+    throw runtime_error("Demosaic " + instruction_set_ + " differs from scalar demosaic");
+
+  frame_pixels_ = size_t(max(0, camera.width)) * max(0, camera.height);
+}
+
+void DemosaicStage::PrintInfo(ostream & out) {
+  string available;
+  for (const string & name : DemosaicInstructionSets())
+    available += (available.empty() ? "" : ", ") + name;
+
+  out << "Demosaic settings" << endl
+    << "=================" << endl;
+  out << Label("Pixel format") << pixel_format_ << endl;
+  out << Label("Instruction set") << instruction_set_ << endl;
+  out << Label("Available") << available << endl;
+  out << Label("Self-check") << "passed" << endl;
+  out << endl;
+}
+
+void DemosaicStage::Reserve(size_t slots) {
+  // allocated up front, replays may still bring larger frames
+  rgb_.resize(slots);
+  for (vector<uint8_t> & rgb : rgb_)
+    rgb.resize(3 * frame_pixels_);
+}
+
+void DemosaicStage::Process(const Frame & frame, size_t slot, int row_begin, int row_end) {
+  size_t pixels = size_t(frame.width) * frame.height;
+  vector<uint8_t> & rgb = rgb_.at(slot);
+
+  // frames too small to hold their pixels are left alone
+  if (frame.width < 2 || frame.height < 2 || frame.size < pixels)
+    return;
+
+  // only with a single stripe, stripes of one frame run concurrently
+  if (rgb.size() < 3 * pixels) {
+    if (row_begin > 0 || row_end < frame.height)
+      throw runtime_error("Demosaic output too small for striped frames");
+    rgb.resize(3 * pixels);
+  }
+
+  demosaic_(frame.data, frame.width, frame.height, phase_, rgb.data(), row_begin, row_end);
+}
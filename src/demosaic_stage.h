@@ -0,0 +1,34 @@
+#ifndef DEMOSAIC_STAGE_H
+#define DEMOSAIC_STAGE_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "demosaic.h"
+#include "processing_stage.h"
+
+// Converts every 8 bit Bayer frame to RGB with the demosaic of the given
+// instruction set. The result goes into the buffer of the slot and is
+// overwritten by the next frame, only the time it takes is of interest.
+class DemosaicStage : public ProcessingStage {
+ public:
+  // Throws when the pixel format is not 8 bit Bayer, the instruction set is
+  // not available or its demosaic differs from the scalar one
+  DemosaicStage(const std::string & instruction_set, const CameraConfig & camera);
+
+  void PrintInfo(std::ostream & out) override;
+  void Reserve(size_t slots) override;
+  void Process(const Frame & frame, size_t slot, int row_begin, int row_end) override;
+
+ private:
+  std::string instruction_set_;
+  std::string pixel_format_;
+  BayerPhase phase_;
+  DemosaicFunction demosaic_;
+  size_t frame_pixels_;
+  std::vector<std::vector<uint8_t>> rgb_;
+};
+
+#endif
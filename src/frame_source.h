@@ -0,0 +1,135 @@
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include "clock_sync.h"
+#include "config.h"
+#include "phase_timer.h"
+
+// Thrown by GetNextFrame of a source that has no more frames to give
+class EndOfStream : public std::runtime_error {
+ public:
+  EndOfStream() : std::runtime_error("End of stream") {}
+};
+
+// Image handed out by a FrameSource. The payload stays valid until the frame
+// is given back with FrameSource::ReleaseFrame().
+struct Frame {
+  const uint8_t * data;
+  size_t size;
+  int width;
+  int height;
+  uint64_t frame_id;
+  uint64_t timestamp; // device time at end of exposure in ns, 0 if unknown
+  bool incomplete;    // payload is missing data
+  int status;         // source specific image status, 0 when complete
+  uint64_t handle; // owned by the source that produced the frame
+};
+
+// Cumulative counters of the transport layer stream
+struct StreamCounters {
+  uint64_t lost_frames;
+  uint64_t dropped_frames;
+  uint64_t failed_buffers;
+  uint64_t buffer_underruns;
+};
+
+// Bandwidth of the link between device and host in bytes per second, 0
+// where the device does not tell
+struct LinkStatus {
+  double speed;              // negotiated speed of the link
+  double throughput_limit;   // cap the device keeps the stream under
+  double current_throughput; // what the device expects to send with the current settings
+};
+
+// Ranges of the region of interest nodes
+struct RoiLimits {
+  int width_min;
+  int width_max;
+  int width_inc;
+  int height_min;
+  int height_max;
+  int height_inc;
+  int offset_x_inc;
+  int offset_y_inc;
+};
+
+// Anything RunTest can pull frames from. Call order mirrors the Spinnaker
+// camera: Init, BeginAcquisition, GetNextFrame/ReleaseFrame, EndAcquisition,
+// DeInit. Between acquisitions Configure may apply different settings
+// without initializing the device again.
+class FrameSource {
+ public:
+  virtual ~FrameSource() {}
+
+  // Open the device and apply the [camera] configuration
+  virtual void Init() = 0;
+  virtual void DeInit() = 0;
+
+  // Apply settings to an initialized device that is not acquiring
+  virtual void Configure(const CameraConfig & config) = 0;
+
+  // Print device information and applied settings
+  virtual void PrintInfo(std::ostream & out) = 0;
+
+  virtual void BeginAcquisition() = 0;
+  virtual void EndAcquisition() = 0;
+
+  // Block until the next frame is available
+  virtual void GetNextFrame(Frame & frame) = 0;
+  // Safe to call from a thread other than the grabbing one, and from two
+  // threads at once
+  virtual void ReleaseFrame(Frame & frame) = 0;
+
+  // Wait at most timeout for the next frame. Returns false when none
+  // arrived in time. Sources without a timeout block like GetNextFrame.
+  virtual bool TryGetNextFrame(Frame & frame, std::chrono::milliseconds timeout) {
+    GetNextFrame(frame);
+    return true;
+  }
+
+  // Start every frame with a software trigger instead of free running, or
+  // go back to free running. Call while not acquiring. Returns false when
+  // the source cannot be triggered.
+  virtual bool SetSoftwareTrigger(bool enabled) { return false; }
+
+  // Send the named test pattern instead of the image, "Off" for the image
+  // again. Call while not acquiring. Returns false when the source has no
+  // such pattern.
+  virtual bool SetTestPattern(const std::string & pattern) { return false; }
+
+  // Start one frame in software trigger mode, from any thread
+  virtual void FireSoftwareTrigger() { throw std::runtime_error("Source has no software trigger"); }
+
+  // Latch the device clock to correlate frame timestamps with the host
+  // clock. Returns false when the device has no readable clock.
+  virtual bool SampleClock(ClockSample & sample) { return false; }
+
+  // Read stream statistics. Returns false when the source keeps none.
+  virtual bool ReadStreamCounters(StreamCounters & counters) { return false; }
+
+  // Lap the timer after each step of Init and Configure, to profile
+  // startup. Sources that do not profile ignore it.
+  virtual void SetPhaseTimer(PhaseTimer * timer) {}
+
+  // Read speed and throughput of the link. Returns false when the source
+  // has no link.
+  virtual bool ReadLinkStatus(LinkStatus & status) { return false; }
+
+  // Bytes allocated for stream buffers with the current settings
+  virtual uint64_t BufferMemory() { return 0; }
+
+  // Largest payload of a frame with the current settings
+  virtual uint64_t PayloadSize() { return 0; }
+
+  // Read the ranges of width, height and offsets. Returns false when the
+  // region of interest cannot be changed.
+  virtual bool ReadRoiLimits(RoiLimits & limits) { return false; }
+};
+
+#endif
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include "frame_stats.h"
+#include "report.h"
+
+using namespace std;
+using namespace std::chrono;
+
+FrameStats::FrameStats(nanoseconds window_length, nanoseconds warmup)
+  : window_length_(window_length), warmup_(warmup), started_(false), window_frames_(0),
+    window_bytes_(0), window_negative_latencies_(0), window_lost_(0), window_incomplete_(0),
+    last_window_frames_(0), last_window_seconds_(0), last_window_lost_(0), last_window_incomplete_(0),
+    window_fps_(0), window_bytes_per_second_(0),
+    run_frames_(0), run_bytes_(0), run_duration_(0), processing_threads_(1), run_negative_latencies_(0),
+    run_lost_(0), run_incomplete_(0) {
+}
+
+bool FrameStats::AddFrame(steady_clock::time_point arrival, size_t bytes) {
+  bool window_closed = false;
+
+  if (!started_) {
+    start_ = window_begin_ = arrival;
+    started_ = true;
+  }
+  else {
+    nanoseconds elapsed = arrival - window_begin_;
+
+    // The window ends at the first frame arriving after its length has
+    // passed, so fps is measured over exactly the time the frames took
+    if (elapsed >= window_length_) {
+      window_fps_ = window_frames_ / duration<double>(elapsed).count();
+      window_bytes_per_second_ = window_bytes_ / duration<double>(elapsed).count();
+      swap(window_, last_window_);
+      swap(window_latency_, last_window_latency_);
+      swap(window_processing_, last_window_processing_);
+      window_.Reset();
+      window_latency_.Reset();
+      window_processing_.Reset();
+      last_window_frames_ = window_frames_;
+      last_window_seconds_ = duration<double>(elapsed).count();
+      last_window_lost_ = window_lost_;
+      last_window_incomplete_ = window_incomplete_;
+
+      if (window_begin_ - start_ >= warmup_) {
+        run_.Merge(last_window_);
+        run_latency_.Merge(last_window_latency_);
+        run_processing_.Merge(last_window_processing_);
+        run_negative_latencies_ += window_negative_latencies_;
+        run_lost_ += window_lost_;
+        run_incomplete_ += window_incomplete_;
+        run_frames_ += window_frames_;
+        run_bytes_ += window_bytes_;
+        run_duration_ += elapsed;
+        window_closed = true;
+      }
+
+      window_frames_ = 0;
+      window_bytes_ = 0;
+      window_negative_latencies_ = 0;
+      window_lost_ = 0;
+      window_incomplete_ = 0;
+      window_begin_ = arrival;
+    }
+
+    window_.Record(uint64_t(duration_cast<nanoseconds>(arrival - last_arrival_).count()));
+  }
+
+  window_frames_++;
+  window_bytes_ += bytes;
+  last_arrival_ = arrival;
+
+  return window_closed;
+}
+
+void FrameStats::AddLatency(int64_t latency) {
+  if (latency < 0) {
+    window_negative_latencies_++;
+    latency = 0;
+  }
+
+  window_latency_.Record(uint64_t(latency));
+}
+
+void FrameStats::AddProcessingTime(int64_t time) {
+  window_processing_.Record(uint64_t(max(int64_t(0), time)));
+}
+
+void FrameStats::AddLoss(uint64_t lost, bool incomplete) {
+  window_lost_ += lost;
+  if (incomplete)
+    window_incomplete_++;
+}
+
+void FrameStats::RestartRun() {
+  run_.Reset();
+  run_latency_.Reset();
+  run_processing_.Reset();
+  run_negative_latencies_ = 0;
+  run_lost_ = 0;
+  run_incomplete_ = 0;
+  run_frames_ = 0;
+  run_bytes_ = 0;
+  run_duration_ = nanoseconds(0);
+}
+
+double FrameStats::RunSeconds() const {
+  return duration<double>(run_duration_).count();
+}
+
+double FrameStats::RunFps() const {
+  return run_duration_.count() ? run_frames_ / RunSeconds() : 0;
+}
+
+double FrameStats::RunLossRatio() const {
+  uint64_t expected = run_frames_ + run_lost_;
+  return expected ? double(run_lost_ + run_incomplete_) / expected : 0;
+}
+
+double FrameStats::RunBytesPerSecond() const {
+  return run_duration_.count() ? run_bytes_ / RunSeconds() : 0;
+}
+
+string FrameStats::WindowLine() const {
+  const Histogram & h = last_window_;
+  ostringstream line;
+
+  line << fixed << setprecision(1) << window_fps_ << "fps"
+    << "  p50 " << Us(h.Percentile(50))
+    << "  p90 " << Us(h.Percentile(90))
+    << "  p99 " << Us(h.Percentile(99))
+    << "  p99.9 " << Us(h.Percentile(99.9))
+    << "  max " << Us(h.Max())
+    << "  jitter " << Us(h.StdDev())
+    << "  lost " << last_window_lost_
+    << "  incomplete " << last_window_incomplete_;
+
+  const Histogram & latency = last_window_latency_;
+  if (latency.Count())
+    line << "  latency p50 " << Us(latency.Percentile(50))
+      << "  p99 " << Us(latency.Percentile(99))
+      << "  max " << Us(latency.Max());
+
+  const Histogram & processing = last_window_processing_;
+  if (processing.Count())
+    line << "  processing p50 " << Us(processing.Percentile(50))
+      << "  p99 " << Us(processing.Percentile(99));
+
+  return line.str();
+}
+
+void FrameStats::PrintWindow(ostream & out) const {
+  out << WindowLine() << endl;
+}
+
+void FrameStats::PrintSummary(ostream & out, const string & title) const {
+  const Histogram & h = run_;
+  ostringstream summary;
+
+  summary << fixed << setprecision(1);
+  summary << title << endl
+    << string(title.size(), '=') << endl;
+  summary << Label("Frames") << run_frames_ << endl;
+  summary << Label("Duration") << RunSeconds() << "s" << endl;
+  summary << Label("Mean fps") << RunFps() << endl;
+  summary << Label("Throughput") << RunBytesPerSecond() / 1e6 << "MB/s" << endl;
+  summary << Label("Lost frames") << run_lost_ << endl;
+  summary << Label("Incomplete frames") << run_incomplete_ << endl;
+  summary << Label("Loss ratio") << setprecision(4) << RunLossRatio() * 100 << "%" << setprecision(1) << endl;
+  summary << Label("Interval mean") << Us(h.Mean()) << endl;
+  summary << Label("Interval min") << Us(h.Min()) << endl;
+  summary << Label("Interval p50") << Us(h.Percentile(50)) << endl;
+  summary << Label("Interval p90") << Us(h.Percentile(90)) << endl;
+  summary << Label("Interval p99") << Us(h.Percentile(99)) << endl;
+  summary << Label("Interval p99.9") << Us(h.Percentile(99.9)) << endl;
+  summary << Label("Interval max") << Us(h.Max()) << endl;
+  summary << Label("Jitter") << Us(h.StdDev()) << endl;
+
+  const Histogram & latency = run_latency_;
+  if (latency.Count()) {
+    summary << Label("Latency mean") << Us(latency.Mean()) << endl;
+    summary << Label("Latency p50") << Us(latency.Percentile(50)) << endl;
+    summary << Label("Latency p90") << Us(latency.Percentile(90)) << endl;
+    summary << Label("Latency p99") << Us(latency.Percentile(99)) << endl;
+    summary << Label("Latency p99.9") << Us(latency.Percentile(99.9)) << endl;
+    summary << Label("Latency max") << Us(latency.Max()) << endl;
+    if (run_negative_latencies_)
+      summary << Label("Latency negative") << run_negative_latencies_ << " frames" << endl;
+  }
+
+  // Each thread sustains as many frames per second as the mean time allows,
+  // together they have to match what the camera sent including the frames
+  // lost
+  const Histogram & processing = run_processing_;
+  if (processing.Count()) {
+    double capacity = processing.Mean() > 0 ? processing_threads_ * 1e9 / processing.Mean() : 0;
+    double camera_fps = run_duration_.count() ? (run_frames_ + run_lost_) / RunSeconds() : 0;
+
+    summary << Label("Processing mean") << Us(processing.Mean()) << endl;
+    summary << Label("Processing p50") << Us(processing.Percentile(50)) << endl;
+    summary << Label("Processing p99") << Us(processing.Percentile(99)) << endl;
+    summary << Label("Processing max") << Us(processing.Max()) << endl;
+    summary << Label("Processing capacity") << capacity << " fps" << endl;
+    summary << Label("Processing load") << (run_duration_.count() ? processing.Count() / RunSeconds() : 0)
+      * processing.Mean() / 1e7 << "% of a core" << endl;
+    summary << Label("Keeps up") << (capacity >= camera_fps ? "yes" : "no") << " at " << camera_fps << " fps" << endl;
+  }
+
+  out << summary.str();
+}
@@ -0,0 +1,105 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include "histogram.h"
+
+// Frame rate, inter-frame interval, exposure-to-host latency, processing
+// time and frame loss statistics, both per reporting window and for the
+// whole run. Windows starting within the warm-up period are left out of the
+// run totals.
+class FrameStats {
+ public:
+  explicit FrameStats(std::chrono::nanoseconds window_length = std::chrono::seconds(1),
+      std::chrono::nanoseconds warmup = std::chrono::seconds(1));
+
+  // Record the arrival of a frame with a payload of the given size. Returns
+  // true when the frame closed a reporting window that should be printed.
+  bool AddFrame(std::chrono::steady_clock::time_point arrival, size_t bytes);
+  // Record the time from end of exposure to arrival of the last added frame
+  void AddLatency(int64_t latency);
+  // Record the time a processing stage spent on a frame
+  void AddProcessingTime(int64_t time);
+  // Threads sharing the processing, for the frame rate they sustain
+  void SetProcessingThreads(int threads) { processing_threads_ = threads; }
+  // Record frames lost before the last added frame and whether it arrived
+  // incomplete
+  void AddLoss(uint64_t lost, bool incomplete);
+
+  // Statistics of the last closed window
+  double WindowFps() const { return window_fps_; }
+  double WindowBytesPerSecond() const { return window_bytes_per_second_; }
+  const Histogram & WindowIntervals() const { return last_window_; }
+  const Histogram & WindowLatencies() const { return last_window_latency_; }
+  const Histogram & WindowProcessingTimes() const { return last_window_processing_; }
+  uint64_t WindowFrames() const { return last_window_frames_; }
+  double WindowSeconds() const { return last_window_seconds_; }
+  uint64_t WindowLost() const { return last_window_lost_; }
+  uint64_t WindowIncomplete() const { return last_window_incomplete_; }
+
+  uint64_t RunFrames() const { return run_frames_; }
+  double RunSeconds() const;
+  double RunFps() const;
+  double RunBytesPerSecond() const;
+  const Histogram & RunIntervals() const { return run_; }
+  const Histogram & RunLatencies() const { return run_latency_; }
+  const Histogram & RunProcessingTimes() const { return run_processing_; }
+  // Frames whose latency came out negative because the clock fit was off
+  uint64_t RunNegativeLatencies() const { return run_negative_latencies_; }
+  uint64_t RunLost() const { return run_lost_; }
+  uint64_t RunIncomplete() const { return run_incomplete_; }
+  // Share of expected frames that were lost or arrived incomplete
+  double RunLossRatio() const;
+
+  // Start the run totals over from the next window, to leave out a warm-up
+  // that ended later than expected
+  void RestartRun();
+
+  // One line describing the last closed window
+  std::string WindowLine() const;
+
+  void PrintWindow(std::ostream & out) const;
+  void PrintSummary(std::ostream & out, const std::string & title = "Summary") const;
+
+ private:
+  std::chrono::nanoseconds window_length_;
+  std::chrono::nanoseconds warmup_;
+  bool started_;
+
+  std::chrono::steady_clock::time_point start_;
+  std::chrono::steady_clock::time_point window_begin_;
+  std::chrono::steady_clock::time_point last_arrival_;
+  uint64_t window_frames_;
+  uint64_t window_bytes_;
+  Histogram window_;
+  Histogram last_window_;
+  Histogram window_latency_;
+  Histogram last_window_latency_;
+  Histogram window_processing_;
+  Histogram last_window_processing_;
+  uint64_t window_negative_latencies_;
+  uint64_t window_lost_;
+  uint64_t window_incomplete_;
+  uint64_t last_window_frames_;
+  double last_window_seconds_;
+  uint64_t last_window_lost_;
+  uint64_t last_window_incomplete_;
+  double window_fps_;
+  double window_bytes_per_second_;
+
+  uint64_t run_frames_;
+  uint64_t run_bytes_;
+  std::chrono::nanoseconds run_duration_;
+  Histogram run_;
+  Histogram run_latency_;
+  Histogram run_processing_;
+  int processing_threads_;
+  uint64_t run_negative_latencies_;
+  uint64_t run_lost_;
+  uint64_t run_incomplete_;
+};
+
+#endif
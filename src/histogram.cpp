@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <cmath>
+#include "histogram.h"
+
+using namespace std;
+
+static const int PRECISION_BITS = 8;
+static const uint64_t HALF_BUCKET_COUNT = 1 << (PRECISION_BITS - 1);
+static const size_t BUCKET_COUNT = (64 - PRECISION_BITS) * HALF_BUCKET_COUNT + (1 << PRECISION_BITS);
+
+static size_t BucketIndex(uint64_t value) {
+  if (value < (1 << PRECISION_BITS))
+    return size_t(value);
+
+  // shift the value so that its top PRECISION_BITS bits remain
+  int shift = (63 - __builtin_clzll(value)) - (PRECISION_BITS - 1);
+  return size_t(shift * HALF_BUCKET_COUNT + (value >> shift));
+}
+
+// Largest value that falls into a bucket
+static uint64_t BucketValue(size_t index) {
+  if (index < (1 << PRECISION_BITS))
+    return index;
+
+  int shift = int(index / HALF_BUCKET_COUNT) - 1;
+  uint64_t base = index - shift * HALF_BUCKET_COUNT;
+  return ((base + 1) << shift) - 1;
+}
+
+Histogram::Histogram() : buckets_(BUCKET_COUNT) {
+  Reset();
+}
+
+void Histogram::Record(uint64_t value) {
+  buckets_[BucketIndex(value)]++;
+
+  min_ = count_ ? min(min_, value) : value;
+  max_ = max(max_, value);
+  count_++;
+  sum_ += double(value);
+  sum_squares_ += double(value) * double(value);
+}
+
+void Histogram::Merge(const Histogram & other) {
+  if (other.count_ == 0)
+    return;
+
+  for (size_t i = 0; i < BUCKET_COUNT; i++)
+    buckets_[i] += other.buckets_[i];
+
+  min_ = count_ ? min(min_, other.min_) : other.min_;
+  max_ = max(max_, other.max_);
+  count_ += other.count_;
+  sum_ += other.sum_;
+  sum_squares_ += other.sum_squares_;
+}
+
+void Histogram::Reset() {
+  fill(buckets_.begin(), buckets_.end(), 0);
+  count_ = 0;
+  min_ = 0;
+  max_ = 0;
+  sum_ = 0;
+  sum_squares_ = 0;
+}
+
+double Histogram::Mean() const {
+  return count_ ? sum_ / count_ : 0;
+}
+
+double Histogram::StdDev() const {
+  if (count_ < 2)
+    return 0;
+
+  double mean = Mean();
+  return sqrt(max(0.0, sum_squares_ / count_ - mean * mean));
+}
+
+uint64_t Histogram::Percentile(double percentile) const {
+  if (count_ == 0)
+    return 0;
+
+  uint64_t rank = uint64_t(ceil(percentile / 100 * count_));
+  rank = max<uint64_t>(1, min(rank, count_));
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < BUCKET_COUNT; i++) {
+    seen += buckets_[i];
+    if (seen >= rank)
+      return min(max(BucketValue(i), min_), max_);
+  }
+
+  return max_;
+}
@@ -0,0 +1,37 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstdint>
+#include <vector>
+
+// Log bucketed histogram in the style of HdrHistogram. Values below 256 are
+// counted exactly, above that every power of two is split into 128 linear
+// buckets, which bounds the relative error of a reported value to 1/128
+// while covering the whole uint64_t range in 7424 counters.
+class Histogram {
+ public:
+  Histogram();
+
+  void Record(uint64_t value);
+  void Merge(const Histogram & other);
+  void Reset();
+
+  uint64_t Count() const { return count_; }
+  uint64_t Min() const { return count_ ? min_ : 0; }
+  uint64_t Max() const { return max_; }
+  double Mean() const;
+  double StdDev() const;
+
+  // Value below which the given percentage (0 - 100) of samples fall
+  uint64_t Percentile(double percentile) const;
+
+ private:
+  std::vector<uint64_t> buckets_;
+  uint64_t count_;
+  uint64_t min_;
+  uint64_t max_;
+  double sum_;
+  double sum_squares_;
+};
+
+#endif
@@ -0,0 +1,111 @@
+#include <stdexcept>
+#include "image_processor_stage.h"
+#include "report.h"
+
+using namespace Spinnaker;
+using namespace std;
+
+const vector<string> & ColorProcessingAlgorithms() {
+  static const vector<string> algorithms = {
+    "NEAREST_NEIGHBOR", "NEAREST_NEIGHBOR_AVG", "BILINEAR", "EDGE_SENSING", "HQ_LINEAR", "IPP",
+    "DIRECTIONAL_FILTER", "WEIGHTED_DIRECTIONAL_FILTER", "RIGOROUS"
+  };
+  return algorithms;
+}
+
+static ColorProcessingAlgorithmEnums FindAlgorithm(const string & name) {
+  if (name == "NEAREST_NEIGHBOR")
+    return SPINNAKER_COLOR_PROCESSING_ALGORITHM_NEAREST_NEIGHBOR;
+  if (name == "NEAREST_NEIGHBOR_AVG")
+    return SPINNAKER_COLOR_PROCESSING_ALGORITHM_NEAREST_NEIGHBOR_AVG;
+  if (name == "BILINEAR")
+    return SPINNAKER_COLOR_PROCESSING_ALGORITHM_BILINEAR;
+  if (name == "EDGE_SENSING")
+    return SPINNAKER_COLOR_PROCESSING_ALGORITHM_EDGE_SENSING;
+  if (name == "HQ_LINEAR")
+    return SPINNAKER_COLOR_PROCESSING_ALGORITHM_HQ_LINEAR;
+  if (name == "IPP")
+    return SPINNAKER_COLOR_PROCESSING_ALGORITHM_IPP;
+  if (name == "DIRECTIONAL_FILTER")
+    return SPINNAKER_COLOR_PROCESSING_ALGORITHM_DIRECTIONAL_FILTER;
+  if (name == "WEIGHTED_DIRECTIONAL_FILTER")
+    return SPINNAKER_COLOR_PROCESSING_ALGORITHM_WEIGHTED_DIRECTIONAL_FILTER;
+  if (name == "RIGOROUS")
+    return SPINNAKER_COLOR_PROCESSING_ALGORITHM_RIGOROUS;
+
+  throw runtime_error("Unknown color processing algorithm " + name);
+}
+
+// Pixel formats frames arrive in or are converted to
+static PixelFormatEnums FindPixelFormat(const string & name) {
+  static const struct {
+    const char * name;
+    PixelFormatEnums format;
+  } formats[] = {
+    { "Mono8", PixelFormat_Mono8 }, { "Mono16", PixelFormat_Mono16 },
+    { "RGB8", PixelFormat_RGB8 }, { "BGR8", PixelFormat_BGR8 },
+    { "RGBa8", PixelFormat_RGBa8 }, { "BGRa8", PixelFormat_BGRa8 },
+    { "RGB16", PixelFormat_RGB16 }, { "BGR16", PixelFormat_BGR16 },
+    { "BayerRG8", PixelFormat_BayerRG8 }, { "BayerGR8", PixelFormat_BayerGR8 },
+    { "BayerGB8", PixelFormat_BayerGB8 }, { "BayerBG8", PixelFormat_BayerBG8 },
+    { "BayerRG16", PixelFormat_BayerRG16 }, { "BayerGR16", PixelFormat_BayerGR16 },
+    { "BayerGB16", PixelFormat_BayerGB16 }, { "BayerBG16", PixelFormat_BayerBG16 },
+  };
+
+  for (const auto & format : formats)
+    if (name == format.name)
+      return format.format;
+
+  throw runtime_error("Pixel format not supported for conversion: " + name);
+}
+
+ImageProcessorStage::ImageProcessorStage(const string & algorithm, const string & destination_format,
+    const CameraConfig & camera)
+  : algorithm_name_(algorithm), pixel_format_(camera.pixel_format), destination_format_(destination_format),
+    algorithm_(FindAlgorithm(algorithm)), source_(FindPixelFormat(camera.pixel_format)),
+    destination_(FindPixelFormat(destination_format)) {
+  // the SDK refuses algorithms it was built without, find out before
+  // acquisition starts
+  vector<uint8_t> blank(size_t(max(2, camera.width)) * max(2, camera.height) * 2);
+  Frame frame = Frame();
+  frame.data = blank.data();
+  frame.size = blank.size();
+  frame.width = max(2, camera.width);
+  frame.height = max(2, camera.height);
+
+  ImageProcessor processor;
+  ImagePtr converted;
+  processor.SetColorProcessing(algorithm_);
+  Convert(frame, processor, converted);
+}
+
+void ImageProcessorStage::PrintInfo(ostream & out) {
+  out << "Image processor settings" << endl
+    << "========================" << endl;
+  out << Label("Pixel format") << pixel_format_ << endl;
+  out << Label("Destination format") << destination_format_ << endl;
+  out << Label("Algorithm") << algorithm_name_ << endl;
+  out << endl;
+}
+
+void ImageProcessorStage::Reserve(size_t slots) {
+  processors_.resize(slots);
+  converted_.resize(slots);
+
+  for (ImageProcessor & processor : processors_)
+    processor.SetColorProcessing(algorithm_);
+}
+
+void ImageProcessorStage::Process(const Frame & frame, size_t slot, int row_begin, int row_end) {
+  if (row_begin > 0 || row_end < frame.height)
+    throw runtime_error("Image processor converts whole frames only");
+
+  Convert(frame, processors_.at(slot), converted_.at(slot));
+}
+
+void ImageProcessorStage::Convert(const Frame & frame, ImageProcessor & processor, ImagePtr & converted) {
+  // wrapping the frame is part of what a conversion costs
+  ImagePtr image = Image::Create(size_t(frame.width), size_t(frame.height), 0, 0, source_,
+    const_cast<uint8_t *>(frame.data));
+  converted = processor.Convert(image, destination_);
+}
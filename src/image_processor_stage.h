@@ -0,0 +1,46 @@
+#ifndef IMAGE_PROCESSOR_STAGE_H
+#define IMAGE_PROCESSOR_STAGE_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Spinnaker.h"
+#include "config.h"
+#include "processing_stage.h"
+
+// Color processing algorithms of the SDK, from the cheapest and lowest
+// quality to the most expensive and highest quality
+const std::vector<std::string> & ColorProcessingAlgorithms();
+
+// Converts every frame with the ImageProcessor of the Spinnaker SDK to the
+// destination format, using the given color processing algorithm. Every
+// slot has an ImageProcessor of its own so slots convert concurrently.
+// Frames are converted whole, stripes are not supported.
+class ImageProcessorStage : public ProcessingStage {
+ public:
+  // Throws when the pixel format, destination format or algorithm is not
+  // known or the SDK fails to convert a test frame with them
+  ImageProcessorStage(const std::string & algorithm, const std::string & destination_format,
+      const CameraConfig & camera);
+
+  void PrintInfo(std::ostream & out) override;
+  bool SplitsRows() const override { return false; }
+  void Reserve(size_t slots) override;
+  void Process(const Frame & frame, size_t slot, int row_begin, int row_end) override;
+
+ private:
+  void Convert(const Frame & frame, Spinnaker::ImageProcessor & processor, Spinnaker::ImagePtr & converted);
+
+  std::string algorithm_name_;
+  std::string pixel_format_;
+  std::string destination_format_;
+  Spinnaker::ColorProcessingAlgorithmEnums algorithm_;
+  Spinnaker::PixelFormatEnums source_;
+  Spinnaker::PixelFormatEnums destination_;
+
+  // the converted image of a slot stays until the next frame in that slot
+  std::vector<Spinnaker::ImageProcessor> processors_;
+  std::vector<Spinnaker::ImagePtr> converted_;
+};
+
+#endif
@@ -0,0 +1,435 @@
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include "image_stats.h"
+#include "pixel_format.h"
+
+#if defined(__x86_64__)
+#define STATS_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define STATS_NEON
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+
+static const int BINS_8 = 256;
+static const int BINS_16 = 1024;
+
+int StatsBitDepth(const string & pixel_format) {
+  int bits = BitsPerPixel(pixel_format);
+
+  if (bits == 8 && pixel_format.compare(0, 3, "RGB") != 0)
+    return 8;
+  if (bits != 16 || pixel_format.size() < 2)
+    return 0;
+
+  string depth = pixel_format.substr(pixel_format.size() - 2);
+  return depth == "10" ? 10 : (depth == "12" ? 12 : 0);
+}
+
+// Pixels are counted into one of four tables by their position, an
+// increment of the same bin right after another would otherwise wait for
+// the store before it. Vector kernels find sum, minimum and maximum and
+// hand the loaded pixels to Count8 and Count16, which take them apart in
+// general purpose registers.
+struct Counts {
+  uint32_t table[4][BINS_16];
+  uint64_t sum;
+  uint32_t min;
+  uint32_t max;
+  uint64_t clipped; // counted here for 16 bit words only
+  int shift;
+  uint32_t mask;
+  uint32_t full;
+
+  explicit Counts(int bits)
+    : sum(0), min(UINT32_MAX), max(0), clipped(0), shift(bits == 8 ? 0 : bits - 10),
+      mask(bits == 8 ? BINS_8 - 1 : BINS_16 - 1), full((1u << bits) - 1) {
+    memset(table, 0, sizeof(table));
+  }
+
+  // eight 8 bit pixels
+  inline void Count8(uint64_t bytes) {
+    table[0][bytes & 0xff]++;
+    table[1][(bytes >> 8) & 0xff]++;
+    table[2][(bytes >> 16) & 0xff]++;
+    table[3][(bytes >> 24) & 0xff]++;
+    table[0][(bytes >> 32) & 0xff]++;
+    table[1][(bytes >> 40) & 0xff]++;
+    table[2][(bytes >> 48) & 0xff]++;
+    table[3][bytes >> 56]++;
+  }
+
+  // four 16 bit words, bits above the bit depth wrap around the bins
+  inline void Count16(uint64_t words) {
+    for (int k = 0; k < 4; k++) {
+      uint32_t value = uint32_t(words >> (16 * k)) & 0xffff;
+      table[k][(value >> shift) & mask]++;
+      clipped += value >= full;
+    }
+  }
+
+  // one pixel of the tail or of the scalar version
+  inline void Add(uint32_t value, size_t i, bool words) {
+    table[i & 3][(value >> shift) & mask]++;
+    sum += value;
+    min = std::min(min, value);
+    max = std::max(max, value);
+    if (words)
+      clipped += value >= full;
+  }
+
+  void Finish(size_t pixels, int bits, ImageStatistics & stats) const {
+    int bins = bits == 8 ? BINS_8 : BINS_16;
+
+    stats.histogram.resize(size_t(bins));
+    for (int bin = 0; bin < bins; bin++)
+      stats.histogram[size_t(bin)] = table[0][bin] + table[1][bin] + table[2][bin] + table[3][bin];
+
+    stats.pixels = pixels;
+    stats.sum = sum;
+    stats.min = pixels ? min : 0;
+    stats.max = max;
+    stats.clipped = bits == 8 ? stats.histogram[BINS_8 - 1] : clipped;
+  }
+};
+
+static inline uint16_t Word(const uint8_t * data, size_t i) {
+  return uint16_t(data[2 * i] | data[2 * i + 1] << 8);
+}
+
+void ImageStatsScalar(const uint8_t * data, size_t pixels, int bits, ImageStatistics & stats) {
+  Counts counts(bits);
+
+  if (bits == 8)
+    for (size_t i = 0; i < pixels; i++)
+      counts.Add(data[i], i, false);
+  else
+    for (size_t i = 0; i < pixels; i++)
+      counts.Add(Word(data, i), i, true);
+
+  counts.Finish(pixels, bits, stats);
+}
+
+#ifdef STATS_X86
+
+__attribute__((target("sse4.1")))
+static void Stats8Sse41(const uint8_t * data, size_t pixels, Counts & counts) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i low = _mm_set1_epi8(-1), high = zero, sum = zero;
+  size_t i = 0;
+
+  for (; i + 16 <= pixels; i += 16) {
+    __m128i pixel = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    low = _mm_min_epu8(low, pixel);
+    high = _mm_max_epu8(high, pixel);
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(pixel, zero));
+    counts.Count8(uint64_t(_mm_cvtsi128_si64(pixel)));
+    counts.Count8(uint64_t(_mm_extract_epi64(pixel, 1)));
+  }
+
+  alignas(16) uint8_t lows[16], highs[16];
+  alignas(16) uint64_t sums[2];
+  _mm_store_si128(reinterpret_cast<__m128i *>(lows), low);
+  _mm_store_si128(reinterpret_cast<__m128i *>(highs), high);
+  _mm_store_si128(reinterpret_cast<__m128i *>(sums), sum);
+
+  if (i > 0) {
+    counts.min = *min_element(lows, lows + 16);
+    counts.max = *max_element(highs, highs + 16);
+  }
+  counts.sum = sums[0] + sums[1];
+
+  for (; i < pixels; i++)
+    counts.Add(data[i], i, false);
+}
+
+__attribute__((target("sse4.1")))
+static void Stats16Sse41(const uint8_t * data, size_t pixels, Counts & counts) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i low = _mm_set1_epi16(-1), high = zero, sum = zero;
+  size_t i = 0;
+
+  for (; i + 8 <= pixels; i += 8) {
+    __m128i pixel = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 2 * i));
+    low = _mm_min_epu16(low, pixel);
+    high = _mm_max_epu16(high, pixel);
+
+    // pairs summed in 32 bit lanes, then widened so that no frame overflows
+    __m128i pairs = _mm_add_epi32(_mm_unpacklo_epi16(pixel, zero), _mm_unpackhi_epi16(pixel, zero));
+    sum = _mm_add_epi64(sum, _mm_add_epi64(_mm_unpacklo_epi32(pairs, zero), _mm_unpackhi_epi32(pairs, zero)));
+
+    counts.Count16(uint64_t(_mm_cvtsi128_si64(pixel)));
+    counts.Count16(uint64_t(_mm_extract_epi64(pixel, 1)));
+  }
+
+  alignas(16) uint16_t lows[8], highs[8];
+  alignas(16) uint64_t sums[2];
+  _mm_store_si128(reinterpret_cast<__m128i *>(lows), low);
+  _mm_store_si128(reinterpret_cast<__m128i *>(highs), high);
+  _mm_store_si128(reinterpret_cast<__m128i *>(sums), sum);
+
+  if (i > 0) {
+    counts.min = *min_element(lows, lows + 8);
+    counts.max = *max_element(highs, highs + 8);
+  }
+  counts.sum = sums[0] + sums[1];
+
+  for (; i < pixels; i++)
+    counts.Add(Word(data, i), i, true);
+}
+
+__attribute__((target("avx2")))
+static void Stats8Avx2(const uint8_t * data, size_t pixels, Counts & counts) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i low = _mm256_set1_epi8(-1), high = zero, sum = zero;
+  size_t i = 0;
+
+  for (; i + 32 <= pixels; i += 32) {
+    __m256i pixel = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+    low = _mm256_min_epu8(low, pixel);
+    high = _mm256_max_epu8(high, pixel);
+    sum = _mm256_add_epi64(sum, _mm256_sad_epu8(pixel, zero));
+    counts.Count8(uint64_t(_mm256_extract_epi64(pixel, 0)));
+    counts.Count8(uint64_t(_mm256_extract_epi64(pixel, 1)));
+    counts.Count8(uint64_t(_mm256_extract_epi64(pixel, 2)));
+    counts.Count8(uint64_t(_mm256_extract_epi64(pixel, 3)));
+  }
+
+  alignas(32) uint8_t lows[32], highs[32];
+  alignas(32) uint64_t sums[4];
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lows), low);
+  _mm256_store_si256(reinterpret_cast<__m256i *>(highs), high);
+  _mm256_store_si256(reinterpret_cast<__m256i *>(sums), sum);
+
+  if (i > 0) {
+    counts.min = *min_element(lows, lows + 32);
+    counts.max = *max_element(highs, highs + 32);
+  }
+  counts.sum = sums[0] + sums[1] + sums[2] + sums[3];
+
+  for (; i < pixels; i++)
+    counts.Add(data[i], i, false);
+}
+
+__attribute__((target("avx2")))
+static void Stats16Avx2(const uint8_t * data, size_t pixels, Counts & counts) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i low = _mm256_set1_epi16(-1), high = zero, sum = zero;
+  size_t i = 0;
+
+  for (; i + 16 <= pixels; i += 16) {
+    __m256i pixel = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + 2 * i));
+    low = _mm256_min_epu16(low, pixel);
+    high = _mm256_max_epu16(high, pixel);
+
+    __m256i pairs = _mm256_add_epi32(_mm256_unpacklo_epi16(pixel, zero), _mm256_unpackhi_epi16(pixel, zero));
+    sum = _mm256_add_epi64(sum,
+      _mm256_add_epi64(_mm256_unpacklo_epi32(pairs, zero), _mm256_unpackhi_epi32(pairs, zero)));
+
+    counts.Count16(uint64_t(_mm256_extract_epi64(pixel, 0)));
+    counts.Count16(uint64_t(_mm256_extract_epi64(pixel, 1)));
+    counts.Count16(uint64_t(_mm256_extract_epi64(pixel, 2)));
+    counts.Count16(uint64_t(_mm256_extract_epi64(pixel, 3)));
+  }
+
+  alignas(32) uint16_t lows[16], highs[16];
+  alignas(32) uint64_t sums[4];
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lows), low);
+  _mm256_store_si256(reinterpret_cast<__m256i *>(highs), high);
+  _mm256_store_si256(reinterpret_cast<__m256i *>(sums), sum);
+
+  if (i > 0) {
+    counts.min = *min_element(lows, lows + 16);
+    counts.max = *max_element(highs, highs + 16);
+  }
+  counts.sum = sums[0] + sums[1] + sums[2] + sums[3];
+
+  for (; i < pixels; i++)
+    counts.Add(Word(data, i), i, true);
+}
+
+__attribute__((target("sse4.1")))
+static void ImageStatsSse41(const uint8_t * data, size_t pixels, int bits, ImageStatistics & stats) {
+  Counts counts(bits);
+
+  if (bits == 8)
+    Stats8Sse41(data, pixels, counts);
+  else
+    Stats16Sse41(data, pixels, counts);
+
+  counts.Finish(pixels, bits, stats);
+}
+
+__attribute__((target("avx2")))
+static void ImageStatsAvx2(const uint8_t * data, size_t pixels, int bits, ImageStatistics & stats) {
+  Counts counts(bits);
+
+  if (bits == 8)
+    Stats8Avx2(data, pixels, counts);
+  else
+    Stats16Avx2(data, pixels, counts);
+
+  counts.Finish(pixels, bits, stats);
+}
+
+#endif
+
+#ifdef STATS_NEON
+
+static void Stats8Neon(const uint8_t * data, size_t pixels, Counts & counts) {
+  uint8x16_t low = vdupq_n_u8(0xff), high = vdupq_n_u8(0);
+  uint64x2_t sum = vdupq_n_u64(0);
+  size_t i = 0;
+
+  for (; i + 16 <= pixels; i += 16) {
+    uint8x16_t pixel = vld1q_u8(data + i);
+    low = vminq_u8(low, pixel);
+    high = vmaxq_u8(high, pixel);
+    sum = vpadalq_u32(sum, vpaddlq_u16(vpaddlq_u8(pixel)));
+
+    uint64x2_t words = vreinterpretq_u64_u8(pixel);
+    counts.Count8(vgetq_lane_u64(words, 0));
+    counts.Count8(vgetq_lane_u64(words, 1));
+  }
+
+  uint8_t lows[16], highs[16];
+  uint64_t sums[2];
+  vst1q_u8(lows, low);
+  vst1q_u8(highs, high);
+  vst1q_u64(sums, sum);
+
+  if (i > 0) {
+    counts.min = *min_element(lows, lows + 16);
+    counts.max = *max_element(highs, highs + 16);
+  }
+  counts.sum = sums[0] + sums[1];
+
+  for (; i < pixels; i++)
+    counts.Add(data[i], i, false);
+}
+
+static void Stats16Neon(const uint8_t * data, size_t pixels, Counts & counts) {
+  uint16x8_t low = vdupq_n_u16(0xffff), high = vdupq_n_u16(0);
+  uint64x2_t sum = vdupq_n_u64(0);
+  size_t i = 0;
+
+  for (; i + 8 <= pixels; i += 8) {
+    uint16x8_t pixel = vreinterpretq_u16_u8(vld1q_u8(data + 2 * i));
+    low = vminq_u16(low, pixel);
+    high = vmaxq_u16(high, pixel);
+    sum = vpadalq_u32(sum, vpaddlq_u16(pixel));
+
+    uint64x2_t words = vreinterpretq_u64_u16(pixel);
+    counts.Count16(vgetq_lane_u64(words, 0));
+    counts.Count16(vgetq_lane_u64(words, 1));
+  }
+
+  uint16_t lows[8], highs[8];
+  uint64_t sums[2];
+  vst1q_u16(lows, low);
+  vst1q_u16(highs, high);
+  vst1q_u64(sums, sum);
+
+  if (i > 0) {
+    counts.min = *min_element(lows, lows + 8);
+    counts.max = *max_element(highs, highs + 8);
+  }
+  counts.sum = sums[0] + sums[1];
+
+  for (; i < pixels; i++)
+    counts.Add(Word(data, i), i, true);
+}
+
+static void ImageStatsNeon(const uint8_t * data, size_t pixels, int bits, ImageStatistics & stats) {
+  Counts counts(bits);
+
+  if (bits == 8)
+    Stats8Neon(data, pixels, counts);
+  else
+    Stats16Neon(data, pixels, counts);
+
+  counts.Finish(pixels, bits, stats);
+}
+
+#endif
+
+static bool Supported(const string & instruction_set) {
+#ifdef STATS_X86
+  if (instruction_set == "avx2")
+    return __builtin_cpu_supports("avx2");
+  if (instruction_set == "sse4.1")
+    return __builtin_cpu_supports("sse4.1");
+#endif
+#ifdef STATS_NEON
+  if (instruction_set == "neon")
+    return true;
+#endif
+  return instruction_set == "scalar";
+}
+
+vector<string> ImageStatsInstructionSets() {
+  vector<string> instruction_sets;
+
+  for (const char * name : { "avx2", "sse4.1", "neon", "scalar" })
+    if (Supported(name))
+      instruction_sets.push_back(name);
+
+  return instruction_sets;
+}
+
+ImageStatsFunction FindImageStats(const string & instruction_set) {
+  if (instruction_set == "auto")
+    return FindImageStats(ImageStatsInstructionSets().front());
+
+  if (!Supported(instruction_set))
+    return nullptr;
+
+#ifdef STATS_X86
+  if (instruction_set == "avx2")
+    return ImageStatsAvx2;
+  if (instruction_set == "sse4.1")
+    return ImageStatsSse41;
+#endif
+#ifdef STATS_NEON
+  if (instruction_set == "neon")
+    return ImageStatsNeon;
+#endif
+  return ImageStatsScalar;
+}
+
+bool CheckImageStats(ImageStatsFunction stats, int bits) {
+  const size_t sizes[] = { 0, 1, 7, 16, 31, 33, 100, 1000, 4099 };
+  uint32_t full = (1u << bits) - 1;
+  mt19937 random(1);
+
+  for (size_t pixels : sizes) {
+    size_t bytes_per_pixel = bits == 8 ? 1 : 2;
+    vector<uint8_t> data(pixels * bytes_per_pixel);
+
+    // clipped pixels now and then, and values above the bit depth
+    for (size_t i = 0; i < pixels; i++) {
+      uint32_t value = random() % 8 == 0 ? full : uint32_t(random() % (full + 1));
+      if (bits != 8 && random() % 64 == 0)
+        value = uint32_t(random() % 0x10000);
+
+      data[i * bytes_per_pixel] = uint8_t(value);
+      if (bits != 8)
+        data[i * bytes_per_pixel + 1] = uint8_t(value >> 8);
+    }
+
+    ImageStatistics expected, actual;
+    ImageStatsScalar(data.data(), pixels, bits, expected);
+    stats(data.data(), pixels, bits, actual);
+
+    if (actual.histogram != expected.histogram || actual.pixels != expected.pixels || actual.sum != expected.sum
+        || actual.min != expected.min || actual.max != expected.max || actual.clipped != expected.clipped)
+      return false;
+  }
+
+  return true;
+}
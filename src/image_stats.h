@@ -0,0 +1,45 @@
+#ifndef IMAGE_STATS_H
+#define IMAGE_STATS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Brightness statistics of one frame
+struct ImageStatistics {
+  std::vector<uint32_t> histogram; // 256 bins for 8 bit pixels, 1024 for 10 and 12 bit
+  uint64_t pixels;
+  uint64_t sum;
+  uint32_t min;
+  uint32_t max;
+  uint64_t clipped; // pixels at the largest value of the bit depth
+
+  double Mean() const { return pixels ? double(sum) / pixels : 0; }
+};
+
+// Bit depth of the pixels of a Mono or Bayer format with 8 bit pixels or
+// 10 and 12 bit pixels unpacked into 16 bits, 0 for other formats
+int StatsBitDepth(const std::string & pixel_format);
+
+// Statistics of pixels pixels of data, one byte each for a bit depth of 8
+// and a little endian 16 bit word each for 10 and 12. 12 bit pixels are
+// counted into bins of four values.
+typedef void (*ImageStatsFunction)(const uint8_t * data, size_t pixels, int bits, ImageStatistics & stats);
+
+// One pixel at a time, the reference for the vectorized versions
+void ImageStatsScalar(const uint8_t * data, size_t pixels, int bits, ImageStatistics & stats);
+
+// Instruction sets with image statistics that this CPU runs, best first
+std::vector<std::string> ImageStatsInstructionSets();
+
+// Image statistics for "avx2", "sse4.1", "neon" or "scalar", or for the
+// best one with "auto". nullptr when the CPU or the build lacks it.
+ImageStatsFunction FindImageStats(const std::string & instruction_set);
+
+// Compare stats against ImageStatsScalar on random frames of the given bit
+// depth and of sizes that leave a tail after the vectors. Returns false on
+// the first difference.
+bool CheckImageStats(ImageStatsFunction stats, int bits);
+
+#endif
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include "image_stats_stage.h"
+#include "report.h"
+
+using namespace std;
+using namespace std::chrono;
+
+ImageStatsStage::ImageStatsStage(const string & instruction_set, const CameraConfig & camera)
+  : instruction_set_(instruction_set), pixel_format_(camera.pixel_format), bits_(StatsBitDepth(camera.pixel_format)),
+    frames_(0), bytes_(0), time_(0), max_time_(0), pixels_(0), sum_(0), min_(UINT32_MAX), max_(0), clipped_(0),
+    max_clipped_share_(0) {
+  if (!bits_)
+    throw runtime_error("Image statistics need an 8 bit or unpacked 10 or 12 bit Mono or Bayer pixel format, not "
+      + pixel_format_);
+
+  if (instruction_set_ == "auto")
+    instruction_set_ = ImageStatsInstructionSets().front();
+
+  stats_ = FindImageStats(instruction_set_);
+  if (!stats_)
+    throw runtime_error("Image statistics instruction set not available: " + instruction_set);
+
+  // the vectorized versions have to count the same as the scalar one
+  if (!CheckImageStats(stats_, bits_))
+    throw runtime_error("Image statistics " + instruction_set_ + " differ from scalar statistics");
+
+  histogram_.assign(bits_ == 8 ? 256 : 1024, 0);
+}
+
+void ImageStatsStage::PrintInfo(ostream & out) {
+  string available;
+  for (const string & name : ImageStatsInstructionSets())
+    available += (available.empty() ? "" : ", ") + name;
+
+  out << "Image statistics settings" << endl
+    << "=========================" << endl;
+  out << Label("Pixel format") << pixel_format_ << endl;
+  out << Label("Bit depth") << bits_ << ", " << histogram_.size() << " bins" << endl;
+  out << Label("Instruction set") << instruction_set_ << endl;
+  out << Label("Available") << available << endl;
+  out << Label("Self-check") << "passed" << endl;
+  out << endl;
+}
+
+void ImageStatsStage::Reserve(size_t slots) {
+  slots_.resize(slots);
+  for (ImageStatistics & stats : slots_)
+    stats.histogram.reserve(histogram_.size());
+}
+
+void ImageStatsStage::Process(const Frame & frame, size_t slot, int row_begin, int row_end) {
+  if (row_begin > 0 || row_end < frame.height)
+    throw runtime_error("Image statistics analyse whole frames only");
+
+  size_t pixels = size_t(frame.width) * frame.height;
+  size_t bytes = pixels * (bits_ == 8 ? 1 : 2);
+  ImageStatistics & stats = slots_.at(slot);
+
+  // frames too small to hold their pixels are left alone
+  if (frame.size < bytes)
+    return;
+
+  steady_clock::time_point begin = steady_clock::now();
+  stats_(frame.data, pixels, bits_, stats);
+  int64_t time = duration_cast<nanoseconds>(steady_clock::now() - begin).count();
+
+  lock_guard<mutex> lock(mutex_);
+  frames_++;
+  bytes_ += bytes;
+  time_ += time;
+  max_time_ = max(max_time_, time);
+  for (size_t bin = 0; bin < histogram_.size(); bin++)
+    histogram_[bin] += stats.histogram[bin];
+  pixels_ += stats.pixels;
+  sum_ += stats.sum;
+  if (stats.pixels) {
+    min_ = min(min_, stats.min);
+    max_ = max(max_, stats.max);
+    max_clipped_share_ = max(max_clipped_share_, double(stats.clipped) / stats.pixels);
+  }
+  clipped_ += stats.clipped;
+}
+
+void ImageStatsStage::PrintSummary(ostream & out) const {
+  lock_guard<mutex> lock(mutex_);
+  ostringstream summary;
+  double mean_time = frames_ ? double(time_) / frames_ : 0;
+
+  // pixel value below which the given share of the pixels falls, the
+  // lowest value of the bin
+  int shift = bits_ == 8 ? 0 : bits_ - 10;
+  auto level = [&](double share) -> size_t {
+    uint64_t count = 0;
+    for (size_t bin = 0; bin < histogram_.size(); bin++) {
+      count += histogram_[bin];
+      if (count > share * pixels_)
+        return bin << shift;
+    }
+    return (histogram_.size() - 1) << shift;
+  };
+
+  summary << fixed << setprecision(0);
+  summary << Label("Analysed frames") << frames_ << endl;
+  summary << Label("Statistics time") << mean_time << "ns/frame, max " << double(max_time_) << "ns" << endl;
+  summary << setprecision(2);
+  summary << Label("Statistics rate") << (time_ > 0 ? double(bytes_) / time_ : 0) << "GB/s, "
+    << setprecision(0) << (mean_time > 0 ? 1e9 / mean_time : 0) << " fps on one core" << endl;
+
+  if (pixels_) {
+    summary << setprecision(1);
+    summary << Label("Mean level") << double(sum_) / pixels_ << " of " << (1u << bits_) - 1 << endl;
+    summary << Label("Level range") << min_ << " to " << max_ << endl;
+    summary << Label("Level p1 p50 p99") << level(0.01) << " " << level(0.5) << " " << level(0.99) << endl;
+    summary << setprecision(3);
+    summary << Label("Clipped pixels") << double(clipped_) / pixels_ * 100 << "%, max "
+      << max_clipped_share_ * 100 << "% of a frame" << endl;
+  }
+
+  out << summary.str();
+}
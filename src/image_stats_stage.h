@@ -0,0 +1,53 @@
+#ifndef IMAGE_STATS_STAGE_H
+#define IMAGE_STATS_STAGE_H
+
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "image_stats.h"
+#include "processing_stage.h"
+
+// Computes histogram, mean, minimum, maximum and clipped pixels of every
+// frame with the statistics of the given instruction set. The statistics
+// of a frame stay in its slot until the next frame, the run totals are
+// merged under a lock. Frames are analysed whole, stripes are not
+// supported.
+class ImageStatsStage : public ProcessingStage {
+ public:
+  // Throws when the pixel format is not 8 bit or unpacked 10 or 12 bit Mono
+  // or Bayer, the instruction set is not available or its statistics differ
+  // from the scalar ones
+  ImageStatsStage(const std::string & instruction_set, const CameraConfig & camera);
+
+  void PrintInfo(std::ostream & out) override;
+  bool SplitsRows() const override { return false; }
+  void Reserve(size_t slots) override;
+  void Process(const Frame & frame, size_t slot, int row_begin, int row_end) override;
+  void PrintSummary(std::ostream & out) const override;
+
+ private:
+  std::string instruction_set_;
+  std::string pixel_format_;
+  int bits_;
+  ImageStatsFunction stats_;
+  std::vector<ImageStatistics> slots_;
+
+  // run totals, times in ns
+  mutable std::mutex mutex_;
+  uint64_t frames_;
+  uint64_t bytes_;
+  int64_t time_;
+  int64_t max_time_;
+  std::vector<uint64_t> histogram_;
+  uint64_t pixels_;
+  uint64_t sum_;
+  uint32_t min_;
+  uint32_t max_;
+  uint64_t clipped_;
+  double max_clipped_share_;
+};
+
+#endif
@@ -0,0 +1,404 @@
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include "integrity_check.h"
+#include "report.h"
+
+#if defined(__x86_64__)
+#define INTEGRITY_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_FEATURE_CRC32)
+#define INTEGRITY_ARM_CRC
+#include <arm_acle.h>
+#endif
+
+using namespace std;
+using namespace std::chrono;
+
+// Small enough for a corrupt block to be compared in L1, large enough that
+// the per block setup does not count
+static const size_t BLOCK_SIZE = 16 * 1024;
+
+// Corrupt frames kept for the summary, the log file has all of them
+static const size_t KEPT_CORRUPT_FRAMES = 4096;
+static const size_t PRINTED_CORRUPT_FRAMES = 20;
+
+// Reflected Castagnoli polynomial
+static const uint32_t POLYNOMIAL = 0x82f63b78;
+
+struct CrcTable {
+  uint32_t entry[256];
+
+  CrcTable() {
+    for (uint32_t byte = 0; byte < 256; byte++) {
+      uint32_t crc = byte;
+      for (int bit = 0; bit < 8; bit++)
+        crc = crc & 1 ? (crc >> 1) ^ POLYNOMIAL : crc >> 1;
+      entry[byte] = crc;
+    }
+  }
+};
+
+static const CrcTable CRC_TABLE;
+
+uint32_t Crc32cScalar(const uint8_t * data, size_t size, uint32_t crc) {
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++)
+    crc = (crc >> 8) ^ CRC_TABLE.entry[(crc ^ data[i]) & 0xff];
+  return ~crc;
+}
+
+static void BlockCrcScalar(const uint8_t * data, size_t size, size_t block_size, uint32_t * crcs) {
+  for (size_t begin = 0; begin < size; begin += block_size)
+    *crcs++ = Crc32cScalar(data + begin, min(block_size, size - begin));
+}
+
+static inline uint64_t Load64(const uint8_t * p) {
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+#ifdef INTEGRITY_X86
+
+__attribute__((target("sse4.2")))
+static uint32_t Crc32cSse42(const uint8_t * data, size_t size) {
+  uint64_t crc = 0xffffffff;
+  size_t i = 0;
+
+  for (; i + 8 <= size; i += 8)
+    crc = _mm_crc32_u64(crc, Load64(data + i));
+  for (; i < size; i++)
+    crc = _mm_crc32_u8(uint32_t(crc), data[i]);
+
+  return ~uint32_t(crc);
+}
+
+// crc32 takes three cycles and a new one can start every cycle, so three
+// blocks are run side by side
+__attribute__((target("sse4.2")))
+static void BlockCrcSse42(const uint8_t * data, size_t size, size_t block_size, uint32_t * crcs) {
+  size_t begin = 0;
+
+  for (; begin + 3 * block_size <= size; begin += 3 * block_size) {
+    const uint8_t * a = data + begin;
+    const uint8_t * b = a + block_size;
+    const uint8_t * c = b + block_size;
+    uint64_t crc_a = 0xffffffff, crc_b = 0xffffffff, crc_c = 0xffffffff;
+    size_t i = 0;
+
+    for (; i + 8 <= block_size; i += 8) {
+      crc_a = _mm_crc32_u64(crc_a, Load64(a + i));
+      crc_b = _mm_crc32_u64(crc_b, Load64(b + i));
+      crc_c = _mm_crc32_u64(crc_c, Load64(c + i));
+    }
+    for (; i < block_size; i++) {
+      crc_a = _mm_crc32_u8(uint32_t(crc_a), a[i]);
+      crc_b = _mm_crc32_u8(uint32_t(crc_b), b[i]);
+      crc_c = _mm_crc32_u8(uint32_t(crc_c), c[i]);
+    }
+
+    *crcs++ = ~uint32_t(crc_a);
+    *crcs++ = ~uint32_t(crc_b);
+    *crcs++ = ~uint32_t(crc_c);
+  }
+
+  for (; begin < size; begin += block_size)
+    *crcs++ = Crc32cSse42(data + begin, min(block_size, size - begin));
+}
+
+#endif
+
+#ifdef INTEGRITY_ARM_CRC
+
+static uint32_t Crc32cArm(const uint8_t * data, size_t size) {
+  uint32_t crc = 0xffffffff;
+  size_t i = 0;
+
+  for (; i + 8 <= size; i += 8)
+    crc = __crc32cd(crc, Load64(data + i));
+  for (; i < size; i++)
+    crc = __crc32cb(crc, data[i]);
+
+  return ~crc;
+}
+
+static void BlockCrcArm(const uint8_t * data, size_t size, size_t block_size, uint32_t * crcs) {
+  size_t begin = 0;
+
+  for (; begin + 3 * block_size <= size; begin += 3 * block_size) {
+    const uint8_t * a = data + begin;
+    const uint8_t * b = a + block_size;
+    const uint8_t * c = b + block_size;
+    uint32_t crc_a = 0xffffffff, crc_b = 0xffffffff, crc_c = 0xffffffff;
+    size_t i = 0;
+
+    for (; i + 8 <= block_size; i += 8) {
+      crc_a = __crc32cd(crc_a, Load64(a + i));
+      crc_b = __crc32cd(crc_b, Load64(b + i));
+      crc_c = __crc32cd(crc_c, Load64(c + i));
+    }
+    for (; i < block_size; i++) {
+      crc_a = __crc32cb(crc_a, a[i]);
+      crc_b = __crc32cb(crc_b, b[i]);
+      crc_c = __crc32cb(crc_c, c[i]);
+    }
+
+    *crcs++ = ~crc_a;
+    *crcs++ = ~crc_b;
+    *crcs++ = ~crc_c;
+  }
+
+  for (; begin < size; begin += block_size)
+    *crcs++ = Crc32cArm(data + begin, min(block_size, size - begin));
+}
+
+#endif
+
+static bool Supported(const string & instruction_set) {
+#ifdef INTEGRITY_X86
+  if (instruction_set == "sse4.2")
+    return __builtin_cpu_supports("sse4.2");
+#endif
+#ifdef INTEGRITY_ARM_CRC
+  if (instruction_set == "crc")
+    return true;
+#endif
+  return instruction_set == "scalar";
+}
+
+vector<string> CrcInstructionSets() {
+  vector<string> instruction_sets;
+
+  for (const char * name : { "sse4.2", "crc", "scalar" })
+    if (Supported(name))
+      instruction_sets.push_back(name);
+
+  return instruction_sets;
+}
+
+BlockCrcFunction FindBlockCrc(const string & instruction_set) {
+  if (instruction_set == "auto")
+    return FindBlockCrc(CrcInstructionSets().front());
+
+  if (!Supported(instruction_set))
+    return nullptr;
+
+#ifdef INTEGRITY_X86
+  if (instruction_set == "sse4.2")
+    return BlockCrcSse42;
+#endif
+#ifdef INTEGRITY_ARM_CRC
+  if (instruction_set == "crc")
+    return BlockCrcArm;
+#endif
+  return BlockCrcScalar;
+}
+
+bool CheckBlockCrc(BlockCrcFunction block_crc) {
+  // the check value of CRC32C
+  const char * check = "123456789";
+  uint32_t crc;
+  block_crc(reinterpret_cast<const uint8_t *>(check), 9, 9, &crc);
+  if (crc != 0xe3069283)
+    return false;
+
+  const size_t sizes[][2] = { { 1, 1 }, { 7, 3 }, { 64, 64 }, { 100, 9 }, { 1000, 24 }, { 3 * 4096 + 5, 4096 },
+    { 7 * 333, 333 } };
+  mt19937 random(1);
+
+  for (const auto & size : sizes) {
+    vector<uint8_t> data(size[0]);
+    for (uint8_t & value : data)
+      value = uint8_t(random());
+
+    size_t blocks = (size[0] + size[1] - 1) / size[1];
+    vector<uint32_t> expected(blocks), actual(blocks);
+    BlockCrcScalar(data.data(), data.size(), size[1], expected.data());
+    block_crc(data.data(), data.size(), size[1], actual.data());
+
+    if (actual != expected)
+      return false;
+  }
+
+  return true;
+}
+
+string CorruptFrameLine(const CorruptFrame & corrupt) {
+  ostringstream line;
+
+  line << "frame " << corrupt.frame_id << " at " << fixed << setprecision(3) << corrupt.time << "s, "
+    << corrupt.bytes << " bytes differ from offset " << corrupt.offset << " (row " << corrupt.row << ") in "
+    << corrupt.blocks << (corrupt.blocks == 1 ? " block" : " blocks");
+
+  return line.str();
+}
+
+IntegrityCheck::IntegrityCheck(const string & test_pattern, const string & log_path)
+  : test_pattern_(test_pattern), instruction_set_(CrcInstructionSets().front()),
+    block_crc_(FindBlockCrc(instruction_set_)), confirmed_(false), row_size_(0), reference_frames_(0),
+    verified_(0), corrupt_(0), corrupt_bytes_(0), skipped_(0), checksum_bytes_(0), checksum_time_(0),
+    max_checksum_time_(0) {
+  if (!CheckBlockCrc(block_crc_))
+    throw runtime_error("CRC32C " + instruction_set_ + " differs from the reference");
+
+  log_.Open(log_path);
+}
+
+void IntegrityCheck::PrintInfo(ostream & out) const {
+  out << "Integrity check" << endl
+    << "===============" << endl;
+  out << Label("Test pattern") << test_pattern_ << endl;
+  out << Label("Checksum") << "CRC32C " << instruction_set_ << ", " << BLOCK_SIZE / 1024 << " KB blocks" << endl;
+  out << endl;
+}
+
+void IntegrityCheck::Begin() {
+  begin_ = steady_clock::now();
+  confirmed_ = false;
+  reference_.clear();
+  reference_crcs_.clear();
+}
+
+bool IntegrityCheck::Check(const Frame & frame) {
+  if (frame.incomplete) {
+    skipped_++;
+    return true;
+  }
+
+  crcs_.resize((frame.size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+
+  steady_clock::time_point start = steady_clock::now();
+  block_crc_(frame.data, frame.size, BLOCK_SIZE, crcs_.data());
+  int64_t time = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+
+  checksum_bytes_ += frame.size;
+  checksum_time_ += time;
+  max_checksum_time_ = max(max_checksum_time_, time);
+
+  bool matches = frame.size == reference_.size() && crcs_ == reference_crcs_;
+
+  // a frame nothing agrees with yet is only a candidate for the reference
+  if (!confirmed_) {
+    if (matches && !reference_.empty()) {
+      confirmed_ = true;
+    }
+    else {
+      reference_.assign(frame.data, frame.data + frame.size);
+      reference_crcs_ = crcs_;
+      row_size_ = frame.height > 0 ? frame.size / frame.height : frame.size;
+      reference_frames_++;
+      return true;
+    }
+  }
+
+  verified_++;
+  if (matches)
+    return true;
+
+  CorruptFrame corrupt;
+  corrupt.frame_id = frame.frame_id;
+  corrupt.time = duration<double>(start - begin_).count();
+  corrupt.offset = 0;
+  corrupt.bytes = 0;
+  corrupt.blocks = 0;
+
+  // only the blocks whose checksum differs are compared byte by byte
+  size_t common = min(frame.size, reference_.size());
+  bool found = false;
+  for (size_t block = 0; block * BLOCK_SIZE < common; block++) {
+    size_t begin = block * BLOCK_SIZE;
+    size_t end = min(begin + BLOCK_SIZE, common);
+    // checksums of blocks cut short by a size mismatch cover different bytes
+    bool whole = frame.size == reference_.size()
+      || (begin + BLOCK_SIZE <= frame.size && begin + BLOCK_SIZE <= reference_.size());
+    if (whole && crcs_[block] == reference_crcs_[block])
+      continue;
+
+    uint64_t differing = 0;
+    for (size_t i = begin; i < end; i++) {
+      if (frame.data[i] == reference_[i])
+        continue;
+      if (!found) {
+        corrupt.offset = i;
+        found = true;
+      }
+      differing++;
+    }
+
+    corrupt.bytes += differing;
+    if (differing || !whole)
+      corrupt.blocks++;
+  }
+
+  // a short or long frame differs from where the reference ends
+  if (frame.size != reference_.size()) {
+    corrupt.bytes += max(frame.size, reference_.size()) - common;
+    if (!found)
+      corrupt.offset = common;
+  }
+  corrupt.row = row_size_ > 0 ? corrupt.offset / row_size_ : 0;
+
+  corrupt_++;
+  corrupt_bytes_ += corrupt.bytes;
+  if (corrupt_frames_.size() < KEPT_CORRUPT_FRAMES)
+    corrupt_frames_.push_back(corrupt);
+  Log(frame, corrupt);
+
+  return false;
+}
+
+vector<CorruptFrame> IntegrityCheck::CorruptFrames(size_t first) const {
+  if (first >= corrupt_frames_.size())
+    return vector<CorruptFrame>();
+
+  return vector<CorruptFrame>(corrupt_frames_.begin() + first, corrupt_frames_.end());
+}
+
+void IntegrityCheck::Log(const Frame & frame, const CorruptFrame & corrupt) {
+  log_.WriteRow({
+    NumberField("frame_id", double(corrupt.frame_id)),
+    NumberField("time", corrupt.time),
+    NumberField("size", double(frame.size)),
+    NumberField("offset", double(corrupt.offset)),
+    NumberField("row", double(corrupt.row)),
+    NumberField("bytes", double(corrupt.bytes)),
+    NumberField("blocks", double(corrupt.blocks))
+  });
+}
+
+void IntegrityCheck::PrintSummary(ostream & out) const {
+  ostringstream summary;
+  uint64_t checked = reference_frames_ + verified_;
+
+  summary << Label("Frames verified") << verified_ << ", " << reference_frames_ << " before the reference agreed, "
+    << skipped_ << " incomplete skipped" << endl;
+  if (!confirmed_ && reference_frames_ > 0)
+    summary << Label("Reference") << "no two complete frames agreed, the test pattern has to be static" << endl;
+
+  summary << fixed << setprecision(4);
+  summary << Label("Corrupt frames") << corrupt_;
+  if (verified_ > 0)
+    summary << ", " << double(corrupt_) / verified_ * 100 << "%";
+  summary << endl;
+  summary << Label("Corrupt bytes") << corrupt_bytes_ << endl;
+
+  summary << setprecision(1);
+  summary << Label("Checksum time") << (checked > 0 ? double(checksum_time_) / checked : 0) << "ns/frame, max "
+    << double(max_checksum_time_) << "ns" << endl;
+  summary << setprecision(2);
+  summary << Label("Checksum rate") << (checksum_time_ > 0 ? double(checksum_bytes_) / checksum_time_ : 0)
+    << "GB/s" << endl;
+
+  for (size_t i = 0; i < corrupt_frames_.size() && i < PRINTED_CORRUPT_FRAMES; i++)
+    summary << Label(i ? "" : "Corrupt log") << CorruptFrameLine(corrupt_frames_[i]) << endl;
+  if (corrupt_ > PRINTED_CORRUPT_FRAMES)
+    summary << Label("") << corrupt_ - PRINTED_CORRUPT_FRAMES << " more" << endl;
+
+  out << summary.str();
+}
@@ -0,0 +1,99 @@
+#ifndef INTEGRITY_CHECK_H
+#define INTEGRITY_CHECK_H
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "frame_source.h"
+#include "result_writer.h"
+
+// CRC32C (Castagnoli) of data continuing from crc, one byte at a time. The
+// reference for the vectorized versions.
+uint32_t Crc32cScalar(const uint8_t * data, size_t size, uint32_t crc = 0);
+
+// CRC32C of every block_size bytes of data into crcs, the last block may be
+// shorter. Blocks are independent, so several are run at once to keep the
+// CRC unit busy and a corrupt frame points at the blocks that differ.
+typedef void (*BlockCrcFunction)(const uint8_t * data, size_t size, size_t block_size, uint32_t * crcs);
+
+// Instruction sets with a block CRC that this CPU runs, best first
+std::vector<std::string> CrcInstructionSets();
+
+// Block CRC for "sse4.2", "crc" (ARMv8) or "scalar", or for the best one
+// with "auto". nullptr when the CPU or the build lacks it.
+BlockCrcFunction FindBlockCrc(const std::string & instruction_set);
+
+// Compare block_crc against Crc32cScalar on the check value and on random
+// data of odd sizes. Returns false on the first difference.
+bool CheckBlockCrc(BlockCrcFunction block_crc);
+
+// A frame whose payload differed from the reference
+struct CorruptFrame {
+  uint64_t frame_id;
+  double time;     // seconds since acquisition began
+  uint64_t offset; // first byte that differs
+  uint64_t row;    // row holding that byte
+  uint64_t bytes;  // bytes that differ, including those missing from a short frame
+  uint64_t blocks; // checksum blocks that differ
+};
+
+// One line describing a corrupt frame
+std::string CorruptFrameLine(const CorruptFrame & corrupt);
+
+// Verifies every frame of a static test pattern against a reference frame.
+// The reference is the first complete frame that the next complete frame
+// agrees with, so a reference corrupted itself is not kept. Frames are
+// checksummed per block with CRC32C and only blocks that differ are
+// compared byte by byte, to find where the corruption is. Incomplete frames
+// are left to the loss count. Every corrupt frame is written to the log
+// file. Called on one thread only.
+class IntegrityCheck {
+ public:
+  IntegrityCheck(const std::string & test_pattern, const std::string & log_path);
+
+  void PrintInfo(std::ostream & out) const;
+
+  // Call when acquisition begins, the reference is taken again
+  void Begin();
+
+  // Returns false when the frame differs from the reference
+  bool Check(const Frame & frame);
+
+  uint64_t Verified() const { return verified_; }
+  uint64_t Corrupt() const { return corrupt_; }
+  // Corrupt frames from first on, the first few thousand are kept
+  std::vector<CorruptFrame> CorruptFrames(size_t first = 0) const;
+
+  void PrintSummary(std::ostream & out) const;
+
+ private:
+  void Log(const Frame & frame, const CorruptFrame & corrupt);
+
+  std::string test_pattern_;
+  std::string instruction_set_;
+  BlockCrcFunction block_crc_;
+  ResultWriter log_;
+
+  std::chrono::steady_clock::time_point begin_;
+  bool confirmed_;              // a second frame agreed with the reference
+  std::vector<uint8_t> reference_;
+  std::vector<uint32_t> reference_crcs_;
+  std::vector<uint32_t> crcs_;
+  size_t row_size_;
+
+  uint64_t reference_frames_;   // frames before the reference was confirmed
+  uint64_t verified_;
+  uint64_t corrupt_;
+  uint64_t corrupt_bytes_;
+  uint64_t skipped_;            // incomplete frames
+  std::vector<CorruptFrame> corrupt_frames_;
+
+  // checksum cost, the byte comparisons of corrupt frames are not included
+  uint64_t checksum_bytes_;
+  int64_t checksum_time_;       // ns
+  int64_t max_checksum_time_;
+};
+
+#endif
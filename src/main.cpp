@@ -1,170 +1,267 @@
+#include <algorithm>
 #include <iostream>
-#include <ctime>
-#include <csignal>
+#include <sstream>
+#include <atomic>
+#include <unistd.h>
 #include "Spinnaker.h"
-#include "cpptoml/cpptoml.h"
+#include "acquisition_thread.h"
+#include "config.h"
+#include "demosaic_stage.h"
+#include "frame_source.h"
+#include "image_stats_stage.h"
+#include "integrity_check.h"
+#include "measurement.h"
+#include "report.h"
+#include "multi_camera.h"
+#include "recording_sink.h"
+#include "replay_source.h"
+#include "roi_search.h"
+#include "shutdown_signal.h"
+#include "spinnaker_source.h"
+#include "startup_profile.h"
+#include "sweep.h"
+#include "synthetic_source.h"
+#include "thread_tuning.h"
+#include "trigger_test.h"
 
 using namespace Spinnaker;
 using namespace Spinnaker::GenApi;
 using namespace Spinnaker::GenICam;
 using namespace std;
+using namespace std::chrono;
 
-bool run = true;
+atomic<bool> run(true);
 const string APPLICATION_NAME = "speed_test";
+const int TEST_FAILED = 2;
+
+// Measure frames popped from the acquisition thread until run turns false.
+// The tuning applied to the acquisition thread is written to tuning.
+void ConsumeFrames(FrameSource & source, Measurement & measurement, AcquisitionThread & acquisition,
+    const TestConfig & test_config, ostream & tuning) {
+  AcquiredFrame acquired;
+
+  acquisition.Start();
+
+  // tuned once started, threads created later do not inherit the settings
+  ThreadTuning acquisition_tuning = {test_config.acquisition_cpus, test_config.acquisition_policy,
+    test_config.acquisition_priority};
+  ThreadTuning consumer_tuning = {test_config.consumer_cpus, test_config.consumer_policy,
+    test_config.consumer_priority};
+  tuning << Label("Acquisition thread") << ApplyThreadTuning(acquisition.Handle(), acquisition_tuning) << endl;
+  tuning << Label("Consumer thread") << ApplyThreadTuning(pthread_self(), consumer_tuning) << endl;
+
+  while (run && !measurement.Finished()) {
+    try {
+      if (!acquisition.Pop(acquired))
+        continue;
+    }
+    catch (EndOfStream &e) {
+      break;
+    }
 
-string Label(string str, const size_t num = 20, const char paddingChar = ' ') {
-  if(num > str.size())
-    str.insert(str.end(), num - str.size(), paddingChar);
+    measurement.ProcessFrame(acquired.frame, acquired.arrival);
 
-  return str + ": ";
-}
+    // return the buffer before the bookkeeping
+    source.ReleaseFrame(acquired.frame);
+
+    // print every completed 1 second window
+    if (measurement.RecordFrame(acquired.frame, acquired.arrival))
+      measurement.PrintWindow(cout);
+  }
 
-void RunTest(CameraPtr pCam, string config_file) {
+  acquisition.Stop();
+
+  // frames still in the ring were acquired within the run
   try {
-    // Initialize camera
-    pCam->Init();
-
-    // Initialize configuration
-    auto config = cpptoml::parse_file(config_file);
-
-    // Retrieve GenICam node_map
-    INodeMap & node_map = pCam->GetNodeMap();
-
-    CIntegerPtr ptr_width = node_map.GetNode("Width");
-    CIntegerPtr ptr_height = node_map.GetNode("Height");
-    CIntegerPtr ptr_offset_x = node_map.GetNode("OffsetX");
-    CIntegerPtr ptr_offset_y = node_map.GetNode("OffsetY");
-    CFloatPtr   ptr_exposure_time = node_map.GetNode("ExposureTime");
-
-    CEnumerationPtr ptr_pixel_format = node_map.GetNode("PixelFormat");
-    CEnumerationPtr ptr_acquisition_mode = node_map.GetNode("AcquisitionMode");
-    CEnumerationPtr ptr_auto_exposure = node_map.GetNode("ExposureAuto");
-    CEnumerationPtr ptr_auto_white_balance = node_map.GetNode("BalanceWhiteAuto");
-    CEnumerationPtr ptr_auto_gain = node_map.GetNode("GainAuto");
-    CEnumerationPtr ptr_adc_bit_depth = node_map.GetNode("AdcBitDepth");
-
-    int width = config->get_qualified_as<int>("camera.width").value_or(0);
-    int height = config->get_qualified_as<int>("camera.height").value_or(0);
-    int offset_x = config->get_qualified_as<int>("camera.offset_x").value_or(0);
-    int offset_y = config->get_qualified_as<int>("camera.offset_y").value_or(0);
-    int exposure_time = config->get_qualified_as<int>("camera.exposure_time").value_or(0);
-    string pixel_format = config->get_qualified_as<string>("camera.pixel_format").value_or("");
-    string acquisition_mode = config->get_qualified_as<string>("camera.acquisition_mode").value_or("");
-    string auto_exposure = config->get_qualified_as<string>("camera.auto_exposure").value_or("");
-    string auto_gain = config->get_qualified_as<string>("camera.auto_gain").value_or("");
-    string auto_white_balance = config->get_qualified_as<string>("camera.auto_white_balance").value_or("");
-    string adc_bit_depth = config->get_qualified_as<string>("camera.adc_bit_depth").value_or("");
-
-    // set width
-    ptr_width->SetValue(width);
-
-    // set height
-    ptr_height->SetValue(height);
-
-    // set x offset
-    ptr_offset_x->SetValue(offset_x);
-
-    // set y offset
-    ptr_offset_y->SetValue(offset_y);
-
-    // Set auto white balance mode
-    CEnumEntryPtr ptr_auto_white_balance_node= ptr_auto_white_balance->GetEntryByName(auto_gain.c_str());
-    ptr_auto_white_balance->SetIntValue(ptr_auto_white_balance_node->GetValue());
-
-    // Set auto gain mode
-    CEnumEntryPtr ptr_auto_gain_node = ptr_auto_gain->GetEntryByName(auto_gain.c_str());
-    ptr_auto_gain->SetIntValue(ptr_auto_gain_node->GetValue());
-
-    // Set adc bit depth
-    CEnumEntryPtr ptr_adc_bit_depth_node = ptr_adc_bit_depth->GetEntryByName(adc_bit_depth.c_str());
-    ptr_adc_bit_depth->SetIntValue(ptr_adc_bit_depth_node->GetValue());
-
-    // Set aqcuisition mode
-    CEnumEntryPtr ptr_acquisition_mode_node = ptr_acquisition_mode->GetEntryByName(acquisition_mode.c_str());
-    ptr_acquisition_mode->SetIntValue(ptr_acquisition_mode_node->GetValue());
-
-    // set pixel format
-    CEnumEntryPtr ptr_pixel_format_node = ptr_pixel_format->GetEntryByName(pixel_format.c_str());
-    ptr_pixel_format->SetIntValue(ptr_pixel_format_node->GetValue());
-
-    // set auto exposure mode
-    CEnumEntryPtr ptr_auto_exposure_node = ptr_auto_exposure->GetEntryByName(auto_exposure.c_str());
-    ptr_auto_exposure->SetIntValue(ptr_auto_exposure_node->GetValue());
-
-    // set exposure time
-    ptr_exposure_time->SetValue(exposure_time); // pass value in microseconds
-
-    // Get camera device information.
-    cout << "Camera device information" << endl
-      << "=========================" << endl;
-    cout << Label("Model") << CStringPtr( node_map.GetNode( "DeviceModelName") )->GetValue() << endl;
-    cout << Label("Firmware version") << CStringPtr( node_map.GetNode( "DeviceFirmwareVersion") )->GetValue() << endl;
-    cout << Label("Serial number") << CStringPtr( node_map.GetNode( "DeviceSerialNumber") )->GetValue() << endl;
-    cout << Label("Max resolution") << ptr_width->GetMax() << " x " << ptr_height->GetMax() << endl;
-    cout << Label("Min exposure time") << ptr_exposure_time->GetMin() << endl;
-    cout << endl;
+    while (acquisition.Pop(acquired, microseconds(0))) {
+      measurement.ProcessFrame(acquired.frame, acquired.arrival);
+      source.ReleaseFrame(acquired.frame);
+      measurement.RecordFrame(acquired.frame, acquired.arrival);
+    }
+  }
+  catch (EndOfStream &e) {
+    // a replay without loop ends with its recording
+  }
+}
 
-    // Camera settings
-    cout << "Camera device settings" << endl << "======================" << endl;
-    cout << Label("Acquisition mode") << ptr_acquisition_mode->GetCurrentEntry()->GetSymbolic() << endl;
-    cout << Label("Pixel format") << ptr_pixel_format->GetCurrentEntry()->GetSymbolic() << endl;
-    cout << Label("ADC bit depth") << ptr_adc_bit_depth->GetCurrentEntry()->GetSymbolic() << endl;
-    cout << Label("Auto white balance") << ptr_auto_white_balance->GetCurrentEntry()->GetSymbolic() << endl;
-    cout << Label("Auto gain") << ptr_auto_gain->GetCurrentEntry()->GetSymbolic() << endl;
-    cout << Label("Auto exposure") << ptr_auto_exposure->GetCurrentEntry()->GetSymbolic() << endl;
-    cout << Label("Exposure time") << ptr_exposure_time->GetValue() << endl;
-    cout << Label("Width") << ptr_width->GetValue() << endl;
-    cout << Label("Height") << ptr_height->GetValue() << endl;
-    cout << Label("Offset X") << ptr_offset_x->GetValue() << endl;
-    cout << Label("Offset Y") << ptr_offset_y->GetValue() << endl;
-    cout << endl;
+// Returns false when the test failed or exceeded the loss budget
+bool RunTest(FrameSource & source, shared_ptr<cpptoml::table> config, const string & name,
+    const TestConfig & test_config) {
+  bool initialized = false, patterned = false, acquiring = false;
+
+  try {
+    if (!test_config.demosaic.empty() && !test_config.image_stats.empty())
+      throw runtime_error("Set one of demosaic and image_stats, both are a processing stage");
+
+    // Lock memory before the SDK and the buffers below allocate theirs, so
+    // they are faulted in up front
+    ostringstream tuning;
+    if (test_config.lock_memory)
+      tuning << Label("Memory") << LockMemory() << endl;
+
+    // Initialize source and apply configuration
+    source.Init();
+    initialized = true;
+    if (!test_config.test_pattern.empty()) {
+      if (!source.SetTestPattern(test_config.test_pattern))
+        throw runtime_error("Source has no test pattern " + test_config.test_pattern);
+      patterned = true;
+    }
+    source.PrintInfo(cout);
 
     // Start aqcuisition
-    pCam->BeginAcquisition();
+    // the steady state detector ends warm-up instead of a fixed second
+    Measurement measurement(source, test_config.steady_state ? nanoseconds(0) : nanoseconds(seconds(1)));
+    SteadyState steady_state(test_config.steady_windows, test_config.steady_tolerance,
+      test_config.confidence_tolerance, test_config.max_duration, uint64_t(max(int64_t(0), test_config.max_frames)));
+    if (test_config.steady_state)
+      measurement.SetSteadyState(&steady_state);
+    StallDetector stalls(milliseconds(int64_t(test_config.grab_timeout)), test_config.stall_incomplete_burst,
+      milliseconds(int64_t(test_config.stall_restart_after)), test_config.stall_log);
+    measurement.SetStallDetector(&stalls);
+    AcquisitionThread acquisition(source, size_t(max(1, test_config.ring_size)));
+    acquisition.SetStallDetector(&stalls);
+    if (test_config.acquisition_thread)
+      measurement.SetAcquisitionThread(&acquisition);
+
+    // Verify every frame against the test pattern
+    unique_ptr<IntegrityCheck> integrity;
+    if (!test_config.test_pattern.empty()) {
+      integrity.reset(new IntegrityCheck(test_config.test_pattern, test_config.integrity_log));
+      integrity->PrintInfo(cout);
+      measurement.SetIntegrityCheck(integrity.get());
+    }
 
-    time_t time_begin = time(0);
-    int frame_counter = 0;
-    bool warmed = false;
+    // Allocate recording buffers and files before the first frame
+    unique_ptr<RecordingSink> sink;
+    if (!test_config.record_path.empty()) {
+      // every file keeps the settings it was recorded with
+      ostringstream settings, info;
+      if (config->get_table("camera"))
+        settings << *config->get_table("camera");
+      source.PrintInfo(info);
+
+      sink.reset(new RecordingSink(test_config));
+      sink->Open(source.PayloadSize(), LoadCameraConfig(config, name), settings.str(), info.str());
+      sink->PrintInfo(cout);
+      measurement.SetRecordingSink(sink.get());
+    }
 
-    cout << "Camera fps measuring" << endl
-      << "====================" << endl;
+    // Check the processing stage against its reference before the first frame
+    unique_ptr<ProcessingStage> stage;
+    unique_ptr<ProcessingExecutor> executor;
+    if (!test_config.demosaic.empty())
+      stage.reset(new DemosaicStage(test_config.demosaic, LoadCameraConfig(config, name)));
+    else if (!test_config.image_stats.empty())
+      stage.reset(new ImageStatsStage(test_config.image_stats, LoadCameraConfig(config, name)));
+
+    if (stage) {
+      stage->PrintInfo(cout);
+
+      if (test_config.processing_threads > 0) {
+        executor.reset(new ProcessingExecutor(*stage, test_config.processing_threads,
+          test_config.processing_stripes, test_config.processing_slots));
+        measurement.SetProcessingExecutor(executor.get());
+      }
+      else {
+        stage->Reserve(1);
+        measurement.SetProcessingStage(stage.get());
+      }
+    }
 
-    while (run) {
-      ImagePtr pResultImage = pCam->GetNextImage();
-      pResultImage->Release();
+    measurement.BeginAcquisition();
+    acquiring = true;
 
-      // 1 second passed
-      if ((time(0) - time_begin) == 1) {
-        if(warmed)
-          cout << frame_counter << "fps" << endl;
-        else
-          warmed = true;
+    cout << "Camera fps measuring" << endl
+      << "====================" << endl;
 
-        frame_counter = 0;
-        time_begin = std::time(0);
+    if (test_config.acquisition_thread) {
+      ConsumeFrames(source, measurement, acquisition, test_config, tuning);
+    }
+    else {
+      // this thread acquires, tuned after the SDK started its own threads
+      ThreadTuning acquisition_tuning = {test_config.acquisition_cpus, test_config.acquisition_policy,
+        test_config.acquisition_priority};
+      tuning << Label("Acquisition thread") << ApplyThreadTuning(pthread_self(), acquisition_tuning) << endl;
+
+      try {
+        while (run && !measurement.Finished()) {
+          // print every completed 1 second window
+          if (measurement.AcquireFrame())
+            measurement.PrintWindow(cout);
+        }
+      }
+      catch (EndOfStream &e) {
+        // a replay without loop ends with its recording
       }
-
-      frame_counter++;
     }
 
+    acquiring = false;
+    measurement.EndAcquisition();
+
+    // Wait for storage to take the frames still being written
+    if (sink)
+      sink->Close();
+
+    cout << endl;
+    measurement.PrintSummary(cout);
+    cout << tuning.str();
+    PrintLossBudget(cout, test_config, measurement.WithinLossBudget(test_config.loss_budget));
     cout << endl;
 
-    // Deinitialize camera
-    pCam->EndAcquisition();
-    pCam->DeInit();
+    // Deinitialize source, sending the image again
+    if (patterned) {
+      patterned = false;
+      source.SetTestPattern("Off");
+    }
+    initialized = false;
+    source.DeInit();
+
+    return measurement.WithinLossBudget(test_config.loss_budget);
   }
-  catch (Spinnaker::Exception &e) {
+  catch (std::exception &e) {
     cout << "Error: " << e.what() << endl;
+
+    // the test pattern stays on the camera until power-off, the first
+    // error is the one reported
+    try {
+      if (acquiring)
+        source.EndAcquisition();
+      if (patterned)
+        source.SetTestPattern("Off");
+      if (initialized)
+        source.DeInit();
+    }
+    catch (std::exception &e) {
+    }
+    return false;
   }
 }
 
-void stop(int param) {
-  run = false;
+// Run the configured test mode on the given sources, returns the exit code
+int RunTests(vector<unique_ptr<FrameSource>> & sources, const vector<string> & names,
+    shared_ptr<cpptoml::table> config, const TestConfig & test_config) {
+  bool passed;
+
+  if (test_config.mode == "multi")
+    passed = RunMultiCameraTest(sources, names, test_config, run);
+  else if (test_config.mode == "sweep" || test_config.mode == "buffer_sweep")
+    passed = RunSweep(*sources.front(), config, names.front(), test_config, run);
+  else if (test_config.mode == "roi_search")
+    passed = RunRoiSearch(*sources.front(), config, names.front(), test_config, run);
+  else if (test_config.mode == "processing_sweep" || test_config.mode == "convert_sweep")
+    passed = RunProcessingSweep(*sources.front(), config, names.front(), test_config, run);
+  else if (test_config.mode == "trigger")
+    passed = RunTriggerTest(*sources.front(), test_config, run);
+  else
+    passed = RunTest(*sources.front(), config, names.front(), test_config);
+
+  return passed ? 0 : TEST_FAILED;
 }
 
 int main(int argc, char **argv) {
-  // Catch interupt to stop test loop
-  signal(SIGINT, stop);
+  // Catch interupt to stop test loop, a second one ends the process
+  ShutdownSignal shutdown(run);
 
   // Check if config file path is passed as argument
   if (argc != 2) {
@@ -183,23 +280,119 @@ int main(int argc, char **argv) {
     exit(0);
   }
 
+  // Initialize configuration
+  shared_ptr<cpptoml::table> config;
+  TestConfig test_config;
+  CameraConfig camera_config;
+  vector<string> serials;
+  try {
+    config = cpptoml::parse_file(config_file);
+    test_config = LoadTestConfig(config);
+    camera_config = LoadCameraConfig(config);
+    serials = LoadCameraSerials(config);
+  }
+  catch (cpptoml::parse_exception &e) {
+    cerr << "Config file is not valid: " << e.what() << endl;
+    return -1;
+  }
+
+  bool sweep = test_config.mode == "sweep" || test_config.mode == "buffer_sweep";
+
+  if (test_config.mode != "single" && test_config.mode != "multi" && test_config.mode != "roi_search"
+      && test_config.mode != "processing_sweep" && test_config.mode != "convert_sweep" && test_config.mode != "trigger"
+      && test_config.mode != "startup" && !sweep) {
+    cerr << "Unknown test mode " << test_config.mode << endl;
+    return -1;
+  }
+
+  // The startup profile brings the system up and down itself, every run
+  if (test_config.mode == "startup")
+    return RunStartupProfile(config, test_config, run) ? 0 : TEST_FAILED;
+
+  // The buffer sweep is a sweep over the stream buffer settings
+  if (test_config.mode == "buffer_sweep")
+    config = BufferSweepConfig(config, test_config);
+
+  vector<SweepAxis> axes = FindSweepAxes(config);
+
+  if (!axes.empty() && !sweep) {
+    cerr << "Arrays in [camera] need mode = \"sweep\"" << endl;
+    return -1;
+  }
+
+  // Sources start out with the first combination of a sweep
+  shared_ptr<cpptoml::table> source_config = SweepPointConfig(config, axes, 0);
+
+  // Only multi camera mode tests more than the first listed camera
+  if (test_config.mode != "multi" && serials.size() > 1)
+    serials.resize(1);
+
+  vector<unique_ptr<FrameSource>> sources;
+
+  if (camera_config.source == "synthetic" || camera_config.source == "replay") {
+    // No hardware involved, skip Spinnaker system setup
+    for (const string & serial : serials) {
+      if (camera_config.source == "replay")
+        sources.push_back(unique_ptr<FrameSource>(new ReplaySource(LoadCameraConfig(source_config, serial))));
+      else
+        sources.push_back(unique_ptr<FrameSource>(new SyntheticSource(LoadCameraConfig(source_config, serial))));
+    }
+
+    if (sources.empty()) {
+      cerr << "No camera simulated" << endl;
+      return -1;
+    }
+
+    return RunTests(sources, serials, config, test_config);
+  }
+  else if (camera_config.source != "spinnaker") {
+    cerr << "Unknown camera source " << camera_config.source << endl;
+    return -1;
+  }
+
   // Retrieve singleton reference to system object
   SystemPtr system = System::GetInstance();
 
   // Retrieve list of cameras from the system
   CameraList camList = system->GetCameras();
 
-  if(camList.GetSize() == 0) {
+  if (serials.empty()) {
+    // Test every connected camera, or only the first in single camera mode
+    unsigned int count = test_config.mode == "multi" ? camList.GetSize() : min(camList.GetSize(), 1u);
+
+    for (unsigned int i = 0; i < count; i++) {
+      CameraPtr pCam = camList.GetByIndex(i);
+      INodeMap & tl_node_map = pCam->GetTLDeviceNodeMap();
+      serials.push_back(string(CStringPtr(tl_node_map.GetNode("DeviceSerialNumber"))->GetValue().c_str()));
+    }
+  }
+
+  for (const string & serial : serials) {
+    CameraPtr pCam = camList.GetBySerial(serial);
+
+    if (!pCam.IsValid()) {
+      cerr << "Camera " << serial << " is not connected" << endl;
+      sources.clear();
+      break;
+    }
+
+    sources.push_back(unique_ptr<FrameSource>(new SpinnakerSource(pCam, LoadCameraConfig(source_config, serial))));
+  }
+
+  int exit_code = -1;
+
+  if(sources.empty()) {
     cerr << "No camera connected" << endl;
-    return -1;
   }
   else {
-    // Run tests on first available camera
-    RunTest(camList.GetByIndex(0), config_file);
+    exit_code = RunTests(sources, serials, config, test_config);
   }
 
-  // Clear camera list before releasing system
+  // Release cameras and clear camera list before releasing system
+  sources.clear();
   camList.Clear();
   // Release system
   system->ReleaseInstance();
+
+  return exit_code;
 }
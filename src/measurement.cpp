@@ -0,0 +1,432 @@
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include "measurement.h"
+#include "report.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Latch samples taken before acquisition starts to get a first clock fit
+static const int INITIAL_CLOCK_SAMPLES = 8;
+// Corrupt frames printed per window, the summary and the log list more
+static const size_t PRINTED_CORRUPT_FRAMES = 5;
+
+Measurement::Measurement(FrameSource & source, nanoseconds warmup)
+  : source_(source), acquisition_(nullptr), sink_(nullptr), stage_(nullptr), executor_(nullptr),
+    steady_state_(nullptr), stalls_(nullptr), printed_stalls_(0), integrity_(nullptr), integrity_last_(0),
+    printed_corrupt_(0), stats_(seconds(1), warmup), has_frame_id_(false), last_frame_id_(0),
+    has_stream_counters_(false), has_link_(false), frames_(0) {
+}
+
+void Measurement::BeginAcquisition() {
+  for (int i = 0; i < INITIAL_CLOCK_SAMPLES; i++)
+    SampleClock();
+
+  source_.BeginAcquisition();
+  if (stalls_)
+    stalls_->Begin();
+  if (integrity_) {
+    integrity_->Begin();
+    integrity_last_ = integrity_->Corrupt();
+  }
+
+  has_stream_counters_ = source_.ReadStreamCounters(stream_begin_);
+  stream_last_ = stream_current_ = stream_begin_;
+
+  has_link_ = source_.ReadLinkStatus(link_);
+
+  if (sink_) {
+    recording_last_ = recording_current_ = sink_->Counters();
+    recording_last_time_ = recording_current_time_ = steady_clock::now();
+  }
+
+  frames_ = 0;
+  host_begin_ = host_last_ = host_current_ = ReadHostUsage();
+}
+
+void Measurement::EndAcquisition() {
+  ReadStreamCounters();
+  if (stalls_)
+    stalls_->End();
+  source_.EndAcquisition();
+
+  // frames still being processed were acquired within the run
+  CollectProcessedFrames(true);
+  host_current_ = ReadHostUsage();
+}
+
+void Measurement::SetProcessingExecutor(ProcessingExecutor * executor) {
+  executor_ = executor;
+  stats_.SetProcessingThreads(executor ? executor->Threads() : 1);
+}
+
+bool Measurement::AcquireFrame() {
+  steady_clock::time_point arrival;
+
+  if (!stalls_) {
+    source_.GetNextFrame(frame_);
+    arrival = steady_clock::now();
+  }
+  else if (!stalls_->Grab(source_, frame_, arrival)) {
+    return false;
+  }
+
+  ProcessFrame(frame_, arrival);
+  source_.ReleaseFrame(frame_);
+
+  return RecordFrame(frame_, arrival);
+}
+
+void Measurement::ProcessFrame(const Frame & frame, steady_clock::time_point arrival) {
+  if (integrity_)
+    integrity_->Check(frame);
+
+  // the payload is copied before the buffer goes back to the source
+  if (sink_)
+    sink_->Write(frame, arrival);
+
+  if (executor_) {
+    executor_->Submit(frame, arrival);
+    CollectProcessedFrames(false);
+  }
+  else if (stage_) {
+    steady_clock::time_point begin = steady_clock::now();
+    stage_->Process(frame, 0, 0, frame.height);
+    stats_.AddProcessingTime(duration_cast<nanoseconds>(steady_clock::now() - begin).count());
+  }
+}
+
+void Measurement::CollectProcessedFrames(bool wait) {
+  if (!executor_)
+    return;
+
+  processed_.clear();
+  executor_->Collect(processed_, wait);
+
+  for (const ProcessedFrame & processed : processed_)
+    stats_.AddProcessingTime(processed.work_time);
+}
+
+bool Measurement::RecordFrame(const Frame & frame, steady_clock::time_point arrival) {
+  bool window_closed = stats_.AddFrame(arrival, frame.size);
+  frames_++;
+
+  if (frame.timestamp && clock_.Ready())
+    stats_.AddLatency(duration_cast<nanoseconds>(arrival.time_since_epoch()).count() - clock_.ToHost(frame.timestamp));
+
+  // Frame IDs count up by one per frame on the camera, a jump means frames
+  // never made it to the host. Going backwards means the counter was reset.
+  uint64_t lost = 0;
+  if (has_frame_id_ && frame.frame_id > last_frame_id_)
+    lost = frame.frame_id - last_frame_id_ - 1;
+  stats_.AddLoss(lost, frame.incomplete);
+
+  has_frame_id_ = true;
+  last_frame_id_ = frame.frame_id;
+
+  // Latching costs a round trip to the camera, once per window is enough to
+  // follow the drift
+  if (window_closed) {
+    SampleClock();
+    ReadStreamCounters();
+    ReadRecordingCounters();
+    ReadLinkStatus();
+    host_last_ = host_current_;
+    host_current_ = ReadHostUsage();
+
+    // counters start over together with the run totals
+    if (steady_state_ && steady_state_->AddWindow(stats_.WindowSeconds(), stats_.WindowFrames(),
+        stats_.WindowFps(), stats_.WindowIntervals().StdDev(), stats_.WindowIntervals().Percentile(99))) {
+      stats_.RestartRun();
+      stream_begin_ = stream_current_;
+      host_begin_ = host_current_;
+    }
+  }
+
+  return window_closed;
+}
+
+void Measurement::SampleClock() {
+  ClockSample sample;
+
+  if (source_.SampleClock(sample))
+    clock_.AddSample(sample);
+}
+
+void Measurement::ReadStreamCounters() {
+  if (!has_stream_counters_)
+    return;
+
+  stream_last_ = stream_current_;
+  source_.ReadStreamCounters(stream_current_);
+}
+
+void Measurement::ReadLinkStatus() {
+  // the link speed can change when the device renegotiates
+  if (has_link_)
+    source_.ReadLinkStatus(link_);
+}
+
+// Bytes per second against the throughput limit or else the link speed
+static double Utilisation(double bytes_per_second, const LinkStatus & link) {
+  double ceiling = link.throughput_limit > 0 ? link.throughput_limit : link.speed;
+  return ceiling > 0 ? bytes_per_second / ceiling : 0;
+}
+
+double Measurement::LinkUtilisation() const {
+  return has_link_ ? Utilisation(stats_.RunBytesPerSecond(), link_) : 0;
+}
+
+double Measurement::WindowLinkUtilisation() const {
+  return has_link_ ? Utilisation(stats_.WindowBytesPerSecond(), link_) : 0;
+}
+
+void Measurement::ReadRecordingCounters() {
+  if (!sink_)
+    return;
+
+  recording_last_ = recording_current_;
+  recording_last_time_ = recording_current_time_;
+  recording_current_ = sink_->Counters();
+  recording_current_time_ = steady_clock::now();
+}
+
+Measurement::HostUsage Measurement::ReadHostUsage() const {
+  HostUsage usage;
+
+  usage.time = steady_clock::now();
+  usage.process = ReadProcessUsage();
+  usage.frames = frames_;
+
+  // without an acquisition thread frames are acquired where they are recorded
+  if (acquisition_) {
+    usage.acquisition_time = acquisition_->CpuTime();
+    usage.consumer_time = ThreadCpuTime();
+  }
+  else {
+    usage.acquisition_time = ThreadCpuTime();
+    usage.consumer_time = 0;
+  }
+
+  usage.worker_time = executor_ ? executor_->CpuTime() : 0;
+  return usage;
+}
+
+bool Measurement::WithinLossBudget(double loss_budget) const {
+  double storage_loss = 0;
+
+  if (sink_) {
+    const RecordingCounters & counters = sink_->Counters();
+    uint64_t frames = counters.submissions + counters.dropped_frames;
+    if (frames > 0)
+      storage_loss = double(counters.dropped_frames) / frames;
+  }
+
+  double processing_loss = 0;
+  if (executor_) {
+    uint64_t frames = executor_->Processed() + executor_->Dropped();
+    if (frames > 0)
+      processing_loss = double(executor_->Dropped()) / frames;
+  }
+
+  // a corrupt frame is as good as a lost one
+  double corrupt_loss = 0;
+  if (integrity_ && integrity_->Verified() > 0)
+    corrupt_loss = double(integrity_->Corrupt()) / integrity_->Verified();
+
+  return stats_.RunLossRatio() + storage_loss + processing_loss + corrupt_loss <= loss_budget;
+}
+
+// CPU time as a share of one core over the given wall time, in percent
+static double CpuShare(int64_t time, double seconds) {
+  return seconds > 0 ? time / seconds / 1e7 : 0;
+}
+
+int64_t Measurement::OtherCpuTime(const HostUsage & begin, const HostUsage & end) {
+  ProcessUsage process = end.process - begin.process;
+  int64_t ours = end.acquisition_time - begin.acquisition_time + end.consumer_time - begin.consumer_time
+    + end.worker_time - begin.worker_time;
+
+  // thread clocks and getrusage are read a moment apart
+  return max(int64_t(0), process.user_time + process.system_time - ours);
+}
+
+// Sum of all stream counters, each of them means a frame that was not delivered
+static uint64_t StreamDrops(const StreamCounters & counters) {
+  return counters.lost_frames + counters.dropped_frames + counters.failed_buffers + counters.buffer_underruns;
+}
+
+void Measurement::PrintWindow(ostream & out) {
+  ostringstream line;
+
+  line << stats_.WindowLine();
+  if (has_link_ && (link_.throughput_limit > 0 || link_.speed > 0))
+    line << fixed << setprecision(1) << "  " << stats_.WindowBytesPerSecond() / 1e6 << "MB/s link "
+      << WindowLinkUtilisation() * 100 << "%";
+  if (has_stream_counters_)
+    line << "  stream drops " << StreamDrops(stream_current_) - StreamDrops(stream_last_);
+  if (sink_) {
+    double seconds = duration<double>(recording_current_time_ - recording_last_time_).count();
+    uint64_t submissions = recording_current_.submissions - recording_last_.submissions;
+    uint64_t depth_sum = recording_current_.queue_depth_sum - recording_last_.queue_depth_sum;
+
+    line << fixed << setprecision(1) << "  write "
+      << (seconds > 0 ? (recording_current_.bytes_written - recording_last_.bytes_written) / seconds / 1e6 : 0)
+      << "MB/s qd " << (submissions > 0 ? double(depth_sum) / submissions : 0)
+      << " storage drops " << recording_current_.dropped_frames - recording_last_.dropped_frames;
+  }
+  if (executor_)
+    line << "  reorder " << executor_->ReorderDepth() << " peak " << executor_->MaxReorderDepth()
+      << " processing drops " << executor_->Dropped();
+  if (integrity_) {
+    line << "  corrupt " << integrity_->Corrupt() - integrity_last_;
+    integrity_last_ = integrity_->Corrupt();
+  }
+  if (steady_state_)
+    line << steady_state_->WindowLine();
+  if (acquisition_)
+    line << "  ring " << acquisition_->Occupancy() << "/" << acquisition_->Capacity()
+      << " peak " << acquisition_->HighWaterMark() << " overflows " << acquisition_->Overflows();
+
+  double seconds = duration<double>(host_current_.time - host_last_.time).count();
+  ProcessUsage process = host_current_.process - host_last_.process;
+  int64_t cpu_time = process.user_time + process.system_time;
+
+  // shares of one core over the window
+  line << fixed << setprecision(1)
+    << "  cpu " << CpuShare(cpu_time, seconds)
+    << "% usr " << CpuShare(process.user_time, seconds)
+    << " sys " << CpuShare(process.system_time, seconds)
+    << " acq " << CpuShare(host_current_.acquisition_time - host_last_.acquisition_time, seconds);
+  if (acquisition_)
+    line << " consumer " << CpuShare(host_current_.consumer_time - host_last_.consumer_time, seconds);
+  if (executor_)
+    line << " workers " << CpuShare(host_current_.worker_time - host_last_.worker_time, seconds);
+  line << " other " << CpuShare(OtherCpuTime(host_last_, host_current_), seconds)
+    << "  cs " << process.voluntary_switches << "/" << process.involuntary_switches
+    << "  faults " << process.minor_faults << "/" << process.major_faults
+    << setprecision(0) << "  frames/cpu-s "
+    << (cpu_time > 0 ? (host_current_.frames - host_last_.frames) / (cpu_time / 1e9) : 0);
+
+  line << endl;
+
+  // stalls that ended since the last window
+  if (stalls_) {
+    vector<Stall> stalls = stalls_->Stalls(printed_stalls_);
+    for (const Stall & stall : stalls)
+      line << "Stall: " << StallLine(stall) << endl;
+    printed_stalls_ += stalls.size();
+  }
+
+  // corrupt frames since the last window, a few of them
+  if (integrity_) {
+    vector<CorruptFrame> corrupt = integrity_->CorruptFrames(printed_corrupt_);
+    for (size_t i = 0; i < corrupt.size() && i < PRINTED_CORRUPT_FRAMES; i++)
+      line << "Corrupt: " << CorruptFrameLine(corrupt[i]) << endl;
+    if (corrupt.size() > PRINTED_CORRUPT_FRAMES)
+      line << "Corrupt: " << corrupt.size() - PRINTED_CORRUPT_FRAMES << " more frames" << endl;
+    printed_corrupt_ += corrupt.size();
+  }
+
+  out << line.str();
+}
+
+// Link bandwidth in MB/s, when the device reports it
+static string LinkRate(double bytes_per_second) {
+  ostringstream rate;
+
+  if (bytes_per_second > 0)
+    rate << fixed << setprecision(1) << bytes_per_second / 1e6 << "MB/s";
+  else
+    rate << "unknown";
+
+  return rate.str();
+}
+
+void Measurement::PrintSummary(ostream & out, const string & title) const {
+  ostringstream summary;
+
+  stats_.PrintSummary(summary, title);
+  if (steady_state_)
+    steady_state_->PrintSummary(summary);
+
+  if (has_stream_counters_) {
+    summary << Label("Stream lost") << stream_current_.lost_frames - stream_begin_.lost_frames << endl;
+    summary << Label("Stream dropped") << stream_current_.dropped_frames - stream_begin_.dropped_frames << endl;
+    summary << Label("Stream failed") << stream_current_.failed_buffers - stream_begin_.failed_buffers << endl;
+    summary << Label("Stream underruns") << stream_current_.buffer_underruns - stream_begin_.buffer_underruns << endl;
+  }
+
+  if (has_link_) {
+    summary << fixed << setprecision(1);
+    summary << Label("Link speed") << LinkRate(link_.speed) << endl;
+    summary << Label("Throughput limit") << LinkRate(link_.throughput_limit) << endl;
+    summary << Label("Device throughput") << LinkRate(link_.current_throughput) << endl;
+    if (link_.throughput_limit > 0 || link_.speed > 0)
+      summary << Label("Link utilisation") << LinkUtilisation() * 100 << "% of "
+        << (link_.throughput_limit > 0 ? "throughput limit" : "link speed") << endl;
+  }
+
+  if (sink_) {
+    const RecordingCounters & counters = sink_->Counters();
+
+    summary << fixed << setprecision(1);
+    summary << Label("Recorded frames") << counters.frames_written << endl;
+    summary << Label("Recorded data") << counters.bytes_written / 1e6 << "MB" << endl;
+    summary << Label("Write throughput")
+      << (counters.seconds > 0 ? counters.bytes_written / counters.seconds / 1e6 : 0) << "MB/s" << endl;
+    summary << Label("Queue depth mean")
+      << (counters.submissions > 0 ? double(counters.queue_depth_sum) / counters.submissions : 0) << endl;
+    summary << Label("Queue depth max") << counters.max_queue_depth << endl;
+    summary << Label("Storage drops") << counters.dropped_frames << endl;
+  }
+
+  if (executor_)
+    executor_->PrintSummary(summary);
+  else if (stage_)
+    stage_->PrintSummary(summary);
+
+  if (stalls_)
+    stalls_->PrintSummary(summary);
+
+  if (integrity_)
+    integrity_->PrintSummary(summary);
+
+  if (acquisition_) {
+    summary << Label("Ring size") << acquisition_->Capacity() << endl;
+    summary << Label("Ring high water") << acquisition_->HighWaterMark() << endl;
+    summary << Label("Ring overflows") << acquisition_->Overflows() << endl;
+  }
+
+  PrintHostUsage(summary, host_begin_, host_current_);
+
+  if (clock_.Ready()) {
+    summary << fixed << setprecision(3);
+    summary << Label("Clock drift") << clock_.DriftPpm() << " ppm" << endl;
+    summary << Label("Clock fit error") << clock_.FitError() / 1000 << "us" << endl;
+  }
+
+  out << summary.str();
+}
+
+void Measurement::PrintHostUsage(ostream & out, const HostUsage & begin, const HostUsage & end) const {
+  double seconds = duration<double>(end.time - begin.time).count();
+  ProcessUsage process = end.process - begin.process;
+  int64_t cpu_time = process.user_time + process.system_time;
+
+  out << fixed << setprecision(1);
+  out << Label("CPU process") << CpuShare(cpu_time, seconds) << "% of a core, user "
+    << CpuShare(process.user_time, seconds) << "% system " << CpuShare(process.system_time, seconds) << "%" << endl;
+  out << Label("CPU acquisition") << CpuShare(end.acquisition_time - begin.acquisition_time, seconds) << "%" << endl;
+  if (acquisition_)
+    out << Label("CPU consumer") << CpuShare(end.consumer_time - begin.consumer_time, seconds) << "%" << endl;
+  if (executor_)
+    out << Label("CPU workers") << CpuShare(end.worker_time - begin.worker_time, seconds) << "%" << endl;
+  out << Label("CPU other threads") << CpuShare(OtherCpuTime(begin, end), seconds) << "%" << endl;
+  out << Label("Context switches") << process.voluntary_switches << " voluntary, "
+    << process.involuntary_switches << " involuntary" << endl;
+  out << Label("Page faults") << process.minor_faults << " minor, " << process.major_faults << " major" << endl;
+  out << setprecision(0) << Label("Frames per CPU-s")
+    << (cpu_time > 0 ? (end.frames - begin.frames) / (cpu_time / 1e9) : 0) << endl;
+}
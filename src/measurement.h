@@ -0,0 +1,156 @@
+#ifndef MEASUREMENT_H
+#define MEASUREMENT_H
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include "acquisition_thread.h"
+#include "clock_sync.h"
+#include "cpu_usage.h"
+#include "frame_source.h"
+#include "frame_stats.h"
+#include "integrity_check.h"
+#include "processing_executor.h"
+#include "processing_stage.h"
+#include "recording_sink.h"
+#include "stall_detector.h"
+#include "steady_state.h"
+
+// Acquires frames from a source and measures each of them: arrival
+// interval, throughput, the latency from end of exposure to the return of
+// GetNextFrame and frames lost on the way, seen as gaps in the frame IDs.
+// Latency needs device timestamps mapped onto the host clock, the device
+// clock is latched at the start and once per reporting window together with
+// the stream counters. Host cost is sampled along with them: CPU time of
+// the process and of the threads frames pass through, context switches and
+// page faults. BeginAcquisition, EndAcquisition and RecordFrame must all be
+// called on the same thread.
+class Measurement {
+ public:
+  explicit Measurement(FrameSource & source, std::chrono::nanoseconds warmup = std::chrono::seconds(1));
+
+  void BeginAcquisition();
+  void EndAcquisition();
+
+  // Acquire, measure and release one frame. Returns true when the frame
+  // closed a reporting window, false as well when no frame came within the
+  // grab timeout of the stall detector.
+  bool AcquireFrame();
+
+  // Check a frame acquired elsewhere, write it to the recording sink and
+  // run the processing stage on it, before its buffer is released
+  void ProcessFrame(const Frame & frame, std::chrono::steady_clock::time_point arrival);
+
+  // Measure a frame acquired elsewhere, arrival is when GetNextFrame
+  // returned it. Returns true when the frame closed a reporting window.
+  bool RecordFrame(const Frame & frame, std::chrono::steady_clock::time_point arrival);
+
+  // Report ring occupancy of the thread frames are acquired on
+  void SetAcquisitionThread(const AcquisitionThread * acquisition) { acquisition_ = acquisition; }
+
+  // Write every acquired frame to the sink and report its bandwidth, queue
+  // depth and drops
+  void SetRecordingSink(RecordingSink * sink) { sink_ = sink; }
+
+  // Run the stage on every acquired frame and report the time it takes
+  void SetProcessingStage(ProcessingStage * stage) { stage_ = stage; }
+
+  // Hand every acquired frame to the executor instead and report its
+  // reorder buffer, drops and the time its workers spend per frame
+  void SetProcessingExecutor(ProcessingExecutor * executor);
+
+  // Acquire through the detector and report the stalls it logs. With an
+  // acquisition thread the thread has to grab through it as well.
+  void SetStallDetector(StallDetector * stalls) { stalls_ = stalls; }
+
+  // Check every acquired frame against the test pattern and report the
+  // corrupt ones
+  void SetIntegrityCheck(IntegrityCheck * integrity) { integrity_ = integrity; }
+
+  // Let the detector decide when warm-up ends, the run totals start over
+  // then, and when enough was measured. Construct with a warm-up of 0.
+  void SetSteadyState(SteadyState * steady_state) { steady_state_ = steady_state; }
+
+  // Whether the steady state detector has measured enough
+  bool Finished() const { return steady_state_ && steady_state_->Done(); }
+
+  const FrameStats & Stats() const { return stats_; }
+  const ClockSync & Clock() const { return clock_; }
+
+  // Share of the link the frames used over the run: payload bytes per second
+  // against the throughput limit, or the link speed without one. 0 when
+  // neither is known.
+  double LinkUtilisation() const;
+  double WindowLinkUtilisation() const;
+
+  // Whether lost and incomplete frames and frames storage or processing
+  // could not take stayed within the given share
+  bool WithinLossBudget(double loss_budget) const;
+
+  // Stalls are printed once, in the window after they ended
+  void PrintWindow(std::ostream & out);
+  void PrintSummary(std::ostream & out, const std::string & title = "Summary") const;
+
+ private:
+  void SampleClock();
+  void ReadStreamCounters();
+  void ReadRecordingCounters();
+  void ReadLinkStatus();
+  void CollectProcessedFrames(bool wait);
+
+  // Process and thread CPU time, context switches and page faults at one
+  // point, thread times in ns
+  struct HostUsage {
+    std::chrono::steady_clock::time_point time;
+    ProcessUsage process;
+    int64_t acquisition_time; // thread calling GetNextFrame
+    int64_t consumer_time;    // thread recording frames, when that is another one
+    int64_t worker_time;      // processing executor
+    uint64_t frames;
+  };
+
+  HostUsage ReadHostUsage() const;
+  // CPU time of the threads that are none of ours, the SDK's own and the
+  // recording writer
+  static int64_t OtherCpuTime(const HostUsage & begin, const HostUsage & end);
+  void PrintHostUsage(std::ostream & out, const HostUsage & begin, const HostUsage & end) const;
+
+  FrameSource & source_;
+  const AcquisitionThread * acquisition_;
+  RecordingSink * sink_;
+  ProcessingStage * stage_;
+  ProcessingExecutor * executor_;
+  SteadyState * steady_state_;
+  StallDetector * stalls_;
+  size_t printed_stalls_;
+  IntegrityCheck * integrity_;
+  uint64_t integrity_last_;  // corrupt frames at the last window
+  size_t printed_corrupt_;
+  std::vector<ProcessedFrame> processed_;
+  FrameStats stats_;
+  ClockSync clock_;
+  Frame frame_;
+
+  bool has_frame_id_;
+  uint64_t last_frame_id_;
+
+  bool has_stream_counters_;
+  StreamCounters stream_begin_;
+  StreamCounters stream_last_;
+  StreamCounters stream_current_;
+
+  bool has_link_;
+  LinkStatus link_;
+
+  RecordingCounters recording_last_;
+  RecordingCounters recording_current_;
+  std::chrono::steady_clock::time_point recording_last_time_;
+  std::chrono::steady_clock::time_point recording_current_time_;
+
+  uint64_t frames_;
+  HostUsage host_begin_;
+  HostUsage host_last_;
+  HostUsage host_current_;
+};
+
+#endif
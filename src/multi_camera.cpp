@@ -0,0 +1,264 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include "multi_camera.h"
+#include "measurement.h"
+#include "report.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+struct CameraThread {
+  FrameSource * source;
+  string name;
+  unique_ptr<Measurement> measurement; // owned by the acquisition thread until it is joined
+  unique_ptr<StallDetector> stalls;
+  thread worker;
+
+  // last closed window, shared with the reporting thread
+  mutex lock;
+  bool has_window;
+  double fps;
+  double p99;
+  double jitter;
+  double latency_p99;
+  double bytes_per_second;
+  double link_utilisation;
+  uint64_t lost;
+  uint64_t incomplete;
+  string error;
+};
+
+void Acquire(CameraThread & camera, const atomic<bool> & run) {
+  try {
+    Measurement & measurement = *camera.measurement;
+
+    measurement.BeginAcquisition();
+
+    while (run) {
+      if (measurement.AcquireFrame()) {
+        const FrameStats & stats = measurement.Stats();
+        lock_guard<mutex> guard(camera.lock);
+
+        camera.has_window = true;
+        camera.fps = stats.WindowFps();
+        camera.p99 = stats.WindowIntervals().Percentile(99);
+        camera.jitter = stats.WindowIntervals().StdDev();
+        camera.latency_p99 = stats.WindowLatencies().Percentile(99);
+        camera.bytes_per_second = stats.WindowBytesPerSecond();
+        camera.link_utilisation = measurement.WindowLinkUtilisation();
+        camera.lost = stats.WindowLost();
+        camera.incomplete = stats.WindowIncomplete();
+      }
+    }
+
+    measurement.EndAcquisition();
+  }
+  catch (std::exception &e) {
+    {
+      lock_guard<mutex> guard(camera.lock);
+      camera.error = e.what();
+    }
+
+    // leave the camera idle for DeInit, it may not have been acquiring
+    try {
+      camera.source->EndAcquisition();
+    }
+    catch (std::exception &e) {
+    }
+  }
+}
+
+// DeInit one camera, an error does not keep the others from being released.
+// Returns false when it failed.
+bool DeInit(FrameSource & source, const string & name) {
+  try {
+    source.DeInit();
+    return true;
+  }
+  catch (std::exception &e) {
+    cout << "Error: DeInit of camera " << name << " failed: " << e.what() << endl;
+    return false;
+  }
+}
+
+// Every camera logs its stalls to a file of its own, the camera name goes
+// before the extension
+string StallLogPath(const string & path, const string & name) {
+  if (path.empty())
+    return path;
+
+  size_t extension = path.find_last_of('.');
+  if (extension == string::npos || path.find('/', extension) != string::npos)
+    return path + "." + name;
+
+  return path.substr(0, extension) + "." + name + path.substr(extension);
+}
+
+void PrintHeader(ostream & out) {
+  out << left << setw(16) << "Camera" << right
+    << setw(12) << "fps"
+    << setw(12) << "p99 us"
+    << setw(12) << "jitter us"
+    << setw(12) << "lat p99 us"
+    << setw(12) << "MB/s"
+    << setw(12) << "link %"
+    << setw(12) << "lost"
+    << setw(12) << "incomplete" << endl;
+}
+
+void PrintRow(ostream & out, const CameraThread & camera) {
+  out << left << setw(16) << camera.name << right << fixed << setprecision(1)
+    << setw(12) << camera.fps
+    << setw(12) << camera.p99 / 1000
+    << setw(12) << camera.jitter / 1000
+    << setw(12) << camera.latency_p99 / 1000
+    << setw(12) << camera.bytes_per_second / 1e6
+    << setw(12) << camera.link_utilisation * 100
+    << setw(12) << camera.lost
+    << setw(12) << camera.incomplete << endl;
+}
+
+void PrintWindows(ostream & out, vector<unique_ptr<CameraThread>> & cameras) {
+  ostringstream table;
+  bool has_rows = false;
+  double total_fps = 0;
+  double total_bytes_per_second = 0;
+
+  for (auto & camera : cameras) {
+    lock_guard<mutex> guard(camera->lock);
+
+    if (!camera->error.empty()) {
+      table << left << setw(16) << camera->name << "Error: " << camera->error << endl;
+      has_rows = true;
+    }
+    else if (camera->has_window) {
+      PrintRow(table, *camera);
+      total_fps += camera->fps;
+      total_bytes_per_second += camera->bytes_per_second;
+      has_rows = true;
+    }
+  }
+
+  // nothing to show while cameras are warming up
+  if (!has_rows)
+    return;
+
+  table << left << setw(16) << "Total" << right << fixed << setprecision(1)
+    << setw(12) << total_fps << setw(36) << "" << setw(12) << total_bytes_per_second / 1e6 << endl;
+
+  out << table.str() << endl;
+}
+
+}
+
+bool RunMultiCameraTest(vector<unique_ptr<FrameSource>> & sources, const vector<string> & names,
+    const TestConfig & test_config, const atomic<bool> & run) {
+  vector<unique_ptr<CameraThread>> cameras;
+
+  try {
+    // Initialize sources one after another, acquisition runs concurrently
+    for (size_t i = 0; i < sources.size(); i++) {
+      unique_ptr<CameraThread> camera(new CameraThread());
+      camera->source = sources[i].get();
+      camera->name = names[i];
+      camera->measurement.reset(new Measurement(*camera->source));
+      camera->stalls.reset(new StallDetector(milliseconds(int64_t(test_config.grab_timeout)),
+        test_config.stall_incomplete_burst, milliseconds(int64_t(test_config.stall_restart_after)),
+        StallLogPath(test_config.stall_log, camera->name)));
+      camera->measurement->SetStallDetector(camera->stalls.get());
+      camera->has_window = false;
+
+      cout << "Camera " << camera->name << endl << endl;
+      camera->source->Init();
+      camera->source->PrintInfo(cout);
+
+      cameras.push_back(move(camera));
+    }
+  }
+  catch (std::exception &e) {
+    cout << "Error: " << e.what() << endl;
+    for (auto & camera : cameras)
+      DeInit(*camera->source, camera->name);
+    return false;
+  }
+
+  cout << "Multi camera fps measuring" << endl
+    << "==========================" << endl;
+  PrintHeader(cout);
+
+  for (auto & camera : cameras)
+    camera->worker = thread(Acquire, ref(*camera), cref(run));
+
+  // Report once a second, checking for interrupt more often
+  steady_clock::time_point next_report = steady_clock::now() + seconds(1);
+  while (run) {
+    this_thread::sleep_for(milliseconds(100));
+
+    if (steady_clock::now() >= next_report) {
+      PrintWindows(cout, cameras);
+      next_report += seconds(1);
+    }
+  }
+
+  for (auto & camera : cameras)
+    camera->worker.join();
+
+  cout << endl;
+
+  double total_fps = 0;
+  double total_bytes_per_second = 0;
+  double sum_squares = 0;
+  bool passed = true;
+
+  for (auto & camera : cameras) {
+    const FrameStats & stats = camera->measurement->Stats();
+    bool within_budget = camera->measurement->WithinLossBudget(test_config.loss_budget);
+
+    if (!camera->error.empty())
+      cout << "Camera " << camera->name << " failed: " << camera->error << endl << endl;
+
+    camera->measurement->PrintSummary(cout, "Summary " + camera->name);
+    PrintLossBudget(cout, test_config, within_budget);
+    cout << endl;
+
+    passed = passed && within_budget && camera->error.empty();
+
+    total_fps += stats.RunFps();
+    total_bytes_per_second += stats.RunBytesPerSecond();
+    sum_squares += stats.RunBytesPerSecond() * stats.RunBytesPerSecond();
+
+    passed = DeInit(*camera->source, camera->name) && passed;
+  }
+
+  ostringstream total;
+  total << fixed << setprecision(1)
+    << "Aggregate" << endl << "=========" << endl
+    << Label("Cameras") << cameras.size() << endl
+    << Label("Total fps") << total_fps << endl
+    << Label("Throughput") << total_bytes_per_second / 1e6 << "MB/s" << endl;
+
+  // Jain's index, 1 when all cameras move the same bytes, 1/n when one
+  // takes everything
+  if (sum_squares > 0)
+    total << setprecision(3) << Label("Fairness")
+      << total_bytes_per_second * total_bytes_per_second / (cameras.size() * sum_squares) << endl;
+
+  total << setprecision(1);
+  for (auto & camera : cameras) {
+    const FrameStats & stats = camera->measurement->Stats();
+    total << Label("Share " + camera->name)
+      << (total_bytes_per_second > 0 ? stats.RunBytesPerSecond() / total_bytes_per_second * 100 : 0) << "%";
+    if (camera->measurement->LinkUtilisation() > 0)
+      total << ", " << camera->measurement->LinkUtilisation() * 100 << "% of its link";
+    total << endl;
+  }
+  cout << total.str() << endl;
+
+  return passed;
+}
@@ -0,0 +1,20 @@
+#ifndef MULTI_CAMERA_H
+#define MULTI_CAMERA_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "frame_source.h"
+
+// Acquire from all sources concurrently, one thread per camera, until run
+// turns false. Every second per camera fps, interval tail, jitter and
+// throughput are printed together with the aggregate over all cameras, so
+// that cameras sharing a host controller can be compared under load.
+// Returns false when a camera failed or exceeded the loss budget.
+bool RunMultiCameraTest(std::vector<std::unique_ptr<FrameSource>> & sources,
+    const std::vector<std::string> & names, const TestConfig & test_config,
+    const std::atomic<bool> & run);
+
+#endif
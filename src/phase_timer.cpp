@@ -0,0 +1,25 @@
+#include "phase_timer.h"
+
+using namespace std;
+using namespace std::chrono;
+
+void PhaseTimer::Start() {
+  laps_.clear();
+  last_ = steady_clock::now();
+}
+
+void PhaseTimer::Lap(const string & phase) {
+  steady_clock::time_point now = steady_clock::now();
+
+  laps_.push_back(make_pair(phase, int64_t(duration_cast<nanoseconds>(now - last_).count())));
+  last_ = now;
+}
+
+int64_t PhaseTimer::Total() const {
+  int64_t total = 0;
+
+  for (const pair<string, int64_t> & lap : laps_)
+    total += lap.second;
+
+  return total;
+}
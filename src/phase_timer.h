@@ -0,0 +1,30 @@
+#ifndef PHASE_TIMER_H
+#define PHASE_TIMER_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Durations of consecutive named phases, each lap is measured from the end
+// of the previous one
+class PhaseTimer {
+ public:
+  PhaseTimer() { Start(); }
+
+  // Forget the laps and measure the next one from now
+  void Start();
+  // End the current phase under the given name
+  void Lap(const std::string & phase);
+
+  // Phase names with their durations in ns, in the order they ended
+  const std::vector<std::pair<std::string, int64_t>> & Laps() const { return laps_; }
+  int64_t Total() const;
+
+ private:
+  std::chrono::steady_clock::time_point last_;
+  std::vector<std::pair<std::string, int64_t>> laps_;
+};
+
+#endif
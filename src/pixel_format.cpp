@@ -0,0 +1,38 @@
+#include "pixel_format.h"
+
+using namespace std;
+
+static bool EndsWith(const string & str, const string & suffix) {
+  return str.size() >= suffix.size()
+    && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+int BitsPerPixel(const string & pixel_format) {
+  // color formats with several channels per pixel
+  if (pixel_format == "RGB8" || pixel_format == "BGR8" || pixel_format == "RGB8Packed")
+    return 24;
+  if (pixel_format == "RGBa8" || pixel_format == "BGRa8")
+    return 32;
+  if (pixel_format == "YUV422Packed" || pixel_format == "YCbCr422_8")
+    return 16;
+  if (pixel_format == "YUV411Packed" || pixel_format == "YCbCr411_8")
+    return 12;
+
+  if (pixel_format.compare(0, 4, "Mono") != 0 && pixel_format.compare(0, 5, "Bayer") != 0)
+    return 0;
+
+  // single channel formats
+  if (EndsWith(pixel_format, "8"))
+    return 8;
+  if (EndsWith(pixel_format, "10p"))
+    return 10;
+  if (EndsWith(pixel_format, "12p"))
+    return 12;
+  // legacy packing stores two pixels in three bytes
+  if (EndsWith(pixel_format, "10Packed") || EndsWith(pixel_format, "12Packed"))
+    return 12;
+  if (EndsWith(pixel_format, "10") || EndsWith(pixel_format, "12") || EndsWith(pixel_format, "16"))
+    return 16;
+
+  return 0;
+}
@@ -0,0 +1,9 @@
+#ifndef PIXEL_FORMAT_H
+#define PIXEL_FORMAT_H
+
+#include <string>
+
+// Bits used by one pixel of a GenICam pixel format, 0 when unknown
+int BitsPerPixel(const std::string & pixel_format);
+
+#endif
@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include "processing_executor.h"
+#include "report.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Wait between checks for the oldest frame to finish
+static const microseconds COLLECT_SLEEP(50);
+
+ProcessingExecutor::ProcessingExecutor(ProcessingStage & stage, int threads, int stripes, int slots)
+  : stage_(stage), stripes_(stage.SplitsRows() ? max(1, stripes) : 1), pending_(0), stop_(false), failed_(false),
+    next_worker_(0),
+    processed_(0), dropped_(0), reorder_depth_(0), max_reorder_depth_(0), reorder_depth_sum_(0), collects_(0) {
+  threads = max(1, threads);
+  size_t slot_count = size_t(slots > 0 ? slots : 4 * threads);
+
+  stage_.Reserve(slot_count);
+
+  for (size_t i = 0; i < slot_count; i++) {
+    slots_.push_back(unique_ptr<Slot>(new Slot()));
+    slots_.back()->done = false;
+    free_slots_.push_back(slot_count - 1 - i);
+  }
+
+  start_ = last_release_ = steady_clock::now();
+  start_core_times_ = ReadCoreTimes();
+
+  for (int i = 0; i < threads; i++) {
+    workers_.push_back(unique_ptr<Worker>(new Worker()));
+    workers_.back()->busy_time = 0;
+    workers_.back()->steals = 0;
+    workers_.back()->cpu_time = 0;
+  }
+
+  // every queue exists before the first worker looks for work to steal
+  for (size_t i = 0; i < workers_.size(); i++)
+    workers_[i]->thread = thread(&ProcessingExecutor::Work, this, i);
+}
+
+ProcessingExecutor::~ProcessingExecutor() {
+  {
+    lock_guard<mutex> lock(idle_mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+
+  for (unique_ptr<Worker> & worker : workers_)
+    worker->thread.join();
+}
+
+bool ProcessingExecutor::Submit(const Frame & frame, steady_clock::time_point arrival) {
+  if (free_slots_.empty()) {
+    dropped_++;
+    return false;
+  }
+
+  size_t index = free_slots_.back();
+  free_slots_.pop_back();
+
+  // the copy lets the source have its buffer back before processing
+  Slot & slot = *slots_[index];
+  slot.data.assign(frame.data, frame.data + frame.size);
+  slot.frame = frame;
+  slot.frame.data = slot.data.data();
+  slot.arrival = arrival;
+  slot.work_time = 0;
+  slot.done = false;
+
+  // no more stripes than rows, every stripe holds at least one
+  int stripes = max(1, min(stripes_, frame.height));
+  slot.remaining = stripes;
+  order_.push_back(index);
+
+  Worker & worker = *workers_[next_worker_];
+  next_worker_ = (next_worker_ + 1) % workers_.size();
+  {
+    // counted before they can be taken, pending_ never goes below zero
+    lock_guard<mutex> lock(worker.mutex);
+    pending_ += size_t(stripes);
+    for (int i = 0; i < stripes; i++)
+      worker.tasks.push_back(Task{ index, int(int64_t(frame.height) * i / stripes),
+        int(int64_t(frame.height) * (i + 1) / stripes) });
+  }
+
+  // a worker between checking pending_ and waiting holds idle_mutex_, taking
+  // it once makes sure the notification is not lost
+  {
+    lock_guard<mutex> lock(idle_mutex_);
+  }
+  if (stripes > 1)
+    wake_.notify_all();
+  else
+    wake_.notify_one();
+
+  return true;
+}
+
+void ProcessingExecutor::Collect(vector<ProcessedFrame> & done, bool wait) {
+  while (!order_.empty()) {
+    Slot & slot = *slots_[order_.front()];
+
+    if (!slot.done.load(memory_order_acquire)) {
+      if (failed_)
+        break;
+      if (wait) {
+        this_thread::sleep_for(COLLECT_SLEEP);
+        continue;
+      }
+
+      // frames done behind the oldest one wait for it
+      size_t depth = 0;
+      for (size_t index : order_)
+        if (slots_[index]->done.load(memory_order_acquire))
+          depth++;
+
+      reorder_depth_ = depth;
+      max_reorder_depth_ = max(max_reorder_depth_, depth);
+      reorder_depth_sum_ += depth;
+      collects_++;
+      break;
+    }
+
+    last_release_ = steady_clock::now();
+
+    ProcessedFrame processed;
+    processed.frame_id = slot.frame.frame_id;
+    processed.work_time = slot.work_time;
+    processed.latency = duration_cast<nanoseconds>(last_release_ - slot.arrival).count();
+    done.push_back(processed);
+
+    latencies_.Record(uint64_t(max(int64_t(0), processed.latency)));
+    processed_++;
+
+    free_slots_.push_back(order_.front());
+    order_.pop_front();
+  }
+
+  if (failed_) {
+    lock_guard<mutex> lock(error_mutex_);
+    rethrow_exception(error_);
+  }
+}
+
+uint64_t ProcessingExecutor::Steals() const {
+  uint64_t steals = 0;
+
+  for (const unique_ptr<Worker> & worker : workers_)
+    steals += worker->steals;
+
+  return steals;
+}
+
+int64_t ProcessingExecutor::CpuTime() const {
+  int64_t time = 0;
+
+  for (const unique_ptr<Worker> & worker : workers_)
+    time += worker->cpu_time;
+
+  return time;
+}
+
+double ProcessingExecutor::Throughput() const {
+  double seconds = duration<double>(last_release_ - start_).count();
+  return seconds > 0 ? processed_ / seconds : 0;
+}
+
+void ProcessingExecutor::Work(size_t index) {
+  Worker & worker = *workers_[index];
+  Task task;
+
+  while (true) {
+    if (TakeTask(index, task)) {
+      RunTask(worker, task);
+      continue;
+    }
+
+    unique_lock<mutex> lock(idle_mutex_);
+    wake_.wait(lock, [this] { return stop_ || pending_ > 0; });
+    if (stop_)
+      return;
+  }
+}
+
+bool ProcessingExecutor::TakeTask(size_t index, Task & task) {
+  // own stripes newest first, their frame was copied last and is in cache
+  {
+    Worker & worker = *workers_[index];
+    lock_guard<mutex> lock(worker.mutex);
+    if (!worker.tasks.empty()) {
+      task = worker.tasks.back();
+      worker.tasks.pop_back();
+      pending_--;
+      return true;
+    }
+  }
+
+  // steal the oldest stripe of another worker, those hold up the reorder
+  // buffer the longest
+  for (size_t i = 1; i < workers_.size(); i++) {
+    Worker & victim = *workers_[(index + i) % workers_.size()];
+    lock_guard<mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = victim.tasks.front();
+      victim.tasks.pop_front();
+      pending_--;
+      workers_[index]->steals++;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void ProcessingExecutor::RunTask(Worker & worker, const Task & task) {
+  Slot & slot = *slots_[task.slot];
+  steady_clock::time_point begin = steady_clock::now();
+
+  try {
+    stage_.Process(slot.frame, task.slot, task.row_begin, task.row_end);
+  }
+  catch (...) {
+    lock_guard<mutex> lock(error_mutex_);
+    if (!failed_)
+      error_ = current_exception();
+    failed_ = true;
+  }
+
+  int64_t time = duration_cast<nanoseconds>(steady_clock::now() - begin).count();
+  worker.busy_time += uint64_t(time);
+  worker.cpu_time = ThreadCpuTime();
+  slot.work_time += time;
+
+  if (slot.remaining.fetch_sub(1) == 1)
+    slot.done.store(true, memory_order_release);
+}
+
+void ProcessingExecutor::PrintSummary(ostream & out) const {
+  ostringstream summary;
+  double seconds = duration<double>(last_release_ - start_).count();
+  vector<double> cores = CoreUtilisation(start_core_times_, ReadCoreTimes());
+
+  summary << fixed << setprecision(1);
+  summary << Label("Workers") << workers_.size() << " threads, " << stripes_ << " stripes per frame, "
+    << slots_.size() << " slots" << endl;
+  summary << Label("Processed frames") << processed_ << endl;
+  summary << Label("Processed fps") << Throughput() << endl;
+  summary << Label("Processing drops") << dropped_ << endl;
+  summary << Label("Release latency p50") << Us(latencies_.Percentile(50)) << endl;
+  summary << Label("Release latency p99") << Us(latencies_.Percentile(99)) << endl;
+  summary << Label("Reorder depth mean") << MeanReorderDepth() << endl;
+  summary << Label("Reorder depth max") << max_reorder_depth_ << endl;
+  summary << Label("Steals") << Steals() << endl;
+
+  string busy;
+  for (const unique_ptr<Worker> & worker : workers_) {
+    ostringstream share;
+    share << fixed << setprecision(0) << (seconds > 0 ? worker->busy_time / seconds / 1e7 : 0) << "%";
+    busy += (busy.empty() ? "" : " ") + share.str();
+  }
+  summary << Label("Worker busy") << busy << endl;
+
+  if (!cores.empty()) {
+    string usage;
+    for (double core : cores) {
+      ostringstream share;
+      share << fixed << setprecision(0) << core * 100 << "%";
+      usage += (usage.empty() ? "" : " ") + share.str();
+    }
+    summary << Label("Core utilisation") << usage << endl;
+  }
+
+  stage_.PrintSummary(summary);
+
+  out << summary.str();
+}
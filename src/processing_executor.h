@@ -0,0 +1,129 @@
+#ifndef PROCESSING_EXECUTOR_H
+#define PROCESSING_EXECUTOR_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+#include "cpu_usage.h"
+#include "frame_source.h"
+#include "histogram.h"
+#include "processing_stage.h"
+
+// A processed frame, released in the order the frames were submitted
+struct ProcessedFrame {
+  uint64_t frame_id;
+  int64_t work_time;  // ns spent on the frame summed over its stripes
+  int64_t latency;    // ns from arrival to release in order
+};
+
+// Runs a processing stage on a pool of worker threads. Submitted frames are
+// copied into one of a fixed number of slots, so that the source gets its
+// buffer back right away, and split into stripes of rows. The stripes of a
+// frame are queued on one worker, idle workers steal them from the front of
+// the other queues while every worker takes its own from the back. Frames
+// may finish out of order, a reorder buffer holds them until every earlier
+// frame is done. When all slots are in use the frame is dropped, the
+// camera is never held up by processing.
+class ProcessingExecutor {
+ public:
+  // Slots of 0 picks four per thread
+  ProcessingExecutor(ProcessingStage & stage, int threads, int stripes, int slots);
+  ~ProcessingExecutor();
+
+  // Copy the frame and queue its stripes. Returns false when it was dropped.
+  bool Submit(const Frame & frame, std::chrono::steady_clock::time_point arrival);
+
+  // Move frames finished in order to done, waiting for all submitted ones
+  // when wait is set. Called by the submitting thread only. Rethrows the
+  // first error of the stage.
+  void Collect(std::vector<ProcessedFrame> & done, bool wait = false);
+
+  int Threads() const { return int(workers_.size()); }
+  int Stripes() const { return stripes_; }
+  size_t Slots() const { return slots_.size(); }
+  uint64_t Processed() const { return processed_; }
+  uint64_t Dropped() const { return dropped_; }
+  uint64_t Steals() const;
+  // CPU time in ns all workers used up to their last stripe
+  int64_t CpuTime() const;
+  size_t InFlight() const { return order_.size(); }
+  // Finished frames held back behind an unfinished one
+  size_t ReorderDepth() const { return reorder_depth_; }
+  size_t MaxReorderDepth() const { return max_reorder_depth_; }
+  double MeanReorderDepth() const { return collects_ ? double(reorder_depth_sum_) / collects_ : 0; }
+  const Histogram & Latencies() const { return latencies_; }
+  // Processed frames per second since the executor started
+  double Throughput() const;
+
+  // Ends with the summary of the stage
+  void PrintSummary(std::ostream & out) const;
+
+ private:
+  struct Slot {
+    std::vector<uint8_t> data;
+    Frame frame;
+    std::chrono::steady_clock::time_point arrival;
+    std::atomic<int> remaining; // stripes not finished yet
+    std::atomic<int64_t> work_time;
+    std::atomic<bool> done;
+  };
+
+  struct Task {
+    size_t slot;
+    int row_begin;
+    int row_end;
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    std::thread thread;
+    std::atomic<uint64_t> busy_time; // ns spent in the stage
+    std::atomic<uint64_t> steals;
+    std::atomic<int64_t> cpu_time;
+  };
+
+  void Work(size_t index);
+  bool TakeTask(size_t index, Task & task);
+  void RunTask(Worker & worker, const Task & task);
+
+  ProcessingStage & stage_;
+  int stripes_;
+  std::vector<std::unique_ptr<Slot>> slots_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  // wakes workers when tasks are queued
+  std::mutex idle_mutex_;
+  std::condition_variable wake_;
+  std::atomic<size_t> pending_;
+  std::atomic<bool> stop_;
+  std::mutex error_mutex_;
+  std::exception_ptr error_;
+  std::atomic<bool> failed_;
+
+  // only touched by the submitting thread
+  std::vector<size_t> free_slots_;
+  std::deque<size_t> order_;
+  size_t next_worker_;
+  uint64_t processed_;
+  uint64_t dropped_;
+  size_t reorder_depth_;
+  size_t max_reorder_depth_;
+  uint64_t reorder_depth_sum_;
+  uint64_t collects_;
+  Histogram latencies_;
+
+  std::chrono::steady_clock::time_point start_;
+  std::chrono::steady_clock::time_point last_release_;
+  CoreTimes start_core_times_;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef PROCESSING_STAGE_H
+#define PROCESSING_STAGE_H
+
+#include <cstddef>
+#include <ostream>
+#include "frame_source.h"
+
+// Work done on every acquired frame. The measurement times each frame to
+// report whether the stage keeps up with the frame rate. Frames may be
+// processed on several threads at once, each into an output slot of its
+// own, and split into stripes of rows that run concurrently as well.
+class ProcessingStage {
+ public:
+  virtual ~ProcessingStage() {}
+
+  virtual void PrintInfo(std::ostream & out) = 0;
+
+  // Whether stripes of rows of one frame can be processed on their own
+  virtual bool SplitsRows() const { return true; }
+
+  // Allocate output for up to slots frames in flight
+  virtual void Reserve(size_t slots) = 0;
+
+  // Process rows row_begin to row_end of the frame into the given slot
+  virtual void Process(const Frame & frame, size_t slot, int row_begin, int row_end) = 0;
+
+  // Print what the stage found over the run, after the timing summary
+  virtual void PrintSummary(std::ostream & out) const {}
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef RECORDING_FORMAT_H
+#define RECORDING_FORMAT_H
+
+#include <cstdint>
+
+// Layout of a recording file, in the byte order of the recording host:
+//
+//   FileHeader        followed by the [camera] settings as TOML and the
+//                     source information as text, padded to header_size
+//   record 0          RecordHeader followed by the payload, padded to
+//                     slot_size
+//   record 1          at header_size + slot_size
+//   ...
+//
+// Records are appended and never touched again, record n starts at
+// header_size + n * slot_size. The side index <file>.idx is an IndexHeader
+// followed by one IndexEntry per record, appended as records are written.
+// Both files can be mapped to reach frame n in constant time. After a crash
+// the index may lag behind or run ahead of the records, it is then rebuilt
+// from the record headers, which carry everything the index holds.
+
+const char RECORDING_MAGIC[8] = { 'S', 'P', 'F', 'T', 'R', 'E', 'C', '1' };
+const char INDEX_MAGIC[8] = { 'S', 'P', 'F', 'T', 'I', 'D', 'X', '1' };
+const uint32_t RECORDING_VERSION = 1;
+const uint32_t RECORD_MAGIC = 0x454d5246; // "FRME"
+
+// Record flags
+const uint32_t RECORD_INCOMPLETE = 1;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;    // bytes before record 0
+  uint64_t slot_size;      // bytes per record, header, payload and padding
+  uint64_t payload_size;   // largest payload
+  uint32_t width;
+  uint32_t height;
+  char pixel_format[32];
+  uint64_t file_number;    // position of the file in the recording
+  int64_t steady_origin;   // host steady clock when the file was created, ns
+  int64_t system_origin;   // host wall clock at the same time, ns since 1970
+  uint32_t settings_size;  // bytes of TOML following the header
+  uint32_t info_size;      // bytes of source information following the TOML
+};
+
+struct RecordHeader {
+  uint32_t magic;
+  uint32_t payload_size;
+  uint64_t sequence;        // frames recorded before this one, across files
+  uint64_t frame_id;
+  uint64_t device_timestamp; // end of exposure on the device clock, ns
+  int64_t host_timestamp;    // arrival on the host steady clock, ns
+  uint64_t payload_offset;   // file offset of the payload
+  uint32_t flags;
+  uint32_t status;
+  uint64_t reserved;
+};
+
+struct IndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t entry_size;
+};
+
+struct IndexEntry {
+  uint64_t offset;          // file offset of the record
+  uint64_t sequence;
+  uint64_t frame_id;
+  uint64_t device_timestamp;
+  int64_t host_timestamp;
+};
+
+static_assert(sizeof(FileHeader) == 104, "FileHeader layout changed");
+static_assert(sizeof(RecordHeader) == 64, "RecordHeader layout changed");
+static_assert(sizeof(IndexHeader) == 16, "IndexHeader layout changed");
+static_assert(sizeof(IndexEntry) == 40, "IndexEntry layout changed");
+
+#endif
@@ -0,0 +1,178 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "recording_reader.h"
+
+using namespace std;
+
+// Map a whole file read only, returns nullptr for an empty file
+static const uint8_t * MapFile(int fd, size_t & size) {
+  struct stat status;
+  if (fstat(fd, &status) != 0)
+    throw runtime_error(string("Cannot stat recording: ") + strerror(errno));
+
+  size = size_t(status.st_size);
+  if (size == 0)
+    return nullptr;
+
+  void * data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED)
+    throw runtime_error(string("Cannot map recording: ") + strerror(errno));
+
+  return static_cast<const uint8_t *>(data);
+}
+
+RecordingReader::RecordingReader(const string & path)
+  : path_(path), fd_(-1), data_(nullptr), size_(0), index_fd_(-1), index_data_(nullptr), index_size_(0),
+    entries_(nullptr), frames_(0), rebuilt_(false) {
+  fd_ = open(path.c_str(), O_RDONLY);
+  if (fd_ < 0)
+    throw runtime_error("Cannot open " + path + ": " + strerror(errno));
+
+  data_ = MapFile(fd_, size_);
+
+  if (size_ < sizeof(FileHeader) || memcmp(Header().magic, RECORDING_MAGIC, sizeof(Header().magic)) != 0)
+    throw runtime_error(path + " is not a recording");
+
+  const FileHeader & header = Header();
+  if (header.version != RECORDING_VERSION)
+    throw runtime_error(path + " has unsupported version " + to_string(header.version));
+  if (header.header_size < sizeof(FileHeader) + header.settings_size + header.info_size
+      || header.slot_size < sizeof(RecordHeader))
+    throw runtime_error(path + " has a broken header");
+
+  size_t valid = 0;
+  if (!MapIndex(valid))
+    RebuildIndex(valid);
+}
+
+RecordingReader::~RecordingReader() {
+  if (index_data_)
+    munmap(const_cast<uint8_t *>(index_data_), index_size_);
+  if (index_fd_ >= 0)
+    close(index_fd_);
+  if (data_)
+    munmap(const_cast<uint8_t *>(data_), size_);
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+string RecordingReader::Settings() const {
+  const char * text = reinterpret_cast<const char *>(data_ + sizeof(FileHeader));
+  return string(text, Header().settings_size);
+}
+
+string RecordingReader::Info() const {
+  const char * text = reinterpret_cast<const char *>(data_ + sizeof(FileHeader) + Header().settings_size);
+  return string(text, Header().info_size);
+}
+
+const RecordHeader & RecordingReader::Record(size_t n) const {
+  return *reinterpret_cast<const RecordHeader *>(data_ + entries_[n].offset);
+}
+
+const uint8_t * RecordingReader::Payload(size_t n) const {
+  return data_ + Record(n).payload_offset;
+}
+
+bool RecordingReader::ValidRecord(uint64_t offset) const {
+  const FileHeader & header = Header();
+
+  if (offset < header.header_size || (offset - header.header_size) % header.slot_size != 0
+      || offset + header.slot_size > size_)
+    return false;
+
+  const RecordHeader & record = *reinterpret_cast<const RecordHeader *>(data_ + offset);
+  return record.magic == RECORD_MAGIC && record.payload_offset == offset + sizeof(RecordHeader)
+    && record.payload_size <= header.slot_size - sizeof(RecordHeader);
+}
+
+// Whether the entry points at a written record with its sequence and frame
+// ID. Entries are appended as writes are queued, a crash can leave entries
+// for slots that were never written.
+bool RecordingReader::MatchesRecord(const IndexEntry & entry) const {
+  if (!ValidRecord(entry.offset))
+    return false;
+
+  const RecordHeader & record = *reinterpret_cast<const RecordHeader *>(data_ + entry.offset);
+  return record.sequence == entry.sequence && record.frame_id == entry.frame_id;
+}
+
+// Use the side index when every entry matches its record and no written
+// record follows the last one. valid is set to the number of leading
+// entries that match.
+bool RecordingReader::MapIndex(size_t & valid) {
+  valid = 0;
+
+  index_fd_ = open((path_ + ".idx").c_str(), O_RDONLY);
+  if (index_fd_ < 0)
+    return false;
+
+  index_data_ = MapFile(index_fd_, index_size_);
+
+  const IndexHeader * index_header = reinterpret_cast<const IndexHeader *>(index_data_);
+  if (index_size_ < sizeof(IndexHeader) || memcmp(index_header->magic, INDEX_MAGIC, sizeof(index_header->magic)) != 0
+      || index_header->entry_size != sizeof(IndexEntry))
+    return false;
+
+  entries_ = reinterpret_cast<const IndexEntry *>(index_data_ + sizeof(IndexHeader));
+  frames_ = (index_size_ - sizeof(IndexHeader)) / sizeof(IndexEntry);
+
+  for (; valid < frames_; valid++) {
+    if (!MatchesRecord(entries_[valid]))
+      return false;
+  }
+
+  uint64_t next_offset = frames_ > 0 ? entries_[frames_ - 1].offset + Header().slot_size : Header().header_size;
+  return !ValidRecord(next_offset);
+}
+
+void RecordingReader::RebuildIndex(size_t valid) {
+  const FileHeader & header = Header();
+
+  rebuilt_ = true;
+
+  // entries that matched are kept, the records after them are scanned
+  rebuilt_entries_.assign(entries_, entries_ + valid);
+  uint64_t first_offset = valid > 0 ? entries_[valid - 1].offset + header.slot_size : header.header_size;
+
+  // Slots are filled in order but writes may finish out of order, a crash
+  // can leave holes. Preallocated slots past the last record read as zeros.
+  for (uint64_t offset = first_offset; offset + header.slot_size <= size_; offset += header.slot_size) {
+    if (!ValidRecord(offset))
+      continue;
+
+    const RecordHeader & record = *reinterpret_cast<const RecordHeader *>(data_ + offset);
+    IndexEntry entry = { offset, record.sequence, record.frame_id, record.device_timestamp, record.host_timestamp };
+    rebuilt_entries_.push_back(entry);
+  }
+
+  entries_ = rebuilt_entries_.data();
+  frames_ = rebuilt_entries_.size();
+
+  // Write the index back for the next reader, through a temporary file so
+  // that a reader never sees half of it. Read only media keep the rebuilt
+  // index in memory only.
+  string temporary = path_ + ".idx.tmp";
+  FILE * file = fopen(temporary.c_str(), "wb");
+  if (!file)
+    return;
+
+  IndexHeader index_header;
+  memcpy(index_header.magic, INDEX_MAGIC, sizeof(index_header.magic));
+  index_header.version = RECORDING_VERSION;
+  index_header.entry_size = sizeof(IndexEntry);
+
+  bool written = fwrite(&index_header, sizeof(index_header), 1, file) == 1
+    && fwrite(rebuilt_entries_.data(), sizeof(IndexEntry), frames_, file) == frames_;
+
+  if (fclose(file) == 0 && written)
+    rename(temporary.c_str(), (path_ + ".idx").c_str());
+  else
+    remove(temporary.c_str());
+}
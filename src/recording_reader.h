@@ -0,0 +1,60 @@
+#ifndef RECORDING_READER_H
+#define RECORDING_READER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "recording_format.h"
+
+// Maps one recording file and its side index. Frame n is found in constant
+// time through the index. When the index is missing or does not match the
+// records, as after a crash while recording, it is rebuilt from the record
+// headers from the first entry that does not match and written back.
+class RecordingReader {
+ public:
+  explicit RecordingReader(const std::string & path);
+  ~RecordingReader();
+
+  RecordingReader(const RecordingReader &) = delete;
+  RecordingReader & operator=(const RecordingReader &) = delete;
+
+  const FileHeader & Header() const { return *reinterpret_cast<const FileHeader *>(data_); }
+
+  // [camera] settings as TOML and source information as printed
+  std::string Settings() const;
+  std::string Info() const;
+
+  size_t Frames() const { return frames_; }
+  const IndexEntry & Entry(size_t n) const { return entries_[n]; }
+  const RecordHeader & Record(size_t n) const;
+  const uint8_t * Payload(size_t n) const;
+
+  // Whether the index had to be rebuilt from the records
+  bool IndexRebuilt() const { return rebuilt_; }
+
+  // Start of the mapped file, for readers that want the raw bytes
+  const uint8_t * Data() const { return data_; }
+  size_t Size() const { return size_; }
+
+ private:
+  bool ValidRecord(uint64_t offset) const;
+  bool MatchesRecord(const IndexEntry & entry) const;
+  bool MapIndex(size_t & valid);
+  void RebuildIndex(size_t valid);
+
+  std::string path_;
+  int fd_;
+  const uint8_t * data_;
+  size_t size_;
+
+  int index_fd_;
+  const uint8_t * index_data_;
+  size_t index_size_;
+
+  std::vector<IndexEntry> rebuilt_entries_;
+  const IndexEntry * entries_;
+  size_t frames_;
+  bool rebuilt_;
+};
+
+#endif
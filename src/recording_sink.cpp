@@ -0,0 +1,357 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include "recording_sink.h"
+#include "report.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// O_DIRECT needs buffers, sizes and offsets aligned to the logical block
+// size of the device, a page covers all common ones
+static const uint64_t BLOCK_SIZE = 4096;
+
+static uint64_t AlignToBlock(uint64_t size) {
+  return (size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+}
+
+static uint8_t * AllocateAligned(uint64_t size) {
+  void * buffer = nullptr;
+  if (posix_memalign(&buffer, BLOCK_SIZE, size) != 0)
+    throw runtime_error("Cannot allocate recording buffers");
+
+  // touch every page now rather than on the first frame
+  memset(buffer, 0, size);
+  return static_cast<uint8_t *>(buffer);
+}
+
+RecordingSink::RecordingSink(const TestConfig & test_config)
+  : config_(test_config), direct_(test_config.record_direct), header_size_(0), slot_size_(0), slots_per_file_(0),
+    file_slot_(0), index_(nullptr), header_(nullptr), prepared_ready_(false), stop_preparing_(false),
+    unflushed_(0) {
+  memset(&counters_, 0, sizeof(counters_));
+}
+
+RecordingSink::~RecordingSink() {
+  try {
+    Close();
+  }
+  catch (std::exception &e) {
+  }
+
+  for (uint8_t * buffer : buffers_)
+    free(buffer);
+  free(header_);
+}
+
+void RecordingSink::Open(uint64_t payload_size, const CameraConfig & camera, const string & settings,
+    const string & info) {
+  if (payload_size == 0)
+    throw runtime_error("Recording needs the payload size of the camera");
+
+  size_t buffer_count = size_t(max(1, config_.record_buffers));
+
+  header_size_ = AlignToBlock(sizeof(FileHeader) + settings.size() + info.size());
+  slot_size_ = AlignToBlock(sizeof(RecordHeader) + payload_size);
+  slots_per_file_ = max(uint64_t(1), uint64_t(config_.record_file_size * 1e6) / slot_size_);
+  file_slot_ = slots_per_file_;
+
+  // the header is the same in every file but for its number and clocks
+  header_ = AllocateAligned(header_size_);
+  FileHeader & header = *reinterpret_cast<FileHeader *>(header_);
+  memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+  header.version = RECORDING_VERSION;
+  header.header_size = uint32_t(header_size_);
+  header.slot_size = slot_size_;
+  header.payload_size = payload_size;
+  header.width = uint32_t(camera.width);
+  header.height = uint32_t(camera.height);
+  strncpy(header.pixel_format, camera.pixel_format.c_str(), sizeof(header.pixel_format) - 1);
+  header.settings_size = uint32_t(settings.size());
+  header.info_size = uint32_t(info.size());
+  memcpy(header_ + sizeof(FileHeader), settings.data(), settings.size());
+  memcpy(header_ + sizeof(FileHeader) + settings.size(), info.data(), info.size());
+
+  for (size_t i = 0; i < buffer_count; i++) {
+    buffers_.push_back(AllocateAligned(slot_size_));
+    free_buffers_.push_back(i);
+  }
+
+  buffer_files_.assign(buffer_count, 0);
+  payload_sizes_.assign(buffer_count, 0);
+  done_.reserve(buffer_count);
+  backend_ = CreateWriteBackend(config_.record_backend, buffer_count, config_.record_threads, backend_note_);
+
+  // the first file decides whether O_DIRECT works, the others follow it
+  UseFile(PrepareFile(0));
+  preparer_ = thread(&RecordingSink::PrepareFiles, this);
+}
+
+RecordingSink::PreparedFile RecordingSink::PrepareFile(size_t number) {
+  char name[32];
+  snprintf(name, sizeof(name), ".%05zu.rec", number);
+  PreparedFile file = { -1, nullptr, config_.record_path + name };
+
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+  file.fd = open(file.path.c_str(), flags | (direct_ ? O_DIRECT : 0), 0644);
+
+  // tmpfs and some network file systems refuse O_DIRECT, the first file
+  // settles it for the recording
+  if (file.fd < 0 && direct_ && errno == EINVAL && number == 0) {
+    direct_ = false;
+    file.fd = open(file.path.c_str(), flags, 0644);
+  }
+
+  if (file.fd < 0)
+    throw runtime_error("Cannot open " + file.path + ": " + strerror(errno));
+
+  try {
+    // reserve the whole file so that writes do not allocate blocks
+    int error = posix_fallocate(file.fd, 0, off_t(header_size_ + slots_per_file_ * slot_size_));
+    if (error != 0 && error != EOPNOTSUPP && error != EINVAL)
+      throw runtime_error("Cannot preallocate " + file.path + ": " + strerror(error));
+
+    FileHeader & header = *reinterpret_cast<FileHeader *>(header_);
+    header.file_number = number;
+    header.steady_origin = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+    header.system_origin = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+
+    if (pwrite(file.fd, header_, header_size_, 0) != ssize_t(header_size_))
+      throw runtime_error("Cannot write header of " + file.path + ": " + strerror(errno));
+
+    file.index = fopen((file.path + ".idx").c_str(), "wb");
+    if (!file.index)
+      throw runtime_error("Cannot open " + file.path + ".idx: " + strerror(errno));
+  }
+  catch (...) {
+    close(file.fd);
+    throw;
+  }
+
+  IndexHeader index_header;
+  memcpy(index_header.magic, INDEX_MAGIC, sizeof(index_header.magic));
+  index_header.version = RECORDING_VERSION;
+  index_header.entry_size = sizeof(IndexEntry);
+  fwrite(&index_header, sizeof(index_header), 1, file.index);
+
+  return file;
+}
+
+void RecordingSink::PrepareFiles() {
+  unique_lock<mutex> lock(prepare_mutex_);
+
+  for (size_t number = 1; ; number++) {
+    prepare_signal_.wait(lock, [this] { return stop_preparing_ || (!prepared_ready_ && !prepare_error_); });
+    if (stop_preparing_)
+      return;
+
+    lock.unlock();
+    PreparedFile file = { -1, nullptr, "" };
+    exception_ptr error;
+    try {
+      file = PrepareFile(number);
+    }
+    catch (...) {
+      error = current_exception();
+    }
+    lock.lock();
+
+    prepared_ = file;
+    prepared_ready_ = !error;
+    prepare_error_ = error;
+    prepare_signal_.notify_all();
+  }
+}
+
+void RecordingSink::StopPreparing() {
+  if (!preparer_.joinable())
+    return;
+
+  {
+    lock_guard<mutex> lock(prepare_mutex_);
+    stop_preparing_ = true;
+  }
+  prepare_signal_.notify_all();
+  preparer_.join();
+
+  // a file prepared but never written is not part of the recording
+  if (prepared_ready_) {
+    fclose(prepared_.index);
+    close(prepared_.fd);
+    unlink((prepared_.path + ".idx").c_str());
+    unlink(prepared_.path.c_str());
+    prepared_ready_ = false;
+  }
+}
+
+void RecordingSink::NextFile() {
+  PreparedFile file;
+  {
+    unique_lock<mutex> lock(prepare_mutex_);
+    prepare_signal_.wait(lock, [this] { return prepared_ready_ || prepare_error_; });
+    if (prepare_error_)
+      rethrow_exception(prepare_error_);
+
+    file = prepared_;
+    prepared_ready_ = false;
+  }
+  prepare_signal_.notify_all();
+
+  // the index is complete once the last record is queued
+  if (index_ && fclose(index_) != 0)
+    throw runtime_error(string("Cannot write recording index: ") + strerror(errno));
+  index_ = nullptr;
+
+  // the previous file keeps its descriptor until its writes are done
+  if (file_writes_.back() == 0) {
+    close(files_.back());
+    files_.back() = -1;
+  }
+
+  UseFile(file);
+}
+
+void RecordingSink::UseFile(const PreparedFile & file) {
+  files_.push_back(file.fd);
+  file_writes_.push_back(0);
+  index_ = file.index;
+  file_slot_ = 0;
+}
+
+bool RecordingSink::Write(const Frame & frame, steady_clock::time_point arrival) {
+  Reap(false);
+
+  if (free_buffers_.empty() || frame.size > slot_size_ - sizeof(RecordHeader)) {
+    // queued writes free buffers only once they are submitted
+    Flush();
+    counters_.dropped_frames++;
+    return false;
+  }
+
+  if (file_slot_ == slots_per_file_)
+    NextFile();
+
+  size_t buffer = free_buffers_.back();
+  free_buffers_.pop_back();
+
+  uint64_t offset = header_size_ + file_slot_ * slot_size_;
+
+  RecordHeader & record = *reinterpret_cast<RecordHeader *>(buffers_[buffer]);
+  record.magic = RECORD_MAGIC;
+  record.payload_size = uint32_t(frame.size);
+  record.sequence = counters_.submissions;
+  record.frame_id = frame.frame_id;
+  record.device_timestamp = frame.timestamp;
+  record.host_timestamp = duration_cast<nanoseconds>(arrival.time_since_epoch()).count();
+  record.payload_offset = offset + sizeof(RecordHeader);
+  record.flags = frame.incomplete ? RECORD_INCOMPLETE : 0;
+  record.status = uint32_t(frame.status);
+  record.reserved = 0;
+
+  memcpy(buffers_[buffer] + sizeof(RecordHeader), frame.data, frame.size);
+  payload_sizes_[buffer] = uint32_t(frame.size);
+
+  // index entries go through the stdio buffer, a write per few thousand frames
+  IndexEntry entry = { offset, record.sequence, record.frame_id, record.device_timestamp, record.host_timestamp };
+  fwrite(&entry, sizeof(entry), 1, index_);
+
+  if (counters_.submissions == 0)
+    first_submission_ = steady_clock::now();
+
+  backend_->Submit(files_.back(), buffers_[buffer], slot_size_, offset, buffer);
+  buffer_files_[buffer] = files_.size() - 1;
+  file_writes_.back()++;
+  file_slot_++;
+  unflushed_++;
+
+  counters_.queue_depth++;
+  counters_.max_queue_depth = max(counters_.max_queue_depth, counters_.queue_depth);
+  counters_.queue_depth_sum += counters_.queue_depth;
+  counters_.submissions++;
+
+  if (unflushed_ >= size_t(max(1, config_.record_batch)))
+    Flush();
+
+  return true;
+}
+
+void RecordingSink::Flush() {
+  if (unflushed_ == 0)
+    return;
+
+  backend_->Flush();
+  unflushed_ = 0;
+}
+
+void RecordingSink::Reap(bool wait) {
+  if (wait)
+    Flush();
+
+  backend_->Complete(done_, wait);
+
+  for (const WriteResult & result : done_) {
+    if (result.result < 0)
+      throw runtime_error(string("Recording write failed: ") + strerror(int(-result.result)));
+    if (uint64_t(result.result) != slot_size_)
+      throw runtime_error("Recording write was cut short");
+
+    counters_.frames_written++;
+    counters_.bytes_written += payload_sizes_[result.tag];
+    counters_.queue_depth--;
+    free_buffers_.push_back(result.tag);
+
+    // a finished file is closed with its last write
+    size_t file = buffer_files_[result.tag];
+    if (--file_writes_[file] == 0 && file + 1 < files_.size()) {
+      close(files_[file]);
+      files_[file] = -1;
+    }
+  }
+
+  if (!done_.empty())
+    counters_.seconds = duration<double>(steady_clock::now() - first_submission_).count();
+
+  done_.clear();
+}
+
+void RecordingSink::Close() {
+  StopPreparing();
+
+  if (files_.empty())
+    return;
+
+  while (counters_.queue_depth > 0)
+    Reap(true);
+
+  if (index_ && fclose(index_) != 0)
+    throw runtime_error(string("Cannot write recording index: ") + strerror(errno));
+  index_ = nullptr;
+
+  // the last file ends after its last record
+  if (ftruncate(files_.back(), off_t(header_size_ + file_slot_ * slot_size_)) != 0)
+    throw runtime_error(string("Cannot trim recording: ") + strerror(errno));
+
+  for (int fd : files_)
+    if (fd >= 0)
+      close(fd);
+  files_.clear();
+  file_writes_.clear();
+}
+
+void RecordingSink::PrintInfo(ostream & out) const {
+  out << "Recording settings" << endl
+    << "==================" << endl;
+
+  out << Label("Path") << config_.record_path << ".*.rec" << endl;
+  out << Label("Backend") << (backend_ ? backend_->Name() : config_.record_backend) << endl;
+  if (!backend_note_.empty())
+    out << Label("") << backend_note_ << endl;
+  out << Label("Direct I/O") << (direct_ ? "yes" : "no") << endl;
+  out << Label("Buffers") << buffers_.size() << endl;
+  out << Label("Record slot") << slot_size_ << " bytes" << endl;
+  out << Label("File size") << (header_size_ + slots_per_file_ * slot_size_) / 1e6 << " MB" << endl;
+  out << endl;
+}
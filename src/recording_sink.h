@@ -0,0 +1,119 @@
+#ifndef RECORDING_SINK_H
+#define RECORDING_SINK_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "config.h"
+#include "frame_source.h"
+#include "recording_format.h"
+#include "write_backend.h"
+
+struct RecordingCounters {
+  uint64_t frames_written;
+  uint64_t bytes_written;      // payload bytes, without the padding to the block size
+  uint64_t dropped_frames;     // no buffer was free, storage fell behind
+  uint64_t queue_depth_sum;    // writes in flight summed over every submission
+  uint64_t submissions;
+  size_t queue_depth;          // writes in flight now
+  size_t max_queue_depth;
+  double seconds;              // from the first submission to the last completion
+};
+
+// Writes frames to preallocated recording files of record_file_size MB in
+// the layout of recording_format.h. Every frame takes a slot of its record
+// header and the payload rounded up to the block size, so that the files
+// can be opened with O_DIRECT. Records are copied into aligned buffers
+// allocated up front and recycled as their writes complete, writes are
+// submitted in batches of record_batch. When no buffer is free the frame is
+// dropped, the camera is never held up by storage. The next file is
+// created and preallocated on a thread of its own while the current one
+// fills, and a file is closed as soon as its last write completed.
+class RecordingSink {
+ public:
+  explicit RecordingSink(const TestConfig & test_config);
+  ~RecordingSink();
+
+  // Allocate buffers for payloads up to payload_size bytes and create the
+  // first file. settings and info are stored in the header of every file.
+  void Open(uint64_t payload_size, const CameraConfig & camera, const std::string & settings,
+      const std::string & info);
+
+  // Queue frame for writing, arrival is when it reached the host. Returns
+  // false when the frame was dropped.
+  bool Write(const Frame & frame, std::chrono::steady_clock::time_point arrival);
+
+  // Wait for all writes, trim the last file and close the files
+  void Close();
+
+  const RecordingCounters & Counters() const { return counters_; }
+
+  void PrintInfo(std::ostream & out) const;
+
+ private:
+  // A data file with its header written and its index opened
+  struct PreparedFile {
+    int fd;
+    FILE * index;
+    std::string path;
+  };
+
+  // Create, preallocate and write the header of file number
+  PreparedFile PrepareFile(size_t number);
+  // Body of the thread preparing the file after the current one
+  void PrepareFiles();
+  void StopPreparing();
+
+  // Move on to the next file, waiting for it only when it is not prepared
+  // yet
+  void NextFile();
+  void UseFile(const PreparedFile & file);
+  void Flush();
+  void Reap(bool wait);
+
+  TestConfig config_;
+  bool direct_;
+  std::unique_ptr<WriteBackend> backend_;
+  std::string backend_note_;
+
+  uint64_t header_size_;
+  uint64_t slot_size_;
+  uint64_t slots_per_file_;
+  uint64_t file_slot_;
+  // descriptor of every file, -1 once closed, and its writes in flight
+  std::vector<int> files_;
+  std::vector<uint64_t> file_writes_;
+  FILE * index_;
+
+  // header of the files, padded to header_size_ and aligned. Only the
+  // preparing thread touches it once the first file is open.
+  uint8_t * header_;
+
+  // next file, prepared while the current one fills
+  std::thread preparer_;
+  std::mutex prepare_mutex_;
+  std::condition_variable prepare_signal_;
+  bool prepared_ready_;
+  PreparedFile prepared_;
+  std::exception_ptr prepare_error_;
+  bool stop_preparing_;
+
+  std::vector<uint8_t *> buffers_;
+  std::vector<size_t> buffer_files_;
+  std::vector<uint32_t> payload_sizes_;
+  std::vector<size_t> free_buffers_;
+  std::vector<WriteResult> done_;
+  size_t unflushed_;
+
+  RecordingCounters counters_;
+  std::chrono::steady_clock::time_point first_submission_;
+};
+
+#endif
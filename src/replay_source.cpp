@@ -0,0 +1,354 @@
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "replay_source.h"
+#include "report.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Spinnaker default for USB3 cameras
+static const size_t DEFAULT_BUFFER_COUNT = 10;
+
+// Handle of frames delivered straight from the mapped file
+static const uint64_t NO_BUFFER = ~uint64_t(0);
+
+static const microseconds POLL_SLEEP(50);
+static const size_t PAGE_SIZE = 4096;
+
+ReplaySource::ReplaySource(const CameraConfig & config)
+  : config_(config), payload_size_(0), frames_(0), first_host_time_(0), span_(0), frame_id_span_(0), at_end_(true),
+    stop_reader_(false), reader_done_(false) {
+}
+
+ReplaySource::~ReplaySource() {
+  DeInit();
+}
+
+void ReplaySource::Init() {
+  DeInit();
+
+  for (size_t number = 0; ; number++) {
+    char name[32];
+    snprintf(name, sizeof(name), ".%05zu.rec", number);
+    string path = config_.replay_path + name;
+
+    if (access(path.c_str(), R_OK) != 0)
+      break;
+
+    files_.push_back(unique_ptr<RecordingReader>(new RecordingReader(path)));
+    descriptors_.push_back(open(path.c_str(), O_RDONLY));
+    if (descriptors_.back() < 0)
+      throw runtime_error("Cannot open " + path + ": " + strerror(errno));
+
+    // playback reads each file once from start to end
+    const RecordingReader & file = *files_.back();
+    if (file.Size() > 0)
+      madvise(const_cast<uint8_t *>(file.Data()), file.Size(), MADV_SEQUENTIAL);
+
+    payload_size_ = max(payload_size_, file.Header().payload_size);
+    frames_ += file.Frames();
+  }
+
+  if (files_.empty())
+    throw runtime_error("No recording found at " + config_.replay_path + ".00000.rec");
+  if (frames_ == 0)
+    throw runtime_error("Recording at " + config_.replay_path + " holds no frames");
+
+  // A pass lasts from the first to the last frame plus one mean interval,
+  // so that looping keeps the frame rate
+  int64_t last_host_time = 0;
+  uint64_t first_frame_id = 0, last_frame_id = 0;
+  bool has_first = false;
+  for (const unique_ptr<RecordingReader> & file : files_) {
+    if (file->Frames() == 0)
+      continue;
+    if (!has_first) {
+      first_host_time_ = file->Entry(0).host_timestamp;
+      first_frame_id = file->Entry(0).frame_id;
+    }
+    has_first = true;
+    last_host_time = file->Entry(file->Frames() - 1).host_timestamp;
+    last_frame_id = file->Entry(file->Frames() - 1).frame_id;
+  }
+  span_ = frames_ > 1 ? int64_t(double(last_host_time - first_host_time_) * frames_ / (frames_ - 1)) : 0;
+
+  // Frame IDs of a pass continue from the last one of the pass before, so
+  // that a loop reads neither as a stream restart nor as lost frames
+  frame_id_span_ = last_frame_id >= first_frame_id ? last_frame_id - first_frame_id + 1 : frames_;
+
+  Configure(config_);
+}
+
+void ReplaySource::DeInit() {
+  StopReadAhead();
+
+  for (int fd : descriptors_)
+    if (fd >= 0)
+      close(fd);
+
+  descriptors_.clear();
+  files_.clear();
+  payload_size_ = 0;
+  frames_ = 0;
+}
+
+void ReplaySource::Configure(const CameraConfig & config) {
+  config_ = config;
+
+  if (config_.replay_timing != "original" && config_.replay_timing != "scaled" && config_.replay_timing != "fast")
+    throw runtime_error("Unknown replay_timing " + config_.replay_timing + ", use original, scaled or fast");
+  if (config_.replay_read != "mmap" && config_.replay_read != "pread" && config_.replay_read != "async")
+    throw runtime_error("Unknown replay_read " + config_.replay_read + ", use mmap, pread or async");
+  if (config_.replay_speed <= 0)
+    throw runtime_error("Replay needs replay_speed > 0");
+
+  StopReadAhead();
+
+  // Mapped payloads need no buffers, the others read whole records
+  size_t buffer_count = config_.buffer_count_mode == "Manual" && config_.buffer_count > 0
+    ? size_t(config_.buffer_count) : DEFAULT_BUFFER_COUNT;
+  if (config_.replay_read == "mmap" || files_.empty())
+    buffer_count = 0;
+
+  buffers_.assign(buffer_count, vector<uint8_t>(sizeof(RecordHeader) + payload_size_));
+}
+
+void ReplaySource::PrintInfo(ostream & out) {
+  out << "Replay source settings" << endl
+    << "======================" << endl;
+
+  const FileHeader & header = files_.front()->Header();
+
+  out << Label("Recording") << config_.replay_path << ".*.rec" << endl;
+  out << Label("Files") << files_.size() << endl;
+  out << Label("Frames") << frames_ << endl;
+  out << Label("Pixel format") << header.pixel_format << endl;
+  out << Label("Width") << header.width << endl;
+  out << Label("Height") << header.height << endl;
+  out << Label("Frame size") << payload_size_ << " bytes" << endl;
+  if (frames_ > 1 && span_ > 0)
+    out << Label("Recorded rate") << frames_ * 1e9 / span_ << " fps" << endl;
+  out << Label("Timing") << config_.replay_timing;
+  if (config_.replay_timing == "scaled")
+    out << " x" << config_.replay_speed;
+  out << endl;
+  out << Label("Read") << config_.replay_read << endl;
+  out << Label("Buffer count") << buffers_.size() << endl;
+  out << Label("Loop") << (config_.replay_loop ? "yes" : "no") << endl;
+  out << Label("Drop cache") << (config_.replay_drop_cache ? "yes" : "no") << endl;
+  out << endl;
+}
+
+void ReplaySource::BeginAcquisition() {
+  StopReadAhead();
+
+  // Evict the recording from the page cache so that the first pass reads
+  // from storage, after unmapping the pages mapped by earlier passes. Pages
+  // mapped by another process stay.
+  if (config_.replay_drop_cache) {
+    for (size_t i = 0; i < files_.size(); i++) {
+      if (files_[i]->Size() > 0)
+        madvise(const_cast<uint8_t *>(files_[i]->Data()), files_[i]->Size(), MADV_DONTNEED);
+      posix_fadvise(descriptors_[i], 0, 0, POSIX_FADV_DONTNEED);
+    }
+  }
+
+  free_buffers_.reset(new SpscRing<size_t>(max(size_t(1), buffers_.size())));
+  for (size_t i = 0; i < buffers_.size(); i++)
+    free_buffers_->TryPush(i);
+
+  cursor_ = Cursor{ 0, 0, 0 };
+  while (files_[cursor_.file]->Frames() == 0)
+    cursor_.file++;
+  at_end_ = false;
+
+  start_ = steady_clock::now();
+
+  if (config_.replay_read == "async") {
+    read_records_.reset(new SpscRing<ReadRecord>(max(size_t(1), buffers_.size())));
+    stop_reader_ = false;
+    reader_done_ = false;
+    reader_error_ = nullptr;
+    reader_ = thread(&ReplaySource::ReadAhead, this);
+  }
+}
+
+void ReplaySource::EndAcquisition() {
+  StopReadAhead();
+}
+
+void ReplaySource::GetNextFrame(Frame & frame) {
+  Cursor cursor;
+  uint64_t buffer = NO_BUFFER;
+  const RecordHeader * record;
+
+  if (config_.replay_read == "async") {
+    ReadRecord read = ReadRecord();
+
+    while (!read_records_->TryPop(read)) {
+      if (reader_done_ && !read_records_->TryPop(read)) {
+        if (reader_error_)
+          rethrow_exception(reader_error_);
+        throw EndOfStream();
+      }
+      else if (reader_done_)
+        break;
+      this_thread::sleep_for(POLL_SLEEP);
+    }
+
+    cursor = read.cursor;
+    buffer = read.buffer;
+    record = reinterpret_cast<const RecordHeader *>(buffers_[buffer].data());
+  }
+  else {
+    if (at_end_)
+      throw EndOfStream();
+
+    cursor = cursor_;
+    at_end_ = !Advance(cursor_);
+
+    if (config_.replay_read == "pread") {
+      buffer = TakeBuffer();
+      ReadPayload(cursor, buffer);
+      record = reinterpret_cast<const RecordHeader *>(buffers_[buffer].data());
+    }
+    else {
+      record = &files_[cursor.file]->Record(cursor.record);
+
+      // Fault the payload in now, a frame from the other strategies is in
+      // memory when it is delivered
+      const volatile uint8_t * payload = files_[cursor.file]->Payload(cursor.record);
+      for (size_t offset = 0; offset < record->payload_size; offset += PAGE_SIZE)
+        payload[offset];
+    }
+  }
+
+  WaitFor(cursor);
+
+  const FileHeader & header = files_[cursor.file]->Header();
+
+  frame.data = reinterpret_cast<const uint8_t *>(record + 1);
+  frame.size = record->payload_size;
+  frame.width = header.width;
+  frame.height = header.height;
+  frame.frame_id = record->frame_id + cursor.loop * frame_id_span_;
+  frame.timestamp = record->device_timestamp;
+  frame.incomplete = (record->flags & RECORD_INCOMPLETE) != 0;
+  frame.status = int(record->status);
+  frame.handle = buffer;
+}
+
+void ReplaySource::ReleaseFrame(Frame & frame) {
+  if (frame.handle == NO_BUFFER)
+    return;
+
+  lock_guard<mutex> lock(release_mutex_);
+  free_buffers_->TryPush(size_t(frame.handle));
+}
+
+uint64_t ReplaySource::BufferMemory() {
+  return uint64_t(buffers_.size()) * (sizeof(RecordHeader) + payload_size_);
+}
+
+uint64_t ReplaySource::PayloadSize() {
+  return payload_size_;
+}
+
+bool ReplaySource::Advance(Cursor & cursor) const {
+  cursor.record++;
+
+  while (cursor.record >= files_[cursor.file]->Frames()) {
+    cursor.record = 0;
+    cursor.file++;
+
+    if (cursor.file == files_.size()) {
+      if (!config_.replay_loop)
+        return false;
+
+      cursor.file = 0;
+      cursor.loop++;
+    }
+  }
+
+  return true;
+}
+
+void ReplaySource::ReadPayload(const Cursor & cursor, size_t buffer) {
+  const RecordingReader & file = *files_[cursor.file];
+  const IndexEntry & entry = file.Entry(cursor.record);
+  size_t size = sizeof(RecordHeader) + payload_size_;
+  size_t done = 0;
+
+  // the record header comes along, the payload size is in there
+  while (done < size) {
+    ssize_t read = pread(descriptors_[cursor.file], buffers_[buffer].data() + done, size - done,
+      off_t(entry.offset + done));
+    if (read < 0 && errno == EINTR)
+      continue;
+    if (read < 0)
+      throw runtime_error(string("Cannot read recording: ") + strerror(errno));
+    if (read == 0)
+      break;
+    done += size_t(read);
+  }
+
+  const RecordHeader & record = *reinterpret_cast<const RecordHeader *>(buffers_[buffer].data());
+  if (done < sizeof(RecordHeader) || done < sizeof(RecordHeader) + record.payload_size)
+    throw runtime_error("Recording ends within a record");
+}
+
+void ReplaySource::WaitFor(const Cursor & cursor) const {
+  if (config_.replay_timing == "fast")
+    return;
+
+  double speed = config_.replay_timing == "scaled" ? config_.replay_speed : 1;
+  int64_t offset = files_[cursor.file]->Entry(cursor.record).host_timestamp - first_host_time_
+    + int64_t(cursor.loop) * span_;
+
+  this_thread::sleep_until(start_ + nanoseconds(int64_t(offset / speed)));
+}
+
+size_t ReplaySource::TakeBuffer() {
+  size_t buffer;
+
+  while (!free_buffers_->TryPop(buffer))
+    this_thread::sleep_for(POLL_SLEEP);
+
+  return buffer;
+}
+
+void ReplaySource::ReadAhead() {
+  Cursor cursor = cursor_;
+  bool more = true;
+
+  try {
+    while (more && !stop_reader_) {
+      size_t buffer;
+      if (!free_buffers_->TryPop(buffer)) {
+        this_thread::sleep_for(POLL_SLEEP);
+        continue;
+      }
+
+      ReadPayload(cursor, buffer);
+
+      // there are no more records in flight than buffers, the ring has room
+      read_records_->TryPush(ReadRecord{ cursor, buffer });
+      more = Advance(cursor);
+    }
+  }
+  catch (...) {
+    reader_error_ = current_exception();
+  }
+
+  reader_done_ = true;
+}
+
+void ReplaySource::StopReadAhead() {
+  stop_reader_ = true;
+  if (reader_.joinable())
+    reader_.join();
+}
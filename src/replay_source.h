@@ -0,0 +1,96 @@
+#ifndef REPLAY_SOURCE_H
+#define REPLAY_SOURCE_H
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "config.h"
+#include "frame_source.h"
+#include "recording_reader.h"
+#include "spsc_ring.h"
+
+// Plays back the frames of a recording made with record_path, at their
+// original timing, at replay_speed times that or as fast as possible.
+// Payloads are delivered straight from the mapped files, read with pread
+// on demand or read ahead on a thread of their own, to compare how fast
+// each way gets recorded frames back into memory. Frames are never dropped,
+// when all buffers are held GetNextFrame waits for one to be released.
+class ReplaySource : public FrameSource {
+ public:
+  explicit ReplaySource(const CameraConfig & config);
+  ~ReplaySource();
+
+  void Init() override;
+  void DeInit() override;
+  void Configure(const CameraConfig & config) override;
+  void PrintInfo(std::ostream & out) override;
+  void BeginAcquisition() override;
+  void EndAcquisition() override;
+  void GetNextFrame(Frame & frame) override;
+  void ReleaseFrame(Frame & frame) override;
+  uint64_t BufferMemory() override;
+  uint64_t PayloadSize() override;
+
+ private:
+  // Position of a record in the recording
+  struct Cursor {
+    size_t file;
+    size_t record;
+    uint64_t loop;
+  };
+
+  // A record read into a buffer by the read-ahead thread
+  struct ReadRecord {
+    Cursor cursor;
+    size_t buffer;
+  };
+
+  // Move to the following record, returns false at the end of a recording
+  // that is not looped
+  bool Advance(Cursor & cursor) const;
+
+  // Copy the payload of a record into a buffer with pread
+  void ReadPayload(const Cursor & cursor, size_t buffer);
+
+  // Wait until the record is due
+  void WaitFor(const Cursor & cursor) const;
+
+  size_t TakeBuffer();
+  void ReadAhead();
+  void StopReadAhead();
+
+  CameraConfig config_;
+  std::vector<std::unique_ptr<RecordingReader>> files_;
+  std::vector<int> descriptors_;
+  uint64_t payload_size_;
+  uint64_t frames_;
+
+  // host time of the first record and the span of a whole pass
+  int64_t first_host_time_;
+  int64_t span_;
+  // added to the frame IDs of each further pass
+  uint64_t frame_id_span_;
+
+  std::chrono::steady_clock::time_point start_;
+  Cursor cursor_;
+  bool at_end_;
+
+  std::vector<std::vector<uint8_t>> buffers_;
+  std::unique_ptr<SpscRing<size_t>> free_buffers_;
+  // frames are released by the consumer and, when its ring overflows, by
+  // the acquisition thread, the free list takes one of them at a time
+  std::mutex release_mutex_;
+
+  // read-ahead thread
+  std::unique_ptr<SpscRing<ReadRecord>> read_records_;
+  std::thread reader_;
+  std::atomic<bool> stop_reader_;
+  std::atomic<bool> reader_done_;
+  std::exception_ptr reader_error_;
+};
+
+#endif
@@ -0,0 +1,23 @@
+#include <iomanip>
+#include <sstream>
+#include "report.h"
+
+using namespace std;
+
+string Label(string str, const size_t num, const char paddingChar) {
+  if(num > str.size())
+    str.insert(str.end(), num - str.size(), paddingChar);
+
+  return str + ": ";
+}
+
+string Us(double ns) {
+  ostringstream out;
+  out << fixed << setprecision(1) << ns / 1000 << "us";
+  return out.str();
+}
+
+void PrintLossBudget(ostream & out, const TestConfig & test_config, bool within_budget) {
+  out << Label("Loss budget") << test_config.loss_budget * 100 << "% "
+    << (within_budget ? "met" : "exceeded") << endl;
+}
@@ -0,0 +1,17 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <ostream>
+#include <string>
+#include "config.h"
+
+// Pad label to a fixed width so that printed values line up
+std::string Label(std::string str, const size_t num = 20, const char paddingChar = ' ');
+
+// Nanoseconds printed as microseconds with one decimal
+std::string Us(double ns);
+
+// Print whether lost and incomplete frames stayed within the loss budget
+void PrintLossBudget(std::ostream & out, const TestConfig & test_config, bool within_budget);
+
+#endif
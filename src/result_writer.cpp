@@ -0,0 +1,92 @@
+#include <sstream>
+#include <stdexcept>
+#include "result_writer.h"
+
+using namespace std;
+
+ResultField TextField(const string & name, const string & value) {
+  ResultField field = { name, value, false };
+  return field;
+}
+
+ResultField NumberField(const string & name, double value) {
+  ostringstream text;
+  text.precision(10);
+  text << value;
+
+  ResultField field = { name, text.str(), true };
+  return field;
+}
+
+static string Quote(const string & value, char escape) {
+  string quoted = "\"";
+
+  for (char c : value) {
+    if (c == '"' || c == escape)
+      quoted += escape;
+    quoted += c;
+  }
+
+  return quoted + "\"";
+}
+
+ResultWriter::ResultWriter() : json_(false), rows_(0) {
+}
+
+ResultWriter::~ResultWriter() {
+  Close();
+}
+
+void ResultWriter::Open(const string & path) {
+  if (path.empty())
+    return;
+
+  file_.open(path.c_str(), ios::out | ios::trunc);
+  if (!file_)
+    throw runtime_error("Cannot write results to " + path);
+
+  json_ = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+  rows_ = 0;
+
+  if (json_)
+    file_ << "[" << flush;
+}
+
+void ResultWriter::Close() {
+  if (!file_.is_open())
+    return;
+
+  if (json_)
+    file_ << (rows_ ? "\n]\n" : "]\n");
+
+  file_.close();
+}
+
+void ResultWriter::WriteRow(const vector<ResultField> & row) {
+  if (!file_.is_open())
+    return;
+
+  if (json_) {
+    file_ << (rows_ ? ",\n  {" : "\n  {");
+    for (size_t i = 0; i < row.size(); i++) {
+      file_ << (i ? ", " : "") << Quote(row[i].name, '\\') << ": "
+        << (row[i].is_number ? row[i].value : Quote(row[i].value, '\\'));
+    }
+    file_ << "}";
+  }
+  else {
+    // CSV header comes from the names of the first row
+    if (rows_ == 0) {
+      for (size_t i = 0; i < row.size(); i++)
+        file_ << (i ? "," : "") << row[i].name;
+      file_ << "\n";
+    }
+
+    for (size_t i = 0; i < row.size(); i++)
+      file_ << (i ? "," : "") << (row[i].is_number ? row[i].value : Quote(row[i].value, '"'));
+    file_ << "\n";
+  }
+
+  file_ << flush;
+  rows_++;
+}
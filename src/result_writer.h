@@ -0,0 +1,38 @@
+#ifndef RESULT_WRITER_H
+#define RESULT_WRITER_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Named value of a result row, numbers are written without quotes
+struct ResultField {
+  std::string name;
+  std::string value;
+  bool is_number;
+};
+
+ResultField TextField(const std::string & name, const std::string & value);
+ResultField NumberField(const std::string & name, double value);
+
+// Writes one machine readable row per measurement, as a JSON array of
+// objects when the path ends in .json and as CSV otherwise. Rows are flushed
+// as they are written so an interrupted run keeps its results.
+class ResultWriter {
+ public:
+  ResultWriter();
+  ~ResultWriter();
+
+  // Without a path rows are discarded
+  void Open(const std::string & path);
+  void Close();
+
+  void WriteRow(const std::vector<ResultField> & row);
+
+ private:
+  std::ofstream file_;
+  bool json_;
+  size_t rows_;
+};
+
+#endif
@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include "roi_search.h"
+#include "measurement.h"
+#include "report.h"
+#include "sweep.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Measured frame rate may fall short of the target by rounding of the
+// window boundaries
+static const double FPS_TOLERANCE = 0.999;
+
+struct Roi {
+  int width;
+  int height;
+  int offset_x;
+  int offset_y;
+};
+
+// Largest multiple of inc not above value
+static int RoundDown(int value, int inc) {
+  return inc > 1 ? value / inc * inc : value;
+}
+
+// Smallest multiple of inc not below value
+static int RoundUp(int value, int inc) {
+  return inc > 1 ? (value + inc - 1) / inc * inc : value;
+}
+
+// Offsets of a width x height region, centered or the configured ones moved
+// inside the sensor
+static Roi PlaceRoi(const RoiLimits & limits, const CameraConfig & camera, bool center, int width, int height) {
+  Roi roi = { width, height, camera.offset_x, camera.offset_y };
+
+  if (center) {
+    roi.offset_x = (limits.width_max - width) / 2;
+    roi.offset_y = (limits.height_max - height) / 2;
+  }
+
+  roi.offset_x = RoundDown(max(0, min(roi.offset_x, limits.width_max - width)), limits.offset_x_inc);
+  roi.offset_y = RoundDown(max(0, min(roi.offset_y, limits.height_max - height)), limits.offset_y_inc);
+
+  return roi;
+}
+
+// Region for step k of the search, the size along the searched dimension is
+// k increments
+class RoiSteps {
+ public:
+  RoiSteps(const RoiLimits & limits, const CameraConfig & camera, const TestConfig & test_config)
+      : limits_(limits), camera_(camera), center_(test_config.roi_center), hold_(test_config.roi_hold), aspect_(1) {
+    limits_.width_inc = max(1, limits_.width_inc);
+    limits_.height_inc = max(1, limits_.height_inc);
+    limits_.offset_x_inc = max(1, limits_.offset_x_inc);
+    limits_.offset_y_inc = max(1, limits_.offset_y_inc);
+
+    fixed_width_ = Clamp(RoundDown(camera.width, limits_.width_inc), limits_.width_min, limits_.width_max,
+        limits_.width_inc);
+    fixed_height_ = Clamp(RoundDown(camera.height, limits_.height_inc), limits_.height_min, limits_.height_max,
+        limits_.height_inc);
+
+    if (hold_ == "width") {
+      first_ = RoundUp(limits_.height_min, limits_.height_inc) / limits_.height_inc;
+      last_ = limits_.height_max / limits_.height_inc;
+    }
+    else if (hold_ == "height") {
+      first_ = RoundUp(limits_.width_min, limits_.width_inc) / limits_.width_inc;
+      last_ = limits_.width_max / limits_.width_inc;
+    }
+    else if (hold_ == "aspect") {
+      if (camera.width <= 0 || camera.height <= 0)
+        throw runtime_error("ROI search needs positive width and height for the aspect ratio");
+
+      aspect_ = double(camera.height) / camera.width;
+      first_ = RoundUp(limits_.width_min, limits_.width_inc) / limits_.width_inc;
+      last_ = min(limits_.width_max, int(limits_.height_max / aspect_)) / limits_.width_inc;
+
+      // the height of the smallest width may still be below its minimum
+      while (first_ < last_ && Height(first_) < limits_.height_min)
+        first_++;
+    }
+    else {
+      throw runtime_error("Unknown roi_hold " + hold_ + ", use aspect, width or height");
+    }
+
+    if (first_ > last_)
+      throw runtime_error("No region of interest fits the limits of the camera");
+  }
+
+  int First() const { return first_; }
+  int Last() const { return last_; }
+
+  Roi At(int k) const {
+    int width = fixed_width_;
+    int height = fixed_height_;
+
+    if (hold_ == "width") {
+      height = k * limits_.height_inc;
+    }
+    else if (hold_ == "height") {
+      width = k * limits_.width_inc;
+    }
+    else {
+      width = k * limits_.width_inc;
+      height = Clamp(Height(k), limits_.height_min, limits_.height_max, limits_.height_inc);
+    }
+
+    return PlaceRoi(limits_, camera_, center_, width, height);
+  }
+
+ private:
+  // Height closest to the aspect ratio for step k
+  int Height(int k) const {
+    int inc = limits_.height_inc;
+    return int(k * limits_.width_inc * aspect_ / inc + 0.5) * inc;
+  }
+
+  static int Clamp(int value, int low, int high, int inc) {
+    return max(RoundUp(low, inc), min(value, RoundDown(high, inc)));
+  }
+
+  RoiLimits limits_;
+  CameraConfig camera_;
+  bool center_;
+  string hold_;
+  double aspect_;
+  int fixed_width_;
+  int fixed_height_;
+  int first_;
+  int last_;
+};
+
+static string RoiText(const Roi & roi) {
+  ostringstream text;
+  text << roi.width << "x" << roi.height << "+" << roi.offset_x << "+" << roi.offset_y;
+  return text.str();
+}
+
+// Copy of config set up to run a single test with the given region
+static shared_ptr<cpptoml::table> RoiConfig(shared_ptr<cpptoml::table> config, const string & serial,
+    const Roi & roi) {
+  shared_ptr<cpptoml::table> roi_config = static_pointer_cast<cpptoml::table>(config->clone());
+  shared_ptr<cpptoml::table> camera = roi_config->get_table("camera");
+  shared_ptr<cpptoml::table> test = roi_config->get_table("test");
+
+  if (!camera) {
+    camera = cpptoml::make_table();
+    roi_config->insert("camera", camera);
+  }
+  if (!test) {
+    test = cpptoml::make_table();
+    roi_config->insert("test", test);
+  }
+
+  const char * keys[] = { "width", "height", "offset_x", "offset_y" };
+  const int values[] = { roi.width, roi.height, roi.offset_x, roi.offset_y };
+
+  for (int i = 0; i < 4; i++) {
+    camera->insert(keys[i], int64_t(values[i]));
+
+    // camera specific values would win over the found region
+    if (!serial.empty() && camera->contains(serial)) {
+      shared_ptr<cpptoml::table> overrides = camera->get_table(serial);
+      if (overrides)
+        overrides->erase(keys[i]);
+    }
+  }
+
+  test->insert("mode", string("single"));
+
+  return roi_config;
+}
+
+// Measure the source with the given region, returns whether it met the target
+static bool MeasureRoi(FrameSource & source, shared_ptr<cpptoml::table> config, const string & serial,
+    const TestConfig & test_config, const atomic<bool> & run, const Roi & roi, bool & acquiring) {
+  source.Configure(LoadCameraConfig(RoiConfig(config, serial, roi), serial));
+
+  Measurement measurement(source, duration_cast<nanoseconds>(duration<double>(test_config.warmup)));
+  bool stalled = !MeasureSetting(measurement, test_config, run, acquiring);
+
+  const FrameStats & stats = measurement.Stats();
+  bool within_budget = !stalled && measurement.WithinLossBudget(test_config.loss_budget);
+  bool passed = run && stats.RunFps() >= test_config.target_fps * FPS_TOLERANCE && within_budget;
+
+  ostringstream line;
+  line << fixed << setprecision(1) << RoiText(roi) << ": " << stats.RunFps() << "fps  "
+    << stats.RunBytesPerSecond() / 1e6 << "MB/s"
+    << setprecision(3) << "  loss " << stats.RunLossRatio() * 100 << "%"
+    << "  " << (passed ? "passed" : stalled ? "stalled" : "failed");
+  cout << line.str() << endl;
+
+  return passed;
+}
+
+bool RunRoiSearch(FrameSource & source, shared_ptr<cpptoml::table> config, const string & serial,
+    const TestConfig & test_config, const atomic<bool> & run) {
+  bool initialized = false, acquiring = false;
+
+  try {
+    if (test_config.target_fps <= 0)
+      throw runtime_error("ROI search needs test.target_fps");
+
+    source.Init();
+    initialized = true;
+    source.PrintInfo(cout);
+
+    RoiLimits limits;
+    if (!source.ReadRoiLimits(limits))
+      throw runtime_error("Region of interest of the camera cannot be changed");
+
+    RoiSteps steps(limits, LoadCameraConfig(config, serial), test_config);
+
+    cout << "ROI search for " << test_config.target_fps << " fps holding " << test_config.roi_hold << ", "
+      << test_config.warmup << "s warm-up and " << test_config.duration << "s measurement each" << endl
+      << "==========" << endl;
+
+    // Bisect between the largest step known to pass and the smallest known
+    // to fail, assuming the frame rate falls as the region grows
+    bool found = false;
+    int passed = steps.First();
+    int failed = steps.Last() + 1;
+
+    if (MeasureRoi(source, config, serial, test_config, run, steps.At(steps.Last()), acquiring)) {
+      passed = steps.Last();
+      found = true;
+    }
+    else {
+      failed = steps.Last();
+      found = run && steps.First() < steps.Last()
+        && MeasureRoi(source, config, serial, test_config, run, steps.At(steps.First()), acquiring);
+    }
+
+    while (found && run && failed - passed > 1) {
+      int k = passed + (failed - passed) / 2;
+
+      if (MeasureRoi(source, config, serial, test_config, run, steps.At(k), acquiring))
+        passed = k;
+      else
+        failed = k;
+    }
+
+    initialized = false;
+    source.DeInit();
+
+    ostringstream result;
+    result << endl;
+    if (!run) {
+      result << Label("Largest region") << "search interrupted" << endl;
+    }
+    else if (!found) {
+      result << Label("Largest region") << "none reached " << test_config.target_fps << " fps" << endl;
+    }
+    else {
+      Roi roi = steps.At(passed);
+      result << Label("Largest region") << RoiText(roi) << endl;
+
+      if (!test_config.roi_output.empty()) {
+        ofstream file(test_config.roi_output);
+        if (!file)
+          throw runtime_error("Cannot open " + test_config.roi_output);
+
+        file << *RoiConfig(config, serial, roi);
+        file.close();
+        result << Label("Configuration") << test_config.roi_output << endl;
+      }
+    }
+    cout << result.str() << endl;
+
+    return found && run;
+  }
+  catch (std::exception &e) {
+    cout << "Error: " << e.what() << endl;
+
+    // the first error is the one reported
+    try {
+      if (acquiring)
+        source.EndAcquisition();
+      if (initialized)
+        source.DeInit();
+    }
+    catch (std::exception &e) {
+    }
+    return false;
+  }
+}
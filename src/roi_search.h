@@ -0,0 +1,20 @@
+#ifndef ROI_SEARCH_H
+#define ROI_SEARCH_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include "config.h"
+#include "frame_source.h"
+
+// Bisect the region of interest size for the largest region that sustains
+// test.target_fps within the loss budget. Sizes follow the increments and
+// maxima of the source, holding the configured aspect ratio, width or
+// height. Every step measures test.duration seconds after test.warmup
+// seconds of warm-up. The winning configuration is written to
+// test.roi_output. Returns false when the source failed or no region met the
+// target.
+bool RunRoiSearch(FrameSource & source, std::shared_ptr<cpptoml::table> config, const std::string & serial,
+    const TestConfig & test_config, const std::atomic<bool> & run);
+
+#endif
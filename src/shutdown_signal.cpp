@@ -0,0 +1,65 @@
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "shutdown_signal.h"
+
+using namespace std;
+
+// Only touched by the handler and read by the watcher
+static volatile sig_atomic_t shutdown_requested = 0;
+static int shutdown_fd = -1;
+
+static void RequestShutdown(int signal) {
+  shutdown_requested = 1;
+
+  // write is async-signal-safe, the eventfd counter cannot overflow here
+  uint64_t one = 1;
+  ssize_t written = write(shutdown_fd, &one, sizeof(one));
+  (void)written;
+}
+
+ShutdownSignal::ShutdownSignal(atomic<bool> & run) : run_(run) {
+  shutdown_fd = eventfd(0, EFD_CLOEXEC);
+  if (shutdown_fd < 0)
+    throw runtime_error(string("eventfd failed: ") + strerror(errno));
+
+  // the handler falls back to the default after the first signal
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = RequestShutdown;
+  action.sa_flags = SA_RESETHAND | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+
+  watcher_ = thread(&ShutdownSignal::Watch, this);
+}
+
+ShutdownSignal::~ShutdownSignal() {
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+
+  // wake the watcher without a shutdown request
+  uint64_t one = 1;
+  ssize_t written = write(shutdown_fd, &one, sizeof(one));
+  (void)written;
+  watcher_.join();
+
+  close(shutdown_fd);
+  shutdown_fd = -1;
+}
+
+void ShutdownSignal::Watch() {
+  uint64_t count;
+
+  while (read(shutdown_fd, &count, sizeof(count)) < 0 && errno == EINTR) {
+  }
+
+  if (shutdown_requested)
+    run_ = false;
+}
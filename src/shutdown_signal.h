@@ -0,0 +1,23 @@
+#ifndef SHUTDOWN_SIGNAL_H
+#define SHUTDOWN_SIGNAL_H
+
+#include <atomic>
+#include <thread>
+
+// Turns SIGINT and SIGTERM into run = false. The handler itself only does
+// what is async-signal-safe, setting a sig_atomic_t and writing an eventfd;
+// a watcher thread blocked on the eventfd clears run. A second signal
+// terminates the process, for when a stop does not get through.
+class ShutdownSignal {
+ public:
+  explicit ShutdownSignal(std::atomic<bool> & run);
+  ~ShutdownSignal();
+
+ private:
+  void Watch();
+
+  std::atomic<bool> & run_;
+  std::thread watcher_;
+};
+
+#endif
@@ -0,0 +1,467 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <iomanip>
+#include <sstream>
+#include "spinnaker_source.h"
+#include "report.h"
+
+using namespace Spinnaker;
+using namespace Spinnaker::GenApi;
+using namespace Spinnaker::GenICam;
+using namespace std;
+
+static const size_t MAX_OUTSTANDING_IMAGES = 1024;
+// Float node values closer than this are taken as unchanged
+static const double FLOAT_TOLERANCE = 0.5;
+
+// Value of an integer node, 0 when the node is not available
+static uint64_t ReadInteger(INodeMap & node_map, const char * name) {
+  CIntegerPtr ptr_counter = node_map.GetNode(name);
+
+  if (!IsAvailable(ptr_counter) || !IsReadable(ptr_counter))
+    return 0;
+
+  return uint64_t(ptr_counter->GetValue());
+}
+
+// Number of stream buffers the SDK allocates with the current settings
+static uint64_t BufferCount(INodeMap & stream_node_map) {
+  CIntegerPtr ptr_buffer_count_result = stream_node_map.GetNode("StreamBufferCountResult");
+  if (IsAvailable(ptr_buffer_count_result) && IsReadable(ptr_buffer_count_result))
+    return uint64_t(ptr_buffer_count_result->GetValue());
+
+  CEnumerationPtr ptr_buffer_count_mode = stream_node_map.GetNode("StreamBufferCountMode");
+  if (string(ptr_buffer_count_mode->GetCurrentEntry()->GetSymbolic().c_str()) == "Manual")
+    return ReadInteger(stream_node_map, "StreamBufferCountManual");
+
+  return ReadInteger(stream_node_map, "StreamDefaultBufferCount");
+}
+
+SpinnakerSource::SpinnakerSource(CameraPtr camera, const CameraConfig & config)
+  : camera_(camera), config_(config), images_(MAX_OUTSTANDING_IMAGES), next_image_(0),
+    exposure_time_ns_(0), timer_(nullptr), unchanged_(0), apply_time_(0) {
+}
+
+void SpinnakerSource::Init() {
+  // Initialize camera
+  camera_->Init();
+  Lap("Init");
+
+  Configure(config_);
+}
+
+void SpinnakerSource::Configure(const CameraConfig & config) {
+  config_ = config;
+
+  if (!config_.user_set_mode.empty() && config_.user_set_mode != "save" && config_.user_set_mode != "load")
+    throw runtime_error("Unknown user_set_mode " + config_.user_set_mode + ", use \"save\" or \"load\"");
+  if (!config_.user_set_mode.empty() && config_.user_set.empty())
+    throw runtime_error("user_set_mode needs a user_set");
+
+  chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+  written_.clear();
+  unchanged_ = 0;
+
+  // Retrieve GenICam node_map
+  INodeMap & node_map = camera_->GetNodeMap();
+
+  // A user set holds every device setting, loading it replaces applying them
+  if (config_.user_set_mode == "load") {
+    SelectUserSet(node_map);
+    CCommandPtr ptr_user_set_load = node_map.GetNode("UserSetLoad");
+    ptr_user_set_load->Execute();
+    Lap("UserSetLoad");
+  }
+  else {
+    // Only nodes that differ from the camera are written, in an order each
+    // write is allowed in: the ADC and pixel format before the region whose
+    // increments they set, auto exposure off before the exposure time
+    SetEnum(node_map, "AcquisitionMode", config_.acquisition_mode);
+    SetEnum(node_map, "AdcBitDepth", config_.adc_bit_depth);
+    SetEnum(node_map, "PixelFormat", config_.pixel_format);
+    SetAxis(node_map, "OffsetX", "Width", "WidthMax", config_.offset_x, config_.width);
+    SetAxis(node_map, "OffsetY", "Height", "HeightMax", config_.offset_y, config_.height);
+    SetEnum(node_map, "BalanceWhiteAuto", config_.auto_white_balance);
+    SetEnum(node_map, "GainAuto", config_.auto_gain);
+    SetEnum(node_map, "ExposureAuto", config_.auto_exposure);
+    SetFloat(node_map, "ExposureTime", config_.exposure_time); // value in microseconds
+
+    // Cap the link bandwidth, cameras sharing a controller get a fixed part each
+    if (config_.throughput_limit > 0) {
+      CEnumerationPtr ptr_limit_mode = node_map.GetNode("DeviceLinkThroughputLimitMode");
+      if (IsAvailable(ptr_limit_mode) && IsWritable(ptr_limit_mode))
+        SetEnum(node_map, "DeviceLinkThroughputLimitMode", "On");
+
+      // round down onto the node's increment within its range
+      CIntegerPtr ptr_limit = node_map.GetNode("DeviceLinkThroughputLimit");
+      int64_t limit = max(ptr_limit->GetMin(), min(ptr_limit->GetMax(), int64_t(config_.throughput_limit)));
+      limit -= (limit - ptr_limit->GetMin()) % max(int64_t(1), ptr_limit->GetInc());
+      SetInteger(node_map, "DeviceLinkThroughputLimit", limit);
+    }
+
+    // the camera starts up with these settings from now on
+    if (config_.user_set_mode == "save") {
+      SelectUserSet(node_map);
+      CCommandPtr ptr_user_set_save = node_map.GetNode("UserSetSave");
+      ptr_user_set_save->Execute();
+
+      CEnumerationPtr ptr_user_set_default = node_map.GetNode("UserSetDefault");
+      if (!IsAvailable(ptr_user_set_default))
+        ptr_user_set_default = node_map.GetNode("UserSetDefaultSelector");
+      CEnumEntryPtr ptr_user_set_default_node = ptr_user_set_default->GetEntryByName(config_.user_set.c_str());
+      ptr_user_set_default->SetIntValue(ptr_user_set_default_node->GetValue());
+      Lap("UserSetSave");
+    }
+  }
+
+  // Stream settings live on the host, no user set keeps them
+  INodeMap & stream_node_map = camera_->GetTLStreamNodeMap();
+
+  // Buffer count is only used in manual buffer count mode
+  if (!config_.buffer_count_mode.empty())
+    SetEnum(stream_node_map, "StreamBufferCountMode", config_.buffer_count_mode);
+  if (config_.buffer_count > 0)
+    SetInteger(stream_node_map, "StreamBufferCountManual", config_.buffer_count);
+  if (!config_.buffer_handling_mode.empty())
+    SetEnum(stream_node_map, "StreamBufferHandlingMode", config_.buffer_handling_mode);
+
+  apply_time_ = chrono::steady_clock::now() - begin;
+}
+
+void SpinnakerSource::SelectUserSet(INodeMap & node_map) {
+  CEnumerationPtr ptr_user_set_selector = node_map.GetNode("UserSetSelector");
+  CEnumEntryPtr ptr_user_set_selector_node = ptr_user_set_selector->GetEntryByName(config_.user_set.c_str());
+
+  if (!IsAvailable(ptr_user_set_selector_node))
+    throw runtime_error("Camera has no user set " + config_.user_set);
+
+  ptr_user_set_selector->SetIntValue(ptr_user_set_selector_node->GetValue());
+}
+
+void SpinnakerSource::SetEnum(INodeMap & node_map, const char * name, const string & value) {
+  CEnumerationPtr ptr_node = node_map.GetNode(name);
+  CEnumEntryPtr ptr_entry = ptr_node->GetEntryByName(value.c_str());
+
+  if (!IsAvailable(ptr_entry))
+    throw runtime_error(string(name) + " has no entry " + value);
+
+  if (ptr_node->GetIntValue() == ptr_entry->GetValue()) {
+    unchanged_++;
+    return;
+  }
+
+  ptr_node->SetIntValue(ptr_entry->GetValue());
+  written_.push_back(name);
+  Lap(name);
+}
+
+void SpinnakerSource::SetInteger(INodeMap & node_map, const char * name, int64_t value) {
+  CIntegerPtr ptr_node = node_map.GetNode(name);
+
+  if (ptr_node->GetValue() == value) {
+    unchanged_++;
+    return;
+  }
+
+  ptr_node->SetValue(value);
+  written_.push_back(name);
+  Lap(name);
+}
+
+void SpinnakerSource::SetFloat(INodeMap & node_map, const char * name, double value) {
+  CFloatPtr ptr_node = node_map.GetNode(name);
+
+  // the camera rounds onto its own steps, a close value is the same setting
+  if (fabs(ptr_node->GetValue() - value) < FLOAT_TOLERANCE) {
+    unchanged_++;
+    return;
+  }
+
+  ptr_node->SetValue(value);
+  written_.push_back(name);
+  Lap(name);
+}
+
+void SpinnakerSource::SetAxis(INodeMap & node_map, const char * offset_name, const char * size_name,
+    const char * max_name, int64_t offset, int64_t size) {
+  CIntegerPtr ptr_offset = node_map.GetNode(offset_name);
+  CIntegerPtr ptr_size = node_map.GetNode(size_name);
+
+  // offset plus size never exceeds the sensor, so the offset goes first when
+  // it fits the current size and the size goes first otherwise
+  int64_t sensor = int64_t(ReadInteger(node_map, max_name));
+  if (sensor == 0)
+    sensor = ptr_size->GetMax() + ptr_offset->GetValue();
+
+  if (offset + ptr_size->GetValue() <= sensor) {
+    SetInteger(node_map, offset_name, offset);
+    SetInteger(node_map, size_name, size);
+  }
+  else {
+    SetInteger(node_map, size_name, size);
+    SetInteger(node_map, offset_name, offset);
+  }
+}
+
+void SpinnakerSource::DeInit() {
+  camera_->DeInit();
+}
+
+void SpinnakerSource::PrintInfo(ostream & out) {
+  INodeMap & node_map = camera_->GetNodeMap();
+
+  CIntegerPtr ptr_width = node_map.GetNode("Width");
+  CIntegerPtr ptr_height = node_map.GetNode("Height");
+  CIntegerPtr ptr_offset_x = node_map.GetNode("OffsetX");
+  CIntegerPtr ptr_offset_y = node_map.GetNode("OffsetY");
+  CFloatPtr   ptr_exposure_time = node_map.GetNode("ExposureTime");
+
+  CEnumerationPtr ptr_pixel_format = node_map.GetNode("PixelFormat");
+  CEnumerationPtr ptr_acquisition_mode = node_map.GetNode("AcquisitionMode");
+  CEnumerationPtr ptr_auto_exposure = node_map.GetNode("ExposureAuto");
+  CEnumerationPtr ptr_auto_white_balance = node_map.GetNode("BalanceWhiteAuto");
+  CEnumerationPtr ptr_auto_gain = node_map.GetNode("GainAuto");
+  CEnumerationPtr ptr_adc_bit_depth = node_map.GetNode("AdcBitDepth");
+
+  // Get camera device information.
+  out << "Camera device information" << endl
+    << "=========================" << endl;
+  out << Label("Model") << CStringPtr( node_map.GetNode( "DeviceModelName") )->GetValue() << endl;
+  out << Label("Firmware version") << CStringPtr( node_map.GetNode( "DeviceFirmwareVersion") )->GetValue() << endl;
+  out << Label("Serial number") << CStringPtr( node_map.GetNode( "DeviceSerialNumber") )->GetValue() << endl;
+  out << Label("Max resolution") << ptr_width->GetMax() << " x " << ptr_height->GetMax() << endl;
+  out << Label("Min exposure time") << ptr_exposure_time->GetMin() << endl;
+  out << endl;
+
+  // Camera settings
+  out << "Camera device settings" << endl << "======================" << endl;
+  out << Label("Acquisition mode") << ptr_acquisition_mode->GetCurrentEntry()->GetSymbolic() << endl;
+  out << Label("Pixel format") << ptr_pixel_format->GetCurrentEntry()->GetSymbolic() << endl;
+  out << Label("ADC bit depth") << ptr_adc_bit_depth->GetCurrentEntry()->GetSymbolic() << endl;
+  out << Label("Auto white balance") << ptr_auto_white_balance->GetCurrentEntry()->GetSymbolic() << endl;
+  out << Label("Auto gain") << ptr_auto_gain->GetCurrentEntry()->GetSymbolic() << endl;
+  out << Label("Auto exposure") << ptr_auto_exposure->GetCurrentEntry()->GetSymbolic() << endl;
+  out << Label("Exposure time") << ptr_exposure_time->GetValue() << endl;
+  out << Label("Width") << ptr_width->GetValue() << endl;
+  out << Label("Height") << ptr_height->GetValue() << endl;
+  out << Label("Offset X") << ptr_offset_x->GetValue() << endl;
+  out << Label("Offset Y") << ptr_offset_y->GetValue() << endl;
+  out << Label("Configuration") << ConfigurationLine() << endl;
+  out << endl;
+
+  INodeMap & stream_node_map = camera_->GetTLStreamNodeMap();
+  CEnumerationPtr ptr_buffer_count_mode = stream_node_map.GetNode("StreamBufferCountMode");
+  CEnumerationPtr ptr_buffer_handling_mode = stream_node_map.GetNode("StreamBufferHandlingMode");
+
+  // Stream settings
+  out << "Stream settings" << endl << "===============" << endl;
+  out << Label("Buffer count mode") << ptr_buffer_count_mode->GetCurrentEntry()->GetSymbolic() << endl;
+  out << Label("Buffer count") << BufferCount(stream_node_map) << endl;
+  out << Label("Buffer handling") << ptr_buffer_handling_mode->GetCurrentEntry()->GetSymbolic() << endl;
+  out << endl;
+}
+
+string SpinnakerSource::ConfigurationLine() const {
+  ostringstream line;
+
+  if (config_.user_set_mode == "load")
+    line << "loaded " << config_.user_set << ", ";
+  line << written_.size() << " of " << written_.size() + unchanged_ << " nodes written in " << fixed
+    << setprecision(1) << chrono::duration<double, milli>(apply_time_).count() << " ms";
+
+  for (size_t i = 0; i < written_.size(); i++)
+    line << (i ? ", " : " (") << written_[i] << (i + 1 == written_.size() ? ")" : "");
+  if (config_.user_set_mode == "save")
+    line << ", saved to " << config_.user_set << " as default";
+
+  return line.str();
+}
+
+void SpinnakerSource::BeginAcquisition() {
+  CFloatPtr ptr_exposure_time = camera_->GetNodeMap().GetNode("ExposureTime");
+  exposure_time_ns_ = uint64_t(ptr_exposure_time->GetValue() * 1000);
+
+  camera_->BeginAcquisition();
+}
+
+void SpinnakerSource::EndAcquisition() {
+  camera_->EndAcquisition();
+}
+
+void SpinnakerSource::GetNextFrame(Frame & frame) {
+  uint64_t slot = next_image_++ % MAX_OUTSTANDING_IMAGES;
+
+  images_[slot] = camera_->GetNextImage();
+  FillFrame(frame, slot);
+}
+
+bool SpinnakerSource::TryGetNextFrame(Frame & frame, chrono::milliseconds timeout) {
+  uint64_t slot = next_image_ % MAX_OUTSTANDING_IMAGES;
+
+  try {
+    images_[slot] = camera_->GetNextImage(uint64_t(max(int64_t(0), int64_t(timeout.count()))));
+  }
+  catch (Spinnaker::Exception &e) {
+    if (e.GetError() == SPINNAKER_ERR_TIMEOUT)
+      return false;
+    throw;
+  }
+
+  next_image_++;
+  FillFrame(frame, slot);
+  return true;
+}
+
+void SpinnakerSource::FillFrame(Frame & frame, uint64_t slot) {
+  ImagePtr & image = images_[slot];
+
+  frame.data = static_cast<const uint8_t *>(image->GetData());
+  frame.size = image->GetImageSize();
+  frame.width = static_cast<int>(image->GetWidth());
+  frame.height = static_cast<int>(image->GetHeight());
+  frame.frame_id = image->GetFrameID();
+  frame.timestamp = image->GetTimeStamp() ? image->GetTimeStamp() + exposure_time_ns_ : 0;
+  frame.incomplete = image->IsIncomplete();
+  frame.status = static_cast<int>(image->GetImageStatus());
+  frame.handle = slot;
+}
+
+void SpinnakerSource::ReleaseFrame(Frame & frame) {
+  ImagePtr & image = images_[frame.handle];
+
+  image->Release();
+  image = ImagePtr();
+}
+
+bool SpinnakerSource::SetSoftwareTrigger(bool enabled) {
+  INodeMap & node_map = camera_->GetNodeMap();
+
+  CEnumerationPtr ptr_trigger_mode = node_map.GetNode("TriggerMode");
+  CEnumerationPtr ptr_trigger_selector = node_map.GetNode("TriggerSelector");
+  CEnumerationPtr ptr_trigger_source = node_map.GetNode("TriggerSource");
+
+  if (!IsAvailable(ptr_trigger_mode) || !IsWritable(ptr_trigger_mode))
+    return false;
+
+  // the trigger source can only be changed with the trigger mode off
+  ptr_trigger_mode->SetIntValue(ptr_trigger_mode->GetEntryByName("Off")->GetValue());
+  if (!enabled)
+    return true;
+
+  if (!IsAvailable(ptr_trigger_source) || !IsWritable(ptr_trigger_source))
+    return false;
+
+  if (IsAvailable(ptr_trigger_selector) && IsWritable(ptr_trigger_selector))
+    ptr_trigger_selector->SetIntValue(ptr_trigger_selector->GetEntryByName("FrameStart")->GetValue());
+  ptr_trigger_source->SetIntValue(ptr_trigger_source->GetEntryByName("Software")->GetValue());
+  ptr_trigger_mode->SetIntValue(ptr_trigger_mode->GetEntryByName("On")->GetValue());
+
+  return true;
+}
+
+bool SpinnakerSource::SetTestPattern(const string & pattern) {
+  INodeMap & node_map = camera_->GetNodeMap();
+
+  CEnumerationPtr ptr_generator_selector = node_map.GetNode("TestPatternGeneratorSelector");
+  CEnumerationPtr ptr_test_pattern = node_map.GetNode("TestPattern");
+
+  if (!IsAvailable(ptr_test_pattern) || !IsWritable(ptr_test_pattern))
+    return false;
+
+  // the pattern generated by the sensor covers the whole readout path
+  if (IsAvailable(ptr_generator_selector) && IsWritable(ptr_generator_selector))
+    ptr_generator_selector->SetIntValue(ptr_generator_selector->GetEntryByName("Sensor")->GetValue());
+
+  CEnumEntryPtr ptr_test_pattern_node = ptr_test_pattern->GetEntryByName(pattern.c_str());
+  if (!IsAvailable(ptr_test_pattern_node))
+    return false;
+
+  ptr_test_pattern->SetIntValue(ptr_test_pattern_node->GetValue());
+  return true;
+}
+
+void SpinnakerSource::FireSoftwareTrigger() {
+  CCommandPtr ptr_trigger = camera_->GetNodeMap().GetNode("TriggerSoftware");
+
+  ptr_trigger->Execute();
+}
+
+bool SpinnakerSource::SampleClock(ClockSample & sample) {
+  INodeMap & node_map = camera_->GetNodeMap();
+
+  CCommandPtr ptr_latch = node_map.GetNode("TimestampLatch");
+  CIntegerPtr ptr_latch_value = node_map.GetNode("TimestampLatchValue");
+
+  if (!IsAvailable(ptr_latch) || !IsWritable(ptr_latch) || !IsAvailable(ptr_latch_value) || !IsReadable(ptr_latch_value))
+    return false;
+
+  chrono::steady_clock::time_point before = chrono::steady_clock::now();
+  ptr_latch->Execute();
+  chrono::steady_clock::time_point after = chrono::steady_clock::now();
+
+  sample.device = uint64_t(ptr_latch_value->GetValue());
+  sample.host = before + (after - before) / 2;
+  sample.round_trip = after - before;
+
+  return true;
+}
+
+bool SpinnakerSource::ReadStreamCounters(StreamCounters & counters) {
+  INodeMap & node_map = camera_->GetTLStreamNodeMap();
+
+  counters.lost_frames = ReadInteger(node_map, "StreamLostFrameCount");
+  counters.dropped_frames = ReadInteger(node_map, "StreamDroppedFrameCount");
+  counters.failed_buffers = ReadInteger(node_map, "StreamFailedBufferCount");
+  counters.buffer_underruns = ReadInteger(node_map, "StreamBufferUnderrunCount");
+
+  return true;
+}
+
+bool SpinnakerSource::ReadLinkStatus(LinkStatus & status) {
+  INodeMap & node_map = camera_->GetNodeMap();
+
+  status.speed = double(ReadInteger(node_map, "DeviceLinkSpeed"));
+  status.throughput_limit = double(ReadInteger(node_map, "DeviceLinkThroughputLimit"));
+  status.current_throughput = double(ReadInteger(node_map, "DeviceLinkCurrentThroughput"));
+
+  return true;
+}
+
+uint64_t SpinnakerSource::BufferMemory() {
+  return BufferCount(camera_->GetTLStreamNodeMap()) * PayloadSize();
+}
+
+uint64_t SpinnakerSource::PayloadSize() {
+  return ReadInteger(camera_->GetNodeMap(), "PayloadSize");
+}
+
+bool SpinnakerSource::ReadRoiLimits(RoiLimits & limits) {
+  INodeMap & node_map = camera_->GetNodeMap();
+
+  CIntegerPtr ptr_width = node_map.GetNode("Width");
+  CIntegerPtr ptr_height = node_map.GetNode("Height");
+  CIntegerPtr ptr_offset_x = node_map.GetNode("OffsetX");
+  CIntegerPtr ptr_offset_y = node_map.GetNode("OffsetY");
+
+  if (!IsWritable(ptr_width) || !IsWritable(ptr_height))
+    return false;
+
+  // Width and Height maxima shrink with the offsets, WidthMax and HeightMax
+  // do not
+  limits.width_min = int(ptr_width->GetMin());
+  limits.width_max = int(ReadInteger(node_map, "WidthMax"));
+  limits.width_inc = int(ptr_width->GetInc());
+  limits.height_min = int(ptr_height->GetMin());
+  limits.height_max = int(ReadInteger(node_map, "HeightMax"));
+  limits.height_inc = int(ptr_height->GetInc());
+  limits.offset_x_inc = int(ptr_offset_x->GetInc());
+  limits.offset_y_inc = int(ptr_offset_y->GetInc());
+
+  if (limits.width_max == 0)
+    limits.width_max = int(ptr_width->GetMax() + ptr_offset_x->GetValue());
+  if (limits.height_max == 0)
+    limits.height_max = int(ptr_height->GetMax() + ptr_offset_y->GetValue());
+
+  return true;
+}
@@ -0,0 +1,74 @@
+#ifndef SPINNAKER_SOURCE_H
+#define SPINNAKER_SOURCE_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "Spinnaker.h"
+#include "config.h"
+#include "frame_source.h"
+
+// Frames acquired from a FLIR camera through the Spinnaker SDK
+class SpinnakerSource : public FrameSource {
+ public:
+  SpinnakerSource(Spinnaker::CameraPtr camera, const CameraConfig & config);
+
+  void Init() override;
+  void DeInit() override;
+  void Configure(const CameraConfig & config) override;
+  void PrintInfo(std::ostream & out) override;
+  void BeginAcquisition() override;
+  void EndAcquisition() override;
+  void GetNextFrame(Frame & frame) override;
+  void ReleaseFrame(Frame & frame) override;
+  bool TryGetNextFrame(Frame & frame, std::chrono::milliseconds timeout) override;
+  bool SetSoftwareTrigger(bool enabled) override;
+  bool SetTestPattern(const std::string & pattern) override;
+  void FireSoftwareTrigger() override;
+  bool SampleClock(ClockSample & sample) override;
+  bool ReadStreamCounters(StreamCounters & counters) override;
+  bool ReadLinkStatus(LinkStatus & status) override;
+  uint64_t BufferMemory() override;
+  uint64_t PayloadSize() override;
+  bool ReadRoiLimits(RoiLimits & limits) override;
+  void SetPhaseTimer(PhaseTimer * timer) override { timer_ = timer; }
+
+ private:
+  Spinnaker::CameraPtr camera_;
+  CameraConfig config_;
+
+  // Images handed out but not yet released. Slots are reused round robin, the
+  // table is much larger than any stream buffer count so a slot is always
+  // released before it comes around again.
+  std::vector<Spinnaker::ImagePtr> images_;
+  uint64_t next_image_;
+
+  // Fill frame from the image just taken into the next slot
+  void FillFrame(Frame & frame, uint64_t slot);
+
+  // Write a node only when its value differs, counting the writes
+  void SetEnum(Spinnaker::GenApi::INodeMap & node_map, const char * name, const std::string & value);
+  void SetInteger(Spinnaker::GenApi::INodeMap & node_map, const char * name, int64_t value);
+  void SetFloat(Spinnaker::GenApi::INodeMap & node_map, const char * name, double value);
+  // Offset and size of one axis in the order the ranges allow
+  void SetAxis(Spinnaker::GenApi::INodeMap & node_map, const char * offset_name, const char * size_name,
+      const char * max_name, int64_t offset, int64_t size);
+  void SelectUserSet(Spinnaker::GenApi::INodeMap & node_map);
+  // How the last Configure went
+  std::string ConfigurationLine() const;
+
+  // End a startup phase when profiling
+  void Lap(const char * phase) { if (timer_) timer_->Lap(phase); }
+
+  // Image timestamps mark the start of exposure
+  uint64_t exposure_time_ns_;
+
+  PhaseTimer * timer_;
+
+  // nodes the last Configure wrote, left alone and the time it took
+  std::vector<std::string> written_;
+  int unchanged_;
+  std::chrono::steady_clock::duration apply_time_;
+};
+
+#endif
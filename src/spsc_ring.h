@@ -0,0 +1,94 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// Capacity is rounded up to a power of two. The write and read positions
+// sit on cache lines of their own, each side keeps a private copy of the
+// other side's position and only reloads it when the ring looks full or
+// empty, so the two threads rarely touch the same line.
+template <class T>
+class SpscRing {
+ public:
+  explicit SpscRing(size_t capacity)
+    : head_(0), cached_tail_(0), high_water_mark_(0), tail_(0), cached_head_(0) {
+    size_t size = 1;
+    while (size < capacity)
+      size <<= 1;
+
+    slots_.resize(size);
+    mask_ = size - 1;
+  }
+
+  // Producer side, returns false when the ring is full
+  bool TryPush(const T & item) {
+    size_t head = head_.load(std::memory_order_relaxed);
+
+    if (head - cached_tail_ > mask_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head - cached_tail_ > mask_)
+        return false;
+    }
+
+    slots_[head & mask_] = item;
+    head_.store(head + 1, std::memory_order_release);
+
+    // the cached read position may be stale, the high-water mark needs the
+    // current one
+    size_t occupancy = head + 1 - tail_.load(std::memory_order_relaxed);
+    if (occupancy > high_water_mark_.load(std::memory_order_relaxed))
+      high_water_mark_.store(occupancy, std::memory_order_relaxed);
+
+    return true;
+  }
+
+  // Consumer side, returns false when the ring is empty
+  bool TryPop(T & item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+
+    if (tail == cached_head_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail == cached_head_)
+        return false;
+    }
+
+    item = slots_[tail & mask_];
+    tail_.store(tail + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  // Items waiting, exact only when called from one of the two threads
+  // while the other one is idle
+  size_t Size() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+
+  size_t Capacity() const { return mask_ + 1; }
+
+  // Most items ever waiting at once, seen by the producer after a push
+  size_t HighWaterMark() const { return high_water_mark_.load(std::memory_order_relaxed); }
+
+ private:
+  static const size_t CACHE_LINE = 64;
+
+  std::vector<T> slots_;
+  size_t mask_;
+  char pad_slots_[CACHE_LINE];
+
+  // written by the producer
+  std::atomic<size_t> head_;
+  size_t cached_tail_;
+  std::atomic<size_t> high_water_mark_;
+  char pad_head_[CACHE_LINE];
+
+  // written by the consumer
+  std::atomic<size_t> tail_;
+  size_t cached_head_;
+  char pad_tail_[CACHE_LINE];
+};
+
+#endif
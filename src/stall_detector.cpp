@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include "report.h"
+#include "stall_detector.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Stalls listed in the summary, the log file has all of them
+static const size_t PRINTED_STALLS = 20;
+
+static const char * TypeName(StallType type) {
+  switch (type) {
+    case StallType::Timeout: return "timeout";
+    case StallType::IncompleteBurst: return "incomplete burst";
+    case StallType::StreamRestart: return "stream restart";
+  }
+  return "";
+}
+
+StallDetector::StallDetector(milliseconds grab_timeout, int incomplete_burst, milliseconds restart_after,
+    const string & log_path)
+  : grab_timeout_(grab_timeout), incomplete_burst_(uint64_t(max(1, incomplete_burst))),
+    restart_after_(restart_after), has_frame_id_(false), last_frame_id_(0), timed_out_(false), restarts_(0),
+    restarted_(false), burst_(0) {
+  log_.Open(log_path);
+}
+
+void StallDetector::Begin() {
+  begin_ = last_arrival_ = steady_clock::now();
+  has_frame_id_ = false;
+  timed_out_ = false;
+  restarts_ = 0;
+  burst_ = 0;
+
+  lock_guard<mutex> lock(mutex_);
+  end_ = begin_;
+}
+
+bool StallDetector::Grab(FrameSource & source, Frame & frame, steady_clock::time_point & arrival) {
+  bool grabbed = true;
+
+  if (grab_timeout_.count() > 0)
+    grabbed = source.TryGetNextFrame(frame, grab_timeout_);
+  else
+    source.GetNextFrame(frame);
+
+  steady_clock::time_point now = steady_clock::now();
+  {
+    lock_guard<mutex> lock(mutex_);
+    end_ = now;
+  }
+
+  if (!grabbed) {
+    if (!timed_out_) {
+      timed_out_ = true;
+      restarts_ = 0;
+    }
+
+    // restart once the stall lasted restart_after, then every restart_after
+    steady_clock::time_point since = restarts_ ? last_restart_ : last_arrival_;
+    if (restart_after_.count() > 0 && now - since >= restart_after_) {
+      source.EndAcquisition();
+      source.BeginAcquisition();
+
+      last_restart_ = steady_clock::now();
+      if (!restarts_)
+        first_restart_ = last_restart_;
+      restarts_++;
+      restarted_ = true;
+    }
+
+    return false;
+  }
+
+  arrival = now;
+
+  if (timed_out_) {
+    Log(StallType::Timeout, last_arrival_, now, 0, restarts_,
+      restarts_ ? duration<double>(now - first_restart_).count() : 0);
+    timed_out_ = false;
+  }
+  else if (has_frame_id_ && frame.frame_id < last_frame_id_ && !restarted_) {
+    Log(StallType::StreamRestart, last_arrival_, now, 0, 0, 0);
+  }
+
+  // a burst lasts from the last complete frame to the next one
+  if (frame.incomplete) {
+    if (!burst_)
+      burst_start_ = last_arrival_;
+    burst_++;
+  }
+  else {
+    if (burst_ >= incomplete_burst_)
+      Log(StallType::IncompleteBurst, burst_start_, now, burst_, 0, 0);
+    burst_ = 0;
+  }
+
+  has_frame_id_ = true;
+  last_frame_id_ = frame.frame_id;
+  last_arrival_ = now;
+  restarted_ = false;
+
+  return true;
+}
+
+void StallDetector::End() {
+  steady_clock::time_point now = steady_clock::now();
+
+  if (timed_out_)
+    Log(StallType::Timeout, last_arrival_, now, 0, restarts_, -1);
+  else if (burst_ >= incomplete_burst_)
+    Log(StallType::IncompleteBurst, burst_start_, now, burst_, 0, 0);
+
+  timed_out_ = false;
+  burst_ = 0;
+
+  lock_guard<mutex> lock(mutex_);
+  end_ = now;
+}
+
+void StallDetector::Log(StallType type, steady_clock::time_point start, steady_clock::time_point end,
+    uint64_t frames, int restarts, double recovery) {
+  Stall stall;
+  stall.type = type;
+  stall.start = duration<double>(start - begin_).count();
+  stall.duration = duration<double>(end - start).count();
+  stall.frames = frames;
+  stall.restarts = restarts;
+  stall.recovery = recovery;
+
+  lock_guard<mutex> lock(mutex_);
+  stalls_.push_back(stall);
+
+  log_.WriteRow({
+    TextField("type", TypeName(type)),
+    NumberField("start_s", stall.start),
+    NumberField("duration_ms", stall.duration * 1000),
+    NumberField("incomplete_frames", double(frames)),
+    NumberField("restarts", restarts),
+    NumberField("recovery_ms", recovery < 0 ? -1 : recovery * 1000)
+  });
+}
+
+size_t StallDetector::Count() const {
+  lock_guard<mutex> lock(mutex_);
+  return stalls_.size();
+}
+
+vector<Stall> StallDetector::Stalls(size_t first) const {
+  lock_guard<mutex> lock(mutex_);
+  return vector<Stall>(stalls_.begin() + min(first, stalls_.size()), stalls_.end());
+}
+
+string StallLine(const Stall & stall) {
+  ostringstream line;
+
+  line << fixed << setprecision(1) << TypeName(stall.type) << " at " << stall.start << "s for "
+    << stall.duration * 1000 << "ms";
+  if (stall.frames)
+    line << ", " << stall.frames << " incomplete frames";
+  if (stall.restarts)
+    line << ", " << stall.restarts << (stall.restarts == 1 ? " restart" : " restarts");
+  if (stall.recovery > 0)
+    line << ", recovered in " << stall.recovery * 1000 << "ms";
+  else if (stall.recovery < 0)
+    line << ", not recovered";
+
+  return line.str();
+}
+
+void StallDetector::PrintSummary(ostream & out) const {
+  vector<Stall> stalls = Stalls();
+  double seconds;
+  {
+    lock_guard<mutex> lock(mutex_);
+    seconds = duration<double>(end_ - begin_).count();
+  }
+
+  ostringstream summary;
+  summary << fixed << setprecision(1);
+  summary << Label("Stalls") << stalls.size();
+  if (seconds > 0)
+    summary << ", " << stalls.size() * 3600 / seconds << " per hour";
+  summary << endl;
+
+  if (stalls.empty()) {
+    out << summary.str();
+    return;
+  }
+
+  for (StallType type : {StallType::Timeout, StallType::IncompleteBurst, StallType::StreamRestart}) {
+    size_t count = size_t(count_if(stalls.begin(), stalls.end(), [type](const Stall & stall) { return stall.type == type; }));
+    if (count)
+      summary << Label(string("  ") + TypeName(type)) << count << endl;
+  }
+
+  double total = 0, longest = 0, recovery_total = 0, recovery_longest = 0;
+  size_t recovered = 0, unrecovered = 0;
+  for (const Stall & stall : stalls) {
+    total += stall.duration;
+    longest = max(longest, stall.duration);
+    if (stall.recovery > 0) {
+      recovered++;
+      recovery_total += stall.recovery;
+      recovery_longest = max(recovery_longest, stall.recovery);
+    }
+    else if (stall.recovery < 0 && stall.restarts) {
+      unrecovered++;
+    }
+  }
+
+  summary << Label("Stall mean") << total / stalls.size() * 1000 << "ms" << endl;
+  summary << Label("Stall max") << longest * 1000 << "ms" << endl;
+  summary << Label("Stalled time") << (seconds > 0 ? total / seconds * 100 : 0) << "%" << endl;
+  if (recovered || unrecovered) {
+    summary << Label("Recovered") << recovered << " of " << recovered + unrecovered << " restarted" << endl;
+    if (recovered) {
+      summary << Label("Recovery mean") << recovery_total / recovered * 1000 << "ms" << endl;
+      summary << Label("Recovery max") << recovery_longest * 1000 << "ms" << endl;
+    }
+  }
+
+  for (size_t i = 0; i < stalls.size() && i < PRINTED_STALLS; i++)
+    summary << Label(i ? "" : "Stall log") << StallLine(stalls[i]) << endl;
+  if (stalls.size() > PRINTED_STALLS)
+    summary << Label("") << stalls.size() - PRINTED_STALLS << " more" << endl;
+
+  out << summary.str();
+}
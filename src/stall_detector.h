@@ -0,0 +1,89 @@
+#ifndef STALL_DETECTOR_H
+#define STALL_DETECTOR_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "frame_source.h"
+#include "result_writer.h"
+
+enum class StallType {
+  Timeout,         // no frame within the grab timeout
+  IncompleteBurst, // several incomplete frames in a row
+  StreamRestart    // frame IDs started over without us restarting
+};
+
+// An interruption of the stream, times in seconds
+struct Stall {
+  StallType type;
+  double start;    // since acquisition began, at the last good frame
+  double duration; // until the next complete frame
+  uint64_t frames; // incomplete frames of a burst
+  int restarts;    // acquisition restarts it took
+  double recovery; // from the first restart to the next frame, -1 when none came at all
+};
+
+// One line describing a stall
+std::string StallLine(const Stall & stall);
+
+// Acquires frames with a timeout and logs every stall of the stream. A
+// stall without frames longer than restart_after restarts acquisition, and
+// again each restart_after until frames come back. Every stall is written
+// to the log file as soon as it is over.
+class StallDetector {
+ public:
+  // A grab timeout of 0 blocks, a restart_after of 0 never restarts
+  StallDetector(std::chrono::milliseconds grab_timeout, int incomplete_burst,
+      std::chrono::milliseconds restart_after, const std::string & log_path);
+
+  // Call when acquisition begins
+  void Begin();
+
+  // Get the next frame and the time it arrived. Returns false when none
+  // arrived within the grab timeout. Called on the acquiring thread only.
+  bool Grab(FrameSource & source, Frame & frame, std::chrono::steady_clock::time_point & arrival);
+
+  // Close a stall still going on when acquisition ends
+  void End();
+
+  // Whether no frame came since the last grab timed out. Acquiring thread
+  // only.
+  bool TimedOut() const { return timed_out_; }
+
+  // Safe from any thread
+  size_t Count() const;
+  std::vector<Stall> Stalls(size_t first = 0) const;
+
+  void PrintSummary(std::ostream & out) const;
+
+ private:
+  void Log(StallType type, std::chrono::steady_clock::time_point start,
+      std::chrono::steady_clock::time_point end, uint64_t frames, int restarts, double recovery);
+
+  std::chrono::milliseconds grab_timeout_;
+  uint64_t incomplete_burst_;
+  std::chrono::milliseconds restart_after_;
+
+  // acquiring thread only
+  std::chrono::steady_clock::time_point begin_;
+  std::chrono::steady_clock::time_point last_arrival_;
+  bool has_frame_id_;
+  uint64_t last_frame_id_;
+  bool timed_out_;
+  std::chrono::steady_clock::time_point first_restart_;
+  std::chrono::steady_clock::time_point last_restart_;
+  int restarts_;
+  bool restarted_; // frame IDs may start over after our own restart
+  uint64_t burst_;
+  std::chrono::steady_clock::time_point burst_start_;
+
+  mutable std::mutex mutex_;
+  std::vector<Stall> stalls_;
+  std::chrono::steady_clock::time_point end_;
+  ResultWriter log_;
+};
+
+#endif
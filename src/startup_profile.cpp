@@ -0,0 +1,234 @@
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+#include "Spinnaker.h"
+#include "startup_profile.h"
+#include "frame_source.h"
+#include "phase_timer.h"
+#include "replay_source.h"
+#include "report.h"
+#include "result_writer.h"
+#include "spinnaker_source.h"
+#include "synthetic_source.h"
+
+using namespace Spinnaker;
+using namespace std;
+using namespace std::chrono;
+
+// Wait for the first frame when no grab timeout is configured
+static const milliseconds FIRST_FRAME_TIMEOUT(10000);
+
+// Seconds since the process was started, from /proc/self/stat, -1 when unknown
+static double ProcessAge() {
+  ifstream stat("/proc/self/stat");
+  string line;
+  if (!getline(stat, line))
+    return -1;
+
+  // the command name may contain spaces, the fields after it do not
+  size_t end = line.rfind(')');
+  if (end == string::npos)
+    return -1;
+
+  // starttime is field 22, the 20th after the command name
+  istringstream fields(line.substr(end + 2));
+  string field;
+  for (int i = 0; i < 20 && fields >> field; i++) {
+  }
+
+  timespec now;
+  if (!fields || clock_gettime(CLOCK_BOOTTIME, &now) != 0)
+    return -1;
+
+  double start = stod(field) / sysconf(_SC_CLK_TCK);
+  return now.tv_sec + now.tv_nsec / 1e9 - start;
+}
+
+// Init, BeginAcquisition and first frame of a source created for this run.
+// The source is stopped and deinitialized again on errors as well, so that
+// the camera is not left streaming when the system is released.
+static void StartSource(FrameSource & source, PhaseTimer & timer, const TestConfig & test_config) {
+  bool initialized = false, acquiring = false;
+
+  source.SetPhaseTimer(&timer);
+
+  try {
+    // sources that do not profile Init are timed as a whole
+    size_t laps = timer.Laps().size();
+    source.Init();
+    initialized = true;
+    if (timer.Laps().size() == laps)
+      timer.Lap("Init");
+
+    source.BeginAcquisition();
+    acquiring = true;
+    timer.Lap("BeginAcquisition");
+
+    Frame frame;
+    milliseconds timeout = test_config.grab_timeout > 0 ? milliseconds(int64_t(test_config.grab_timeout))
+      : FIRST_FRAME_TIMEOUT;
+    if (!source.TryGetNextFrame(frame, timeout))
+      throw runtime_error("No frame within " + to_string(timeout.count()) + " ms of BeginAcquisition");
+    timer.Lap("First frame");
+
+    source.ReleaseFrame(frame);
+    acquiring = false;
+    source.EndAcquisition();
+    source.SetPhaseTimer(nullptr);
+    initialized = false;
+    source.DeInit();
+  }
+  catch (...) {
+    // the first error is the one reported
+    source.SetPhaseTimer(nullptr);
+    try {
+      if (acquiring)
+        source.EndAcquisition();
+      if (initialized)
+        source.DeInit();
+    }
+    catch (std::exception &e) {
+    }
+    throw;
+  }
+}
+
+// One cold start of the configured camera, the laps end up in timer
+static void ProfileRun(shared_ptr<cpptoml::table> config, const TestConfig & test_config, PhaseTimer & timer) {
+  CameraConfig camera_config = LoadCameraConfig(config);
+  vector<string> serials = LoadCameraSerials(config);
+  string serial = serials.empty() ? "" : serials.front();
+
+  timer.Start();
+
+  if (camera_config.source == "synthetic" || camera_config.source == "replay") {
+    unique_ptr<FrameSource> source;
+    if (camera_config.source == "replay")
+      source.reset(new ReplaySource(LoadCameraConfig(config, serial)));
+    else
+      source.reset(new SyntheticSource(LoadCameraConfig(config, serial)));
+    timer.Lap("Create source");
+
+    StartSource(*source, timer, test_config);
+    return;
+  }
+
+  SystemPtr system = System::GetInstance();
+  timer.Lap("System::GetInstance");
+
+  CameraList cameras = system->GetCameras();
+  timer.Lap("GetCameras");
+
+  try {
+    CameraPtr camera = serial.empty() ? (cameras.GetSize() ? cameras.GetByIndex(0) : CameraPtr())
+      : cameras.GetBySerial(serial);
+    if (!camera.IsValid())
+      throw runtime_error(serial.empty() ? "No camera connected" : "Camera " + serial + " is not connected");
+
+    SpinnakerSource source(camera, LoadCameraConfig(config, serial));
+    StartSource(source, timer, test_config);
+  }
+  catch (...) {
+    cameras.Clear();
+    system->ReleaseInstance();
+    throw;
+  }
+
+  // Release cameras and clear camera list before releasing system
+  cameras.Clear();
+  system->ReleaseInstance();
+}
+
+bool RunStartupProfile(shared_ptr<cpptoml::table> config, const TestConfig & test_config, const atomic<bool> & run) {
+  // phases in the order they first ended, with their durations per run
+  vector<string> phases;
+  map<string, vector<double>> durations;
+  vector<double> totals;
+  ResultWriter writer;
+  PhaseTimer timer;
+
+  double process_age = ProcessAge();
+
+  try {
+    writer.Open(test_config.output);
+
+    cout << "Startup profile" << endl
+      << "===============" << endl;
+
+    for (int i = 0; i < max(1, test_config.startup_runs) && run; i++) {
+      ProfileRun(config, test_config, timer);
+
+      vector<ResultField> row = { NumberField("run", i + 1) };
+      pair<string, int64_t> slowest("", 0);
+
+      for (const pair<string, int64_t> & lap : timer.Laps()) {
+        if (!durations.count(lap.first))
+          phases.push_back(lap.first);
+        durations[lap.first].push_back(lap.second / 1e6);
+        row.push_back(NumberField(lap.first + " ms", lap.second / 1e6));
+        if (lap.second > slowest.second)
+          slowest = lap;
+      }
+
+      totals.push_back(timer.Total() / 1e6);
+      row.push_back(NumberField("total ms", timer.Total() / 1e6));
+      writer.WriteRow(row);
+
+      ostringstream line;
+      line << fixed << setprecision(1) << "Run " << i + 1 << "  total " << timer.Total() / 1e6
+        << "ms  slowest " << slowest.first << " " << slowest.second / 1e6 << "ms" << endl;
+      cout << line.str();
+    }
+  }
+  catch (std::exception &e) {
+    cout << "Error: " << e.what() << endl;
+    return false;
+  }
+
+  if (totals.empty())
+    return true;
+
+  double total_mean = 0;
+  for (double total : totals)
+    total_mean += total;
+  total_mean /= totals.size();
+
+  ostringstream table;
+  table << endl << fixed << setprecision(1);
+  string title = "Startup phases over " + to_string(totals.size()) + " runs";
+  table << title << endl << string(title.size(), '=') << endl;
+  if (process_age >= 0)
+    table << Label("Process start") << process_age * 1000 << "ms before the first run" << endl << endl;
+
+  table << left << setw(28) << "Phase" << right << setw(12) << "mean ms" << setw(12) << "min ms"
+    << setw(12) << "max ms" << setw(12) << "share" << endl;
+
+  // a phase missing from some runs counts as 0 there
+  for (const string & phase : phases) {
+    const vector<double> & values = durations[phase];
+    double sum = 0;
+    for (double value : values)
+      sum += value;
+    double mean = sum / totals.size();
+
+    table << left << setw(28) << phase << right
+      << setw(12) << mean
+      << setw(12) << *min_element(values.begin(), values.end())
+      << setw(12) << *max_element(values.begin(), values.end())
+      << setw(11) << (total_mean > 0 ? mean / total_mean * 100 : 0) << "%" << endl;
+  }
+
+  table << left << setw(28) << "Total" << right
+    << setw(12) << total_mean
+    << setw(12) << *min_element(totals.begin(), totals.end())
+    << setw(12) << *max_element(totals.begin(), totals.end()) << endl;
+
+  cout << table.str() << endl;
+  return true;
+}
@@ -0,0 +1,17 @@
+#ifndef STARTUP_PROFILE_H
+#define STARTUP_PROFILE_H
+
+#include <atomic>
+#include <memory>
+#include "config.h"
+
+// Start the camera from nothing test.startup_runs times, as a capture node
+// restarted for every job does, and time each phase up to the first frame:
+// System::GetInstance, GetCameras, Init, every node the configuration
+// writes, BeginAcquisition and the first frame. Everything is released
+// again before the next run. Prints each run and a table of the phases
+// over all runs. Returns false when a run failed.
+bool RunStartupProfile(std::shared_ptr<cpptoml::table> config, const TestConfig & test_config,
+    const std::atomic<bool> & run);
+
+#endif
@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <numeric>
+#include <sstream>
+#include "report.h"
+#include "steady_state.h"
+
+using namespace std;
+
+// Two sided 97.5% quantiles of Student's t distribution by degrees of freedom
+static const double T_QUANTILES[] = {
+  12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+  2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+  2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+static double TQuantile(size_t degrees) {
+  if (degrees <= sizeof(T_QUANTILES) / sizeof(T_QUANTILES[0]))
+    return T_QUANTILES[degrees - 1];
+
+  // close enough past the table, approaching the normal quantile
+  return 1.96 + 2.5 / degrees;
+}
+
+static double Mean(const vector<double> & values) {
+  return values.empty() ? 0 : accumulate(values.begin(), values.end(), 0.0) / values.size();
+}
+
+SteadyState::SteadyState(int windows, double tolerance, double confidence_tolerance,
+    double max_duration, uint64_t max_frames)
+  : windows_(size_t(max(2, windows))), tolerance_(tolerance), confidence_tolerance_(confidence_tolerance),
+    max_duration_(max_duration), max_frames_(max_frames), steady_(false), elapsed_(0), warmup_(0),
+    frames_(0) {
+}
+
+bool SteadyState::AddWindow(double seconds, uint64_t frames, double fps, double jitter, double p99) {
+  bool became_steady = false;
+  elapsed_ += seconds;
+
+  if (!steady_) {
+    recent_fps_.push_back(fps);
+    recent_jitter_.push_back(jitter);
+    if (recent_fps_.size() > windows_) {
+      recent_fps_.pop_front();
+      recent_jitter_.pop_front();
+    }
+
+    // jitter is small and noisy next to the interval it varies, its change
+    // is measured against the interval rather than against itself
+    double fps_mean = accumulate(recent_fps_.begin(), recent_fps_.end(), 0.0) / recent_fps_.size();
+    if (recent_fps_.size() == windows_ && fps_mean > 0
+        && fabs(Change(recent_fps_)) <= tolerance_ * fps_mean
+        && fabs(Change(recent_jitter_)) <= tolerance_ * 1e9 / fps_mean) {
+      steady_ = became_steady = true;
+      warmup_ = elapsed_;
+    }
+  }
+  else {
+    frames_ += frames;
+    fps_.push_back(fps);
+    p99_.push_back(p99);
+
+    // as many windows as warm-up looked at before trusting the spread
+    if (fps_.size() >= windows_ && FpsConfidence() <= confidence_tolerance_
+        && P99Confidence() <= confidence_tolerance_)
+      reason_ = "confidence reached";
+    else if (max_frames_ > 0 && frames_ >= max_frames_)
+      reason_ = "frame limit reached";
+  }
+
+  if (reason_.empty() && max_duration_ > 0 && elapsed_ >= max_duration_)
+    reason_ = steady_ ? "duration limit reached" : "duration limit reached before steady state";
+
+  return became_steady;
+}
+
+// Median of values [begin, end), a single slow window does not move it
+static double Median(deque<double>::const_iterator begin, deque<double>::const_iterator end) {
+  vector<double> values(begin, end);
+  sort(values.begin(), values.end());
+
+  size_t middle = values.size() / 2;
+  return values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+}
+
+double SteadyState::Change(const deque<double> & values) {
+  size_t half = values.size() / 2;
+  return Median(values.end() - half, values.end()) - Median(values.begin(), values.begin() + half);
+}
+
+double SteadyState::Confidence(const vector<double> & values) const {
+  if (values.size() < 2)
+    return INFINITY;
+
+  double mean = Mean(values);
+  double squares = 0;
+  for (double value : values)
+    squares += (value - mean) * (value - mean);
+
+  double half_width = TQuantile(values.size() - 1) * sqrt(squares / (values.size() - 1) / values.size());
+  return mean > 0 ? half_width / mean : INFINITY;
+}
+
+string SteadyState::WindowLine() const {
+  ostringstream line;
+
+  if (!steady_)
+    line << "  warming up";
+  else if (fps_.size() >= 2)
+    line << fixed << setprecision(2) << "  ci fps " << FpsConfidence() * 100
+      << "% p99 " << P99Confidence() * 100 << "%";
+
+  return line.str();
+}
+
+void SteadyState::PrintSummary(ostream & out) const {
+  ostringstream summary;
+
+  summary << fixed << setprecision(1);
+  if (steady_)
+    summary << Label("Steady state") << "after " << warmup_ << "s" << endl;
+  else
+    summary << Label("Steady state") << "not reached in " << elapsed_ << "s" << endl;
+  summary << Label("Stopped") << (reason_.empty() ? "interrupted" : reason_) << endl;
+
+  if (fps_.size() >= 2) {
+    summary << setprecision(2);
+    summary << Label("Mean fps 95% CI") << "+-" << FpsConfidence() * 100 << "% over "
+      << fps_.size() << " windows" << endl;
+    summary << Label("p99 interval 95% CI") << "+-" << P99Confidence() * 100 << "%" << endl;
+  }
+
+  out << summary.str();
+}
@@ -0,0 +1,62 @@
+#ifndef STEADY_STATE_H
+#define STEADY_STATE_H
+
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Ends warm-up and measurement of a run from the reporting windows instead
+// of fixed times. Warm-up lasts until fps and interval standard deviation of
+// the last few windows stop moving: the medians of the older and the newer
+// half of them differ by no more than the tolerance. Measuring then goes on
+// until the 95% confidence intervals of mean fps and of p99 interval,
+// estimated from the spread of the window values, are narrower than their
+// own tolerance, or a limit on duration or frames is reached.
+class SteadyState {
+ public:
+  // Limits of 0 are not checked
+  SteadyState(int windows, double tolerance, double confidence_tolerance,
+      double max_duration, uint64_t max_frames);
+
+  // Feed a closed window. Returns true for the window that ended warm-up,
+  // the run totals should start over after it.
+  bool AddWindow(double seconds, uint64_t frames, double fps, double jitter, double p99);
+
+  bool Steady() const { return steady_; }
+  // Whether enough was measured, Reason tells why
+  bool Done() const { return !reason_.empty(); }
+  const std::string & Reason() const { return reason_; }
+
+  // Half width of the 95% confidence intervals relative to the mean
+  double FpsConfidence() const { return Confidence(fps_); }
+  double P99Confidence() const { return Confidence(p99_); }
+
+  // Remainder of the reporting line of the last window
+  std::string WindowLine() const;
+  void PrintSummary(std::ostream & out) const;
+
+ private:
+  // Median of the newer half of values minus median of the older half
+  static double Change(const std::deque<double> & values);
+  double Confidence(const std::vector<double> & values) const;
+
+  size_t windows_;
+  double tolerance_;
+  double confidence_tolerance_;
+  double max_duration_;
+  uint64_t max_frames_;
+
+  bool steady_;
+  double elapsed_;       // seconds since the first window
+  double warmup_;        // seconds until steady state
+  uint64_t frames_;      // frames since steady state
+  std::deque<double> recent_fps_;
+  std::deque<double> recent_jitter_;
+  std::vector<double> fps_; // windows since steady state
+  std::vector<double> p99_;
+  std::string reason_;
+};
+
+#endif
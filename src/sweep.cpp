@@ -0,0 +1,469 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include "sweep.h"
+#include "cpu_usage.h"
+#include "demosaic_stage.h"
+#include "image_processor_stage.h"
+#include "image_stats_stage.h"
+#include "measurement.h"
+#include "report.h"
+#include "result_writer.h"
+#include "stall_detector.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Value of a TOML scalar as plain text
+static string ValueText(shared_ptr<cpptoml::base> value) {
+  if (auto text = value->as<string>())
+    return text->get();
+  if (auto number = value->as<int64_t>())
+    return to_string(number->get());
+  if (auto flag = value->as<bool>())
+    return flag->get() ? "true" : "false";
+  if (auto number = value->as<double>()) {
+    ostringstream text;
+    text << number->get();
+    return text.str();
+  }
+
+  ostringstream text;
+  text << *value;
+  return text.str();
+}
+
+static bool IsNumber(shared_ptr<cpptoml::base> value) {
+  return value->as<int64_t>() || value->as<double>();
+}
+
+bool MeasureSetting(Measurement & measurement, const TestConfig & test_config, const atomic<bool> & run,
+    bool & acquiring) {
+  // neither logged nor restarted, the next setting starts acquisition anew
+  StallDetector stalls(milliseconds(int64_t(test_config.grab_timeout)), test_config.stall_incomplete_burst,
+    milliseconds(0), "");
+  measurement.SetStallDetector(&stalls);
+  measurement.BeginAcquisition();
+  acquiring = true;
+
+  while (run && measurement.Stats().RunSeconds() < test_config.duration && !stalls.TimedOut())
+    measurement.AcquireFrame();
+
+  bool stalled = stalls.TimedOut();
+  acquiring = false;
+  measurement.EndAcquisition();
+  measurement.SetStallDetector(nullptr);
+
+  return !stalled;
+}
+
+vector<SweepAxis> FindSweepAxes(shared_ptr<cpptoml::table> config) {
+  vector<SweepAxis> axes;
+  shared_ptr<cpptoml::table> camera = config->get_table("camera");
+
+  if (!camera)
+    return axes;
+
+  for (const auto & entry : *camera) {
+    // serials select cameras, they are not a setting
+    if (entry.first == "serials" || !entry.second->is_array())
+      continue;
+
+    SweepAxis axis;
+    axis.key = entry.first;
+    axis.values = entry.second->as_array()->get();
+
+    if (!axis.values.empty())
+      axes.push_back(axis);
+  }
+
+  // tables do not keep the order of the file, sort for a stable order
+  sort(axes.begin(), axes.end(), [](const SweepAxis & a, const SweepAxis & b) { return a.key < b.key; });
+
+  return axes;
+}
+
+size_t SweepPoints(const vector<SweepAxis> & axes) {
+  size_t points = 1;
+
+  for (const SweepAxis & axis : axes)
+    points *= axis.values.size();
+
+  return points;
+}
+
+shared_ptr<cpptoml::table> SweepPointConfig(shared_ptr<cpptoml::table> config, const vector<SweepAxis> & axes,
+    size_t point) {
+  shared_ptr<cpptoml::table> point_config = static_pointer_cast<cpptoml::table>(config->clone());
+  shared_ptr<cpptoml::table> camera = point_config->get_table("camera");
+
+  // mixed radix digits of point, last axis changes fastest
+  for (size_t i = axes.size(); i-- > 0;) {
+    camera->insert(axes[i].key, axes[i].values[point % axes[i].values.size()]);
+    point /= axes[i].values.size();
+  }
+
+  return point_config;
+}
+
+shared_ptr<cpptoml::table> BufferSweepConfig(shared_ptr<cpptoml::table> config, const TestConfig & test_config) {
+  shared_ptr<cpptoml::table> sweep_config = static_pointer_cast<cpptoml::table>(config->clone());
+  shared_ptr<cpptoml::table> camera = sweep_config->get_table("camera");
+
+  if (!camera) {
+    camera = cpptoml::make_table();
+    sweep_config->insert("camera", camera);
+  }
+
+  if (!test_config.buffer_counts.empty()) {
+    shared_ptr<cpptoml::array> counts = cpptoml::make_array();
+    for (int count : test_config.buffer_counts)
+      counts->push_back(int64_t(count));
+
+    camera->insert("buffer_count_mode", string("Manual"));
+    camera->insert("buffer_count", counts);
+  }
+
+  if (!test_config.buffer_handling_modes.empty()) {
+    shared_ptr<cpptoml::array> modes = cpptoml::make_array();
+    for (const string & mode : test_config.buffer_handling_modes)
+      modes->push_back(mode);
+
+    camera->insert("buffer_handling_mode", modes);
+  }
+
+  return sweep_config;
+}
+
+static vector<ResultField> MeasurementFields(const Measurement & measurement, uint64_t buffer_memory) {
+  const FrameStats & stats = measurement.Stats();
+  const Histogram & intervals = stats.RunIntervals();
+  const Histogram & latencies = stats.RunLatencies();
+  vector<ResultField> fields;
+
+  fields.push_back(NumberField("frames", double(stats.RunFrames())));
+  fields.push_back(NumberField("seconds", stats.RunSeconds()));
+  fields.push_back(NumberField("fps", stats.RunFps()));
+  fields.push_back(NumberField("bytes_per_second", stats.RunBytesPerSecond()));
+  fields.push_back(NumberField("lost", double(stats.RunLost())));
+  fields.push_back(NumberField("incomplete", double(stats.RunIncomplete())));
+  fields.push_back(NumberField("loss_ratio", stats.RunLossRatio()));
+  fields.push_back(NumberField("interval_p50_us", intervals.Percentile(50) / 1000.0));
+  fields.push_back(NumberField("interval_p90_us", intervals.Percentile(90) / 1000.0));
+  fields.push_back(NumberField("interval_p99_us", intervals.Percentile(99) / 1000.0));
+  fields.push_back(NumberField("interval_p999_us", intervals.Percentile(99.9) / 1000.0));
+  fields.push_back(NumberField("interval_max_us", intervals.Max() / 1000.0));
+  fields.push_back(NumberField("jitter_us", intervals.StdDev() / 1000.0));
+  fields.push_back(NumberField("latency_p50_us", latencies.Percentile(50) / 1000.0));
+  fields.push_back(NumberField("latency_p99_us", latencies.Percentile(99) / 1000.0));
+  fields.push_back(NumberField("latency_max_us", latencies.Max() / 1000.0));
+  fields.push_back(NumberField("buffer_memory_bytes", double(buffer_memory)));
+
+  return fields;
+}
+
+bool RunSweep(FrameSource & source, shared_ptr<cpptoml::table> config, const string & serial,
+    const TestConfig & test_config, const atomic<bool> & run) {
+  vector<SweepAxis> axes = FindSweepAxes(config);
+  size_t points = SweepPoints(axes);
+  ResultWriter writer;
+  bool initialized = false, acquiring = false;
+
+  try {
+    writer.Open(test_config.output);
+
+    source.Init();
+    initialized = true;
+    source.PrintInfo(cout);
+
+    cout << "Sweep over " << points << " settings, " << test_config.warmup << "s warm-up and "
+      << test_config.duration << "s measurement each" << endl
+      << "=====" << endl;
+
+    bool has_passed = false;
+    uint64_t least_memory = 0;
+    string least_setting;
+
+    for (size_t point = 0; point < points && run; point++) {
+      shared_ptr<cpptoml::table> point_config = SweepPointConfig(config, axes, point);
+      vector<ResultField> row;
+      string setting;
+
+      for (const SweepAxis & axis : axes) {
+        shared_ptr<cpptoml::base> value = point_config->get_table("camera")->get(axis.key);
+        string text = ValueText(value);
+
+        row.push_back(IsNumber(value) ? ResultField{ axis.key, text, true } : TextField(axis.key, text));
+        setting += (setting.empty() ? "" : " ") + axis.key + "=" + text;
+      }
+
+      // Apply the next setting without initializing the camera again
+      source.Configure(LoadCameraConfig(point_config, serial));
+
+      Measurement measurement(source, duration_cast<nanoseconds>(duration<double>(test_config.warmup)));
+      bool stalled = !MeasureSetting(measurement, test_config, run, acquiring);
+
+      const FrameStats & stats = measurement.Stats();
+      uint64_t memory = source.BufferMemory();
+      bool within_budget = !stalled && measurement.WithinLossBudget(test_config.loss_budget);
+      string budget = stalled ? "stalled" : within_budget ? "met" : "exceeded";
+
+      vector<ResultField> fields = MeasurementFields(measurement, memory);
+      row.insert(row.end(), fields.begin(), fields.end());
+      row.push_back(TextField("loss_budget", budget));
+      writer.WriteRow(row);
+
+      ostringstream line;
+      line << fixed << setprecision(1) << setting << ": " << stats.RunFps() << "fps  "
+        << stats.RunBytesPerSecond() / 1e6 << "MB/s  p99 " << stats.RunIntervals().Percentile(99) / 1000.0 << "us"
+        << "  latency p99 " << stats.RunLatencies().Percentile(99) / 1000.0 << "us"
+        << setprecision(3) << "  loss " << stats.RunLossRatio() * 100 << "%" << setprecision(1)
+        << "  memory " << memory / 1e6 << "MB"
+        << "  budget " << budget;
+      cout << line.str() << endl;
+
+      if (within_budget && (!has_passed || memory < least_memory)) {
+        has_passed = true;
+        least_memory = memory;
+        least_setting = setting;
+      }
+    }
+
+    ostringstream result;
+    result << fixed << setprecision(1) << endl;
+    if (has_passed)
+      result << Label("Least memory") << least_memory / 1e6 << "MB with " << least_setting << endl;
+    else
+      result << Label("Least memory") << "no setting met the loss budget" << endl;
+    if (!test_config.output.empty())
+      result << Label("Results") << test_config.output << endl;
+    cout << result.str() << endl;
+
+    writer.Close();
+    initialized = false;
+    source.DeInit();
+    return true;
+  }
+  catch (std::exception &e) {
+    cout << "Error: " << e.what() << endl;
+
+    // the first error is the one reported
+    try {
+      if (acquiring)
+        source.EndAcquisition();
+      if (initialized)
+        source.DeInit();
+    }
+    catch (std::exception &e) {
+    }
+    return false;
+  }
+}
+
+// Frame rate processed and whether the loss budget held with a number of
+// workers
+struct WorkerPoint {
+  int threads;
+  double processed_fps;
+  bool within_budget;
+};
+
+// Measure the stage on 1 up to max_threads workers, printing a line and
+// writing a row per worker count
+static vector<WorkerPoint> SweepWorkers(FrameSource & source, ProcessingStage & stage, const string & name,
+    const vector<ResultField> & stage_fields, int max_threads, const TestConfig & test_config, ResultWriter & writer,
+    const atomic<bool> & run, bool & acquiring) {
+  vector<WorkerPoint> points;
+  double single_fps = 0;
+
+  for (int threads = 1; threads <= max_threads && run; threads++) {
+    ProcessingExecutor executor(stage, threads, test_config.processing_stripes, test_config.processing_slots);
+    Measurement measurement(source, duration_cast<nanoseconds>(duration<double>(test_config.warmup)));
+    measurement.SetProcessingExecutor(&executor);
+
+    CoreTimes begin_core_times = ReadCoreTimes();
+    bool stalled = !MeasureSetting(measurement, test_config, run, acquiring);
+
+    vector<double> cores = CoreUtilisation(begin_core_times, ReadCoreTimes());
+    double core_mean = cores.empty() ? 0 : accumulate(cores.begin(), cores.end(), 0.0) / cores.size();
+
+    const FrameStats & stats = measurement.Stats();
+    uint64_t frames = executor.Processed() + executor.Dropped();
+    double drop_ratio = frames ? double(executor.Dropped()) / frames : 0;
+    double processed_fps = stats.RunFps() * (1 - drop_ratio);
+    if (threads == 1)
+      single_fps = processed_fps;
+    double speedup = single_fps > 0 ? processed_fps / single_fps : 0;
+    bool within_budget = !stalled && measurement.WithinLossBudget(test_config.loss_budget);
+    string budget = stalled ? "stalled" : within_budget ? "met" : "exceeded";
+
+    points.push_back(WorkerPoint{ threads, processed_fps, within_budget });
+
+    vector<ResultField> row = stage_fields;
+    row.push_back(NumberField("processing_threads", threads));
+    row.push_back(NumberField("processing_stripes", executor.Stripes()));
+    row.push_back(NumberField("processed_fps", processed_fps));
+    row.push_back(NumberField("processing_drop_ratio", drop_ratio));
+    row.push_back(NumberField("speedup", speedup));
+    row.push_back(NumberField("efficiency", speedup / threads));
+    row.push_back(NumberField("processing_mean_us", stats.RunProcessingTimes().Mean() / 1000.0));
+    row.push_back(NumberField("release_latency_p99_us", executor.Latencies().Percentile(99) / 1000.0));
+    row.push_back(NumberField("reorder_depth_mean", executor.MeanReorderDepth()));
+    row.push_back(NumberField("reorder_depth_max", double(executor.MaxReorderDepth())));
+    row.push_back(NumberField("steals", double(executor.Steals())));
+    row.push_back(NumberField("core_utilisation_mean", core_mean));
+    vector<ResultField> fields = MeasurementFields(measurement, source.BufferMemory());
+    row.insert(row.end(), fields.begin(), fields.end());
+    row.push_back(TextField("loss_budget", budget));
+    writer.WriteRow(row);
+
+    ostringstream line;
+    line << fixed << setprecision(1) << name << (name.empty() ? "" : " ") << threads << " workers: "
+      << processed_fps << "fps  speedup "
+      << setprecision(2) << speedup << "  efficiency " << speedup / threads << setprecision(3)
+      << "  drops " << drop_ratio * 100 << "%" << setprecision(1)
+      << "  processing " << stats.RunProcessingTimes().Mean() / 1000.0 << "us"
+      << "  release p99 " << executor.Latencies().Percentile(99) / 1000.0 << "us"
+      << "  reorder " << executor.MeanReorderDepth() << " peak " << executor.MaxReorderDepth()
+      << "  steals " << executor.Steals()
+      << setprecision(0) << "  cores " << core_mean * 100 << "%"
+      << "  budget " << budget;
+    cout << line.str() << endl;
+  }
+
+  return points;
+}
+
+bool RunProcessingSweep(FrameSource & source, shared_ptr<cpptoml::table> config, const string & serial,
+    const TestConfig & test_config, const atomic<bool> & run) {
+  int max_threads = test_config.processing_threads > 0 ? test_config.processing_threads
+    : int(max(1u, thread::hardware_concurrency()));
+  bool convert = test_config.mode == "convert_sweep";
+  ResultWriter writer;
+  bool initialized = false, acquiring = false;
+
+  try {
+    if (!convert && test_config.demosaic.empty() && test_config.image_stats.empty())
+      throw runtime_error("Processing sweep needs test.demosaic or test.image_stats");
+
+    CameraConfig camera = LoadCameraConfig(config, serial);
+    vector<string> algorithms = test_config.convert_algorithms.empty() ? ColorProcessingAlgorithms()
+      : test_config.convert_algorithms;
+    vector<string> formats = test_config.convert_formats;
+
+    writer.Open(test_config.output);
+
+    source.Init();
+    initialized = true;
+    source.PrintInfo(cout);
+
+    if (convert)
+      cout << "Conversion sweep over " << algorithms.size() << " algorithms and " << formats.size()
+        << " formats on 1 to " << max_threads << " workers, " << test_config.warmup << "s warm-up and "
+        << test_config.duration << "s measurement each" << endl
+        << "================" << endl;
+
+    // one stage per algorithm and destination format, or the demosaic or
+    // image statistics
+    string stage_name = test_config.demosaic.empty() ? "Image stats" : "Demosaic";
+    vector<string> names;
+    vector<vector<WorkerPoint>> results;
+
+    for (size_t i = 0; i < (convert ? algorithms.size() * formats.size() : 1) && run; i++) {
+      unique_ptr<ProcessingStage> stage;
+      vector<ResultField> stage_fields;
+      string name;
+
+      if (convert) {
+        const string & algorithm = algorithms[i / formats.size()];
+        const string & format = formats[i % formats.size()];
+        name = algorithm + " " + format;
+
+        try {
+          stage.reset(new ImageProcessorStage(algorithm, format, camera));
+        }
+        catch (std::exception &e) {
+          cout << name << ": not available, " << e.what() << endl;
+          continue;
+        }
+
+        stage_fields.push_back(TextField("algorithm", algorithm));
+        stage_fields.push_back(TextField("destination_format", format));
+      }
+      else {
+        if (!test_config.demosaic.empty())
+          stage.reset(new DemosaicStage(test_config.demosaic, camera));
+        else
+          stage.reset(new ImageStatsStage(test_config.image_stats, camera));
+        stage->PrintInfo(cout);
+
+        cout << "Processing sweep over 1 to " << max_threads << " workers, " << test_config.warmup
+          << "s warm-up and " << test_config.duration << "s measurement each" << endl
+          << "================" << endl;
+      }
+
+      names.push_back(name);
+      results.push_back(SweepWorkers(source, *stage, name, stage_fields, max_threads, test_config, writer, run,
+        acquiring));
+    }
+
+    // Frame rate by worker count, and the fewest workers within the budget
+    ostringstream table;
+    table << fixed << setprecision(1) << endl
+      << "Processed fps by workers" << endl
+      << "========================" << endl;
+
+    table << Label("Workers");
+    for (int threads = 1; threads <= max_threads; threads++)
+      table << setw(9) << threads;
+    table << endl;
+
+    string best;
+    for (size_t i = 0; i < results.size(); i++) {
+      int fewest = 0;
+
+      table << Label(names[i].empty() ? stage_name : names[i]);
+      for (const WorkerPoint & point : results[i]) {
+        table << setw(9) << point.processed_fps;
+        if (!fewest && point.within_budget)
+          fewest = point.threads;
+      }
+      if (fewest)
+        table << "  sustained with " << fewest;
+      table << endl;
+
+      // algorithms are listed from lowest to highest quality
+      if (fewest && convert)
+        best = names[i] + " with " + to_string(fewest) + " workers";
+    }
+
+    if (convert)
+      table << endl << Label("Best sustained") << (best.empty() ? "none within the loss budget" : best) << endl;
+    if (!test_config.output.empty())
+      table << endl << Label("Results") << test_config.output << endl;
+    cout << table.str() << endl;
+
+    writer.Close();
+    initialized = false;
+    source.DeInit();
+    return true;
+  }
+  catch (std::exception &e) {
+    cout << "Error: " << e.what() << endl;
+
+    // the first error is the one reported
+    try {
+      if (acquiring)
+        source.EndAcquisition();
+      if (initialized)
+        source.DeInit();
+    }
+    catch (std::exception &e) {
+    }
+    return false;
+  }
+}
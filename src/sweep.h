@@ -0,0 +1,58 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "frame_source.h"
+#include "measurement.h"
+
+// A [camera] key given as an array of values to sweep over
+struct SweepAxis {
+  std::string key;
+  std::vector<std::shared_ptr<cpptoml::base>> values;
+};
+
+std::vector<SweepAxis> FindSweepAxes(std::shared_ptr<cpptoml::table> config);
+
+// Number of combinations, the cartesian product of all axes
+size_t SweepPoints(const std::vector<SweepAxis> & axes);
+
+// Copy of config with every axis replaced by its value in the given
+// combination. Axes are sorted by key, the first one changes slowest.
+std::shared_ptr<cpptoml::table> SweepPointConfig(std::shared_ptr<cpptoml::table> config,
+    const std::vector<SweepAxis> & axes, size_t point);
+
+// Copy of config with test.buffer_counts and test.buffer_handling_modes
+// turned into [camera] arrays, so that the buffer sweep runs as a sweep
+std::shared_ptr<cpptoml::table> BufferSweepConfig(std::shared_ptr<cpptoml::table> config,
+    const TestConfig & test_config);
+
+// Acquire test.warmup seconds of warm-up and test.duration seconds of
+// measurement, waiting at most test.grab_timeout for each frame. A setting
+// that stalls is given up at the first timeout. acquiring is set while the
+// source acquires, for the error path of the caller. Returns false when it
+// stalled.
+bool MeasureSetting(Measurement & measurement, const TestConfig & test_config, const std::atomic<bool> & run,
+    bool & acquiring);
+
+// Measure every combination back to back on a single Init of the source,
+// with test.warmup seconds of warm-up and test.duration seconds of
+// measurement each. Results are printed and written to test.output. Returns
+// false when the source failed.
+bool RunSweep(FrameSource & source, std::shared_ptr<cpptoml::table> config, const std::string & serial,
+    const TestConfig & test_config, const std::atomic<bool> & run);
+
+// Measure the processing stage on 1 up to test.processing_threads workers,
+// or up to every core when that is 0, with test.warmup seconds of warm-up
+// and test.duration seconds of measurement each. The stage is the demosaic,
+// or with mode "convert_sweep" the SDK conversion with every combination of
+// test.convert_algorithms and test.convert_formats. Results are printed as
+// a table of frame rates and written to test.output. Returns false when the
+// source failed.
+bool RunProcessingSweep(FrameSource & source, std::shared_ptr<cpptoml::table> config, const std::string & serial,
+    const TestConfig & test_config, const std::atomic<bool> & run);
+
+#endif
@@ -0,0 +1,417 @@
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+#include "synthetic_source.h"
+#include "pixel_format.h"
+#include "report.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Spinnaker default for USB3 cameras
+static const size_t DEFAULT_BUFFER_COUNT = 10;
+
+SyntheticSource::SyntheticSource(const CameraConfig & config)
+  : config_(config), frame_size_(0), buffer_count_(0), newest_only_(false), next_buffer_(0),
+    next_frame_id_(0), frame_interval_(0), stalled_(false), software_trigger_(false), acquiring_(false),
+    random_(random_device()()),
+    lost_frames_(0), dropped_frames_(0), buffer_underruns_(0) {
+}
+
+void SyntheticSource::Init() {
+  Configure(config_);
+
+  lost_frames_ = 0;
+  dropped_frames_ = 0;
+  buffer_underruns_ = 0;
+  device_clock_origin_ = steady_clock::now();
+}
+
+void SyntheticSource::Configure(const CameraConfig & config) {
+  config_ = config;
+
+  int bits_per_pixel = BitsPerPixel(config_.pixel_format);
+
+  if (bits_per_pixel == 0)
+    throw runtime_error("Unsupported pixel format " + config_.pixel_format);
+  if (config_.width <= 0 || config_.height <= 0)
+    throw runtime_error("Synthetic source needs positive width and height");
+  if (config_.offset_x < 0 || config_.offset_y < 0 || config_.offset_x + config_.width > config_.sensor_width
+      || config_.offset_y + config_.height > config_.sensor_height)
+    throw runtime_error("Region of interest does not fit the synthetic sensor");
+  if (config_.fps < 0 || config_.jitter < 0)
+    throw runtime_error("Synthetic source needs fps >= 0 and jitter >= 0");
+  if (config_.stall_every < 0 || config_.stall_length < 0)
+    throw runtime_error("Synthetic source needs stall_every >= 0 and stall_length >= 0");
+  if (config_.drop_rate < 0 || config_.drop_rate >= 1 || config_.incomplete_rate < 0 || config_.incomplete_rate > 1)
+    throw runtime_error("Synthetic source needs 0 <= drop_rate < 1 and 0 <= incomplete_rate <= 1");
+  if (config_.corrupt_rate < 0 || config_.corrupt_rate > 1)
+    throw runtime_error("Synthetic source needs 0 <= corrupt_rate <= 1");
+
+  const string & handling_mode = config_.buffer_handling_mode;
+  if (!handling_mode.empty() && handling_mode != "OldestFirst" && handling_mode != "OldestFirstOverwrite"
+      && handling_mode != "NewestFirst" && handling_mode != "NewestOnly")
+    throw runtime_error("Unknown buffer handling mode " + handling_mode);
+
+  // Which frames overflow differs between the queueing modes, the number of
+  // dropped frames does not, so only NewestOnly is told apart
+  newest_only_ = handling_mode == "NewestOnly";
+  buffer_count_ = config_.buffer_count_mode == "Manual" && config_.buffer_count > 0
+    ? size_t(config_.buffer_count) : DEFAULT_BUFFER_COUNT;
+  frame_size_ = (size_t(config_.width) * config_.height * bits_per_pixel + 7) / 8;
+
+  // Fill every buffer once with a diagonal gradient, acquisition only hands
+  // them out
+  buffers_.assign(buffer_count_, vector<uint8_t>(frame_size_));
+  buffer_in_use_.reset(new atomic<bool>[buffer_count_]);
+  corrupt_offset_.assign(buffer_count_, frame_size_);
+  corrupt_mask_.assign(buffer_count_, 0);
+  next_buffer_ = 0;
+
+  for (size_t i = 0; i < buffer_count_; i++) {
+    for (size_t offset = 0; offset < frame_size_; offset++)
+      buffers_[i][offset] = uint8_t(offset % config_.width + offset / config_.width);
+
+    buffer_in_use_[i] = false;
+  }
+
+  // The link caps the frame rate at the frames per second it can carry
+  double fps = config_.fps;
+  if (config_.throughput_limit > 0) {
+    double link_fps = config_.throughput_limit / frame_size_;
+    fps = fps > 0 ? min(fps, link_fps) : link_fps;
+  }
+
+  frame_interval_ = nanoseconds(0);
+  if (fps > 0)
+    frame_interval_ = duration_cast<nanoseconds>(duration<double>(1.0 / fps));
+
+  jitter_ = normal_distribution<double>(0, config_.jitter * 1000);
+  drop_ = bernoulli_distribution(config_.drop_rate);
+  incomplete_ = bernoulli_distribution(config_.incomplete_rate);
+  corrupt_ = bernoulli_distribution(config_.corrupt_rate);
+}
+
+void SyntheticSource::DeInit() {
+  buffers_.clear();
+  buffer_in_use_.reset();
+}
+
+void SyntheticSource::PrintInfo(ostream & out) {
+  out << "Synthetic source settings" << endl
+    << "=========================" << endl;
+  out << Label("Pixel format") << config_.pixel_format << endl;
+  out << Label("Sensor size") << config_.sensor_width << " x " << config_.sensor_height << endl;
+  out << Label("Width") << config_.width << endl;
+  out << Label("Height") << config_.height << endl;
+  out << Label("Offset X") << config_.offset_x << endl;
+  out << Label("Offset Y") << config_.offset_y << endl;
+  out << Label("Frame size") << frame_size_ << " bytes" << endl;
+  if (frame_interval_.count() > 0)
+    out << Label("Frame rate") << 1e9 / frame_interval_.count() << " fps" << endl;
+  else
+    out << Label("Frame rate") << "unlimited" << endl;
+  if (config_.throughput_limit > 0)
+    out << Label("Throughput limit") << config_.throughput_limit / 1e6 << " MB/s" << endl;
+  out << Label("Jitter") << config_.jitter << " us" << endl;
+  out << Label("Drop rate") << config_.drop_rate << endl;
+  out << Label("Incomplete rate") << config_.incomplete_rate << endl;
+  if (config_.corrupt_rate > 0)
+    out << Label("Corrupt rate") << config_.corrupt_rate << endl;
+  out << Label("Clock drift") << config_.clock_drift << " ppm" << endl;
+  if (config_.stall_every > 0)
+    out << Label("Stalls") << "every " << config_.stall_every << " s for "
+      << (config_.stall_length > 0 ? to_string(int(config_.stall_length)) + " ms" : "good") << endl;
+  out << Label("Trigger") << (software_trigger_ ? "Software" : "Off") << endl;
+  if (software_trigger_) {
+    out << Label("Trigger delay") << config_.trigger_delay << " us" << endl;
+    out << Label("Exposure time") << config_.exposure_time << " us" << endl;
+  }
+  out << Label("Buffer count") << buffer_count_ << endl;
+  out << Label("Buffer handling") << (config_.buffer_handling_mode.empty() ? "OldestFirst" : config_.buffer_handling_mode) << endl;
+  out << endl;
+}
+
+void SyntheticSource::BeginAcquisition() {
+  next_frame_time_ = steady_clock::now();
+  next_stall_ = next_frame_time_ + duration_cast<nanoseconds>(duration<double>(config_.stall_every));
+  stalled_ = false;
+
+  lock_guard<mutex> lock(trigger_mutex_);
+  triggered_exposures_.clear();
+  trigger_ready_ = next_frame_time_;
+  acquiring_ = true;
+}
+
+void SyntheticSource::EndAcquisition() {
+  {
+    lock_guard<mutex> lock(trigger_mutex_);
+    acquiring_ = false;
+  }
+
+  // wake a grab waiting for a trigger or for the end of a stall
+  trigger_signal_.notify_all();
+}
+
+void SyntheticSource::GetNextFrame(Frame & frame) {
+  NextFrame(frame, nullptr);
+}
+
+bool SyntheticSource::TryGetNextFrame(Frame & frame, milliseconds timeout) {
+  steady_clock::time_point deadline = steady_clock::now() + timeout;
+  return NextFrame(frame, &deadline);
+}
+
+bool SyntheticSource::NextFrame(Frame & frame, const steady_clock::time_point * deadline) {
+  size_t buffer;
+  steady_clock::time_point exposure_end;
+
+  // Frames that are dropped still take up their slot on the timeline
+  while (true) {
+    if (software_trigger_) {
+      if (!WaitForTrigger(exposure_end, deadline))
+        return false;
+    }
+    else if (frame_interval_.count() > 0) {
+      if (config_.stall_every > 0 && next_frame_time_ + frame_interval_ >= next_stall_) {
+        if (config_.stall_length > 0) {
+          // the stream picks up again after the stall without losing frames
+          next_frame_time_ = next_stall_ + duration_cast<nanoseconds>(duration<double>(config_.stall_length / 1000));
+          next_stall_ = next_frame_time_ + duration_cast<nanoseconds>(duration<double>(config_.stall_every));
+        }
+        else {
+          stalled_ = true;
+        }
+      }
+
+      // nothing comes until acquisition is restarted
+      if (stalled_) {
+        unique_lock<mutex> lock(trigger_mutex_);
+        auto ended = [this] { return !acquiring_; };
+
+        if (deadline) {
+          trigger_signal_.wait_until(lock, *deadline, ended);
+          return false;
+        }
+
+        trigger_signal_.wait(lock, ended);
+        throw runtime_error("Acquisition ended while waiting for a frame");
+      }
+
+      next_frame_time_ += frame_interval_;
+      DropOverflowedFrames();
+      exposure_end = next_frame_time_;
+
+      // frames are delivered after a random delay of at most one interval
+      nanoseconds delay(0);
+      if (config_.jitter > 0)
+        delay = nanoseconds(int64_t(min(fabs(jitter_(random_)), double(frame_interval_.count()))));
+
+      // the frame stays on the timeline for the next call
+      if (deadline && exposure_end + delay > *deadline) {
+        next_frame_time_ -= frame_interval_;
+        this_thread::sleep_until(*deadline);
+        return false;
+      }
+
+      this_thread::sleep_until(exposure_end + delay);
+    }
+    else {
+      exposure_end = steady_clock::now();
+    }
+
+    uint64_t frame_id = next_frame_id_++;
+
+    if (config_.drop_rate > 0 && drop_(random_)) {
+      lost_frames_++;
+      continue;
+    }
+
+    buffer = next_buffer_;
+    if (buffer_in_use_[buffer].exchange(true)) {
+      buffer_underruns_++;
+      // without a frame rate there is no exposure to wait for, give a
+      // consumer on another thread the chance to return buffers
+      if (frame_interval_.count() == 0)
+        this_thread::yield();
+      continue;
+    }
+
+    next_buffer_ = (next_buffer_ + 1) % buffer_count_;
+
+    frame.frame_id = frame_id;
+    break;
+  }
+
+  // one byte of the payload goes wrong, as on a link dropping bits
+  if (config_.corrupt_rate > 0 && corrupt_(random_)) {
+    size_t offset = size_t(random_() % frame_size_);
+    uint8_t mask = uint8_t(1 + random_() % 255);
+
+    buffers_[buffer][offset] ^= mask;
+    corrupt_offset_[buffer] = offset;
+    corrupt_mask_[buffer] = mask;
+  }
+
+  frame.data = buffers_[buffer].data();
+  frame.size = frame_size_;
+  frame.width = config_.width;
+  frame.height = config_.height;
+  frame.timestamp = DeviceTime(exposure_end);
+  frame.incomplete = config_.incomplete_rate > 0 && incomplete_(random_);
+  frame.status = frame.incomplete ? 1 : 0;
+  frame.handle = buffer;
+
+  return true;
+}
+
+bool SyntheticSource::WaitForTrigger(steady_clock::time_point & exposure_end, const steady_clock::time_point * deadline) {
+  unique_lock<mutex> lock(trigger_mutex_);
+  auto triggered = [this] { return !triggered_exposures_.empty() || !acquiring_; };
+
+  if (!deadline)
+    trigger_signal_.wait(lock, triggered);
+  else if (!trigger_signal_.wait_until(lock, *deadline, triggered))
+    return false;
+
+  if (triggered_exposures_.empty()) {
+    if (deadline)
+      return false;
+    throw runtime_error("Acquisition ended while waiting for a trigger");
+  }
+
+  // read out within one interval, delivered after a random delay of at
+  // most one more
+  exposure_end = triggered_exposures_.front();
+  steady_clock::time_point delivery = exposure_end + frame_interval_;
+  if (config_.jitter > 0)
+    delivery += nanoseconds(int64_t(min(fabs(jitter_(random_)), double(frame_interval_.count()))));
+
+  if (deadline && delivery > *deadline) {
+    lock.unlock();
+    this_thread::sleep_until(*deadline);
+    return false;
+  }
+
+  triggered_exposures_.pop_front();
+  lock.unlock();
+
+  this_thread::sleep_until(delivery);
+  return true;
+}
+
+bool SyntheticSource::SetSoftwareTrigger(bool enabled) {
+  lock_guard<mutex> lock(trigger_mutex_);
+
+  software_trigger_ = enabled;
+  triggered_exposures_.clear();
+
+  return true;
+}
+
+void SyntheticSource::FireSoftwareTrigger() {
+  steady_clock::time_point now = steady_clock::now();
+
+  {
+    lock_guard<mutex> lock(trigger_mutex_);
+
+    // the sensor is still busy with the previous frame
+    if (now < trigger_ready_)
+      return;
+
+    steady_clock::time_point exposure_start = now + nanoseconds(int64_t(config_.trigger_delay * 1000));
+    nanoseconds exposure(int64_t(max(0, config_.exposure_time)) * 1000);
+
+    triggered_exposures_.push_back(exposure_start + exposure);
+    trigger_ready_ = exposure_start + max(exposure, frame_interval_);
+  }
+
+  trigger_signal_.notify_one();
+}
+
+void SyntheticSource::ReleaseFrame(Frame & frame) {
+  // the gradient is restored before the buffer is handed out again
+  size_t & offset = corrupt_offset_[frame.handle];
+  if (offset < frame_size_) {
+    buffers_[frame.handle][offset] ^= corrupt_mask_[frame.handle];
+    offset = frame_size_;
+  }
+
+  buffer_in_use_[frame.handle] = false;
+}
+
+bool SyntheticSource::SetTestPattern(const string & pattern) {
+  // frames are a fixed gradient with or without a pattern
+  return true;
+}
+
+bool SyntheticSource::ReadLinkStatus(LinkStatus & status) {
+  // the link has no speed of its own, only the configured limit
+  status.speed = 0;
+  status.throughput_limit = config_.throughput_limit;
+  status.current_throughput = frame_interval_.count() > 0 ? frame_size_ * 1e9 / frame_interval_.count() : 0;
+
+  return true;
+}
+
+uint64_t SyntheticSource::BufferMemory() {
+  return uint64_t(buffer_count_) * frame_size_;
+}
+
+uint64_t SyntheticSource::PayloadSize() {
+  return frame_size_;
+}
+
+bool SyntheticSource::ReadRoiLimits(RoiLimits & limits) {
+  // increments of a typical Sony Pregius sensor
+  limits.width_min = 8;
+  limits.width_max = config_.sensor_width;
+  limits.width_inc = 4;
+  limits.height_min = 2;
+  limits.height_max = config_.sensor_height;
+  limits.height_inc = 2;
+  limits.offset_x_inc = 4;
+  limits.offset_y_inc = 2;
+
+  return true;
+}
+
+void SyntheticSource::DropOverflowedFrames() {
+  steady_clock::time_point now = steady_clock::now();
+  if (now <= next_frame_time_)
+    return;
+
+  // frames exposed by now but not yet taken by the consumer
+  uint64_t waiting = uint64_t((now - next_frame_time_) / frame_interval_) + 1;
+  uint64_t capacity = newest_only_ ? 1 : buffer_count_;
+
+  if (waiting > capacity) {
+    uint64_t dropped = waiting - capacity;
+
+    next_frame_id_ += dropped;
+    next_frame_time_ += dropped * frame_interval_;
+    dropped_frames_ += dropped;
+  }
+}
+
+bool SyntheticSource::SampleClock(ClockSample & sample) {
+  sample.host = steady_clock::now();
+  sample.device = DeviceTime(sample.host);
+  sample.round_trip = nanoseconds(0);
+
+  return true;
+}
+
+bool SyntheticSource::ReadStreamCounters(StreamCounters & counters) {
+  counters.lost_frames = lost_frames_;
+  counters.dropped_frames = dropped_frames_;
+  counters.failed_buffers = 0;
+  counters.buffer_underruns = buffer_underruns_;
+
+  return true;
+}
+
+uint64_t SyntheticSource::DeviceTime(steady_clock::time_point time) const {
+  double elapsed = double(duration_cast<nanoseconds>(time - device_clock_origin_).count());
+  return uint64_t(max(0.0, elapsed * (1 + config_.clock_drift * 1e-6)));
+}
@@ -0,0 +1,112 @@
+#ifndef SYNTHETIC_SOURCE_H
+#define SYNTHETIC_SOURCE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+#include "config.h"
+#include "frame_source.h"
+
+// Generates frames without camera hardware. Frame rate, delivery jitter,
+// drop and incomplete rates and device clock drift come from the [camera]
+// section so that the measurement loop can be exercised at rates no real
+// camera reaches. In software trigger mode a frame starts trigger_delay
+// after each trigger, is exposed for exposure_time and read out within one
+// frame interval. Triggers arriving before the previous frame is read out
+// are ignored, as a camera ignores overtriggering. Every frame is the same
+// gradient, which serves as the test pattern; corrupt_rate flips bytes of
+// it.
+class SyntheticSource : public FrameSource {
+ public:
+  explicit SyntheticSource(const CameraConfig & config);
+
+  void Init() override;
+  void DeInit() override;
+  void Configure(const CameraConfig & config) override;
+  void PrintInfo(std::ostream & out) override;
+  void BeginAcquisition() override;
+  void EndAcquisition() override;
+  void GetNextFrame(Frame & frame) override;
+  void ReleaseFrame(Frame & frame) override;
+  bool TryGetNextFrame(Frame & frame, std::chrono::milliseconds timeout) override;
+  bool SetSoftwareTrigger(bool enabled) override;
+  bool SetTestPattern(const std::string & pattern) override;
+  void FireSoftwareTrigger() override;
+  bool SampleClock(ClockSample & sample) override;
+  bool ReadStreamCounters(StreamCounters & counters) override;
+  bool ReadLinkStatus(LinkStatus & status) override;
+  uint64_t BufferMemory() override;
+  uint64_t PayloadSize() override;
+  bool ReadRoiLimits(RoiLimits & limits) override;
+
+ private:
+  // Deliver the next frame, giving up at the deadline when there is one
+  bool NextFrame(Frame & frame, const std::chrono::steady_clock::time_point * deadline);
+
+  // Wait for the next triggered frame to be read out
+  bool WaitForTrigger(std::chrono::steady_clock::time_point & exposure_end,
+      const std::chrono::steady_clock::time_point * deadline);
+
+  // Simulated device clock, starts at zero on Init
+  uint64_t DeviceTime(std::chrono::steady_clock::time_point time) const;
+
+  // Drop frames that would have overflowed the stream buffers while the
+  // consumer was falling behind
+  void DropOverflowedFrames();
+
+  CameraConfig config_;
+  size_t frame_size_;
+
+  // Buffers are handed out round robin like a camera stream. A frame whose
+  // buffer is still held by the consumer is dropped, as with a real camera
+  // running out of stream buffers.
+  size_t buffer_count_;
+  bool newest_only_;
+  std::vector<std::vector<uint8_t>> buffers_;
+  std::unique_ptr<std::atomic<bool>[]> buffer_in_use_;
+  size_t next_buffer_;
+
+  uint64_t next_frame_id_;
+  std::chrono::steady_clock::time_point next_frame_time_;
+  std::chrono::nanoseconds frame_interval_;
+  std::chrono::steady_clock::time_point device_clock_origin_;
+
+  // the stream stops at next_stall_, for good until acquisition is
+  // restarted when stall_length is 0
+  std::chrono::steady_clock::time_point next_stall_;
+  bool stalled_;
+
+  // end of exposure of triggered frames not yet delivered, and when the
+  // sensor takes the next trigger. EndAcquisition clears acquiring_ under
+  // the same lock to wake a grab waiting for a trigger or a stall to end.
+  bool software_trigger_;
+  bool acquiring_;
+  std::mutex trigger_mutex_;
+  std::condition_variable trigger_signal_;
+  std::deque<std::chrono::steady_clock::time_point> triggered_exposures_;
+  std::chrono::steady_clock::time_point trigger_ready_;
+
+  std::mt19937_64 random_;
+  std::normal_distribution<double> jitter_;
+  std::bernoulli_distribution drop_;
+  std::bernoulli_distribution incomplete_;
+  std::bernoulli_distribution corrupt_;
+
+  // byte of each buffer flipped by corrupt_rate, restored on release;
+  // frame_size_ for none
+  std::vector<size_t> corrupt_offset_;
+  std::vector<uint8_t> corrupt_mask_;
+
+  // Frames lost to drop_rate, to stream buffer overflow and to buffers held
+  // by the consumer
+  std::atomic<uint64_t> lost_frames_;
+  std::atomic<uint64_t> dropped_frames_;
+  std::atomic<uint64_t> buffer_underruns_;
+};
+
+#endif
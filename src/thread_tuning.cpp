@@ -0,0 +1,106 @@
+#include <cerrno>
+#include <cstring>
+#include <sched.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include "thread_tuning.h"
+
+using namespace std;
+
+// Stack faulted in by LockMemory, enough for the deepest SDK call
+static const size_t PREFAULT_STACK = 512 * 1024;
+
+static int Policy(const string & name) {
+  if (name == "other")
+    return SCHED_OTHER;
+  if (name == "fifo")
+    return SCHED_FIFO;
+  if (name == "rr")
+    return SCHED_RR;
+  throw runtime_error("unknown scheduling policy " + name + ", use \"other\", \"fifo\" or \"rr\"");
+}
+
+static string PolicyName(int policy) {
+  switch (policy) {
+    case SCHED_OTHER: return "SCHED_OTHER";
+    case SCHED_FIFO: return "SCHED_FIFO";
+    case SCHED_RR: return "SCHED_RR";
+    default: return "policy " + to_string(policy);
+  }
+}
+
+static string Cpus(const vector<int> & cpus) {
+  ostringstream list;
+
+  for (size_t i = 0; i < cpus.size(); i++)
+    list << (i ? "," : "") << cpus[i];
+
+  return list.str();
+}
+
+string ApplyThreadTuning(pthread_t thread, const ThreadTuning & tuning) {
+  ostringstream refused;
+
+  if (!tuning.cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : tuning.cpus) {
+      if (cpu < 0 || cpu >= CPU_SETSIZE)
+        throw runtime_error("CPU " + to_string(cpu) + " out of range");
+      CPU_SET(cpu, &set);
+    }
+
+    int error = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (error)
+      refused << "  cpus " << Cpus(tuning.cpus) << " refused: " << strerror(error);
+  }
+
+  if (!tuning.policy.empty()) {
+    int policy = Policy(tuning.policy);
+    sched_param param = sched_param();
+    param.sched_priority = policy == SCHED_OTHER ? 0 : tuning.priority;
+
+    int error = pthread_setschedparam(thread, policy, &param);
+    if (error)
+      refused << "  " << PolicyName(policy) << " " << param.sched_priority << " refused: " << strerror(error);
+  }
+
+  // read back what the thread runs with now
+  ostringstream applied;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (pthread_getaffinity_np(thread, sizeof(set), &set) == 0) {
+    vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      if (CPU_ISSET(cpu, &set))
+        cpus.push_back(cpu);
+    applied << "cpus " << Cpus(cpus) << " ";
+  }
+
+  int policy;
+  sched_param param;
+  if (pthread_getschedparam(thread, &policy, &param) == 0) {
+    applied << PolicyName(policy);
+    if (policy != SCHED_OTHER)
+      applied << " " << param.sched_priority;
+  }
+
+  return applied.str() + refused.str();
+}
+
+// Touch the stack below the caller so its pages are mapped and locked
+static void PrefaultStack() {
+  volatile char stack[PREFAULT_STACK];
+
+  for (size_t i = 0; i < sizeof(stack); i += 4096)
+    stack[i] = 0;
+}
+
+string LockMemory() {
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    return string("unlocked  mlockall refused: ") + strerror(errno);
+
+  PrefaultStack();
+  return "locked, stack prefaulted";
+}
@@ -0,0 +1,26 @@
+#ifndef THREAD_TUNING_H
+#define THREAD_TUNING_H
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+// Where and how a thread is scheduled
+struct ThreadTuning {
+  std::vector<int> cpus; // cores the thread may run on, empty to leave it alone
+  std::string policy;    // "other", "fifo" or "rr", empty to leave it alone
+  int priority;          // 1 to 99 for "fifo" and "rr"
+};
+
+// Pin the thread and set its scheduling policy. Settings the kernel refuses,
+// without CAP_SYS_NICE for instance, are left as they were. Returns what the
+// thread ended up with as read back from the kernel, followed by the
+// settings that were refused and why.
+std::string ApplyThreadTuning(pthread_t thread, const ThreadTuning & tuning);
+
+// Lock every page of the process in memory, the ones mapped later included,
+// and fault in the stack of the calling thread, so that no page fault
+// interrupts acquisition. Returns what was applied in the same way.
+std::string LockMemory();
+
+#endif
@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include "trigger_test.h"
+#include "clock_sync.h"
+#include "histogram.h"
+#include "report.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Latch samples taken before the first trigger
+static const int INITIAL_CLOCK_SAMPLES = 8;
+// Round trips between latch samples, following the clock drift
+static const int CLOCK_SAMPLE_INTERVAL = 100;
+// A rate passes when at least this share of the planned triggers was fired
+static const double RATE_TOLERANCE = 0.99;
+// Halvings of the rate tried when the round trip rate already fails
+static const int MAX_HALVINGS = 8;
+// Bisection stops when the bounds are this close, relative to the lower one
+static const double RATE_RESOLUTION = 0.02;
+// Wait between checks of the firing thread while collecting frames
+static const milliseconds POLL_TIMEOUT(10);
+
+static void PrintPercentiles(ostringstream & out, const string & name, const Histogram & histogram) {
+  out << Label(name + " p50") << Us(histogram.Percentile(50)) << endl;
+  out << Label(name + " p99") << Us(histogram.Percentile(99)) << endl;
+  out << Label(name + " max") << Us(histogram.Max()) << endl;
+}
+
+// Fire one trigger at a time and wait for its frame. A frame that arrives
+// after its trigger timed out is drained before the next trigger instead of
+// being timed as the next round trip. Returns the frames lost to timeouts
+// and incomplete frames, fills in the round trip rate.
+static uint64_t MeasureRoundTrips(FrameSource & source, const TestConfig & test_config, const atomic<bool> & run,
+    double & round_trip_rate) {
+  milliseconds timeout = duration_cast<milliseconds>(duration<double, milli>(test_config.trigger_timeout));
+  Histogram round_trips, commands, to_exposure, readouts;
+  ClockSync clock;
+  ClockSample sample;
+  uint64_t triggers = 0, frames = 0, timeouts = 0, late = 0, incomplete = 0;
+  // timed out triggers whose frame may still arrive
+  uint64_t stale = 0;
+  Frame frame;
+
+  for (int i = 0; i < INITIAL_CLOCK_SAMPLES; i++)
+    if (source.SampleClock(sample))
+      clock.AddSample(sample);
+
+  steady_clock::time_point begin = steady_clock::now();
+
+  for (int i = 0; i < test_config.trigger_count && run; i++) {
+    if (i % CLOCK_SAMPLE_INTERVAL == 0 && source.SampleClock(sample))
+      clock.AddSample(sample);
+
+    while (stale > 0 && source.TryGetNextFrame(frame, milliseconds(0))) {
+      stale--;
+      late++;
+      source.ReleaseFrame(frame);
+    }
+
+    steady_clock::time_point fired = steady_clock::now();
+    source.FireSoftwareTrigger();
+    steady_clock::time_point executed = steady_clock::now();
+    triggers++;
+
+    if (!source.TryGetNextFrame(frame, timeout)) {
+      timeouts++;
+      // give the late frame one more timeout to arrive
+      if (source.TryGetNextFrame(frame, timeout)) {
+        late++;
+        source.ReleaseFrame(frame);
+      }
+      else {
+        stale++;
+      }
+      continue;
+    }
+    steady_clock::time_point arrival = steady_clock::now();
+
+    frames++;
+    if (frame.incomplete)
+      incomplete++;
+
+    round_trips.Record(uint64_t(duration_cast<nanoseconds>(arrival - fired).count()));
+    commands.Record(uint64_t(duration_cast<nanoseconds>(executed - fired).count()));
+
+    // split at the end of exposure where the device clock allows
+    if (frame.timestamp && clock.Ready()) {
+      int64_t exposure_end = clock.ToHost(frame.timestamp);
+      int64_t fired_ns = duration_cast<nanoseconds>(fired.time_since_epoch()).count();
+      int64_t arrival_ns = duration_cast<nanoseconds>(arrival.time_since_epoch()).count();
+
+      to_exposure.Record(uint64_t(max(int64_t(0), exposure_end - fired_ns)));
+      readouts.Record(uint64_t(max(int64_t(0), arrival_ns - exposure_end)));
+    }
+
+    source.ReleaseFrame(frame);
+  }
+
+  double seconds = duration<double>(steady_clock::now() - begin).count();
+  round_trip_rate = seconds > 0 ? frames / seconds : 0;
+
+  ostringstream summary;
+  summary << fixed << setprecision(1);
+  summary << Label("Triggers") << triggers << endl;
+  summary << Label("Frames") << frames << endl;
+  summary << Label("Timeouts") << timeouts << endl;
+  summary << Label("Late frames") << late << endl;
+  summary << Label("Incomplete frames") << incomplete << endl;
+  summary << Label("Round trip mean") << Us(round_trips.Mean()) << endl;
+  summary << Label("Round trip min") << Us(double(round_trips.Min())) << endl;
+  summary << Label("Round trip p50") << Us(round_trips.Percentile(50)) << endl;
+  summary << Label("Round trip p90") << Us(round_trips.Percentile(90)) << endl;
+  summary << Label("Round trip p99") << Us(round_trips.Percentile(99)) << endl;
+  summary << Label("Round trip p99.9") << Us(round_trips.Percentile(99.9)) << endl;
+  summary << Label("Round trip max") << Us(round_trips.Max()) << endl;
+  summary << Label("Round trip jitter") << Us(round_trips.StdDev()) << endl;
+  PrintPercentiles(summary, "Command", commands);
+  if (to_exposure.Count()) {
+    PrintPercentiles(summary, "To exposure end", to_exposure);
+    PrintPercentiles(summary, "Readout", readouts);
+  }
+  summary << Label("Round trip rate") << round_trip_rate << " Hz" << endl;
+  cout << summary.str();
+
+  return timeouts + incomplete;
+}
+
+// Fire triggers at the given rate on a thread of their own while collecting
+// frames, returns whether every trigger gave a complete frame within the
+// loss budget
+static bool MeasureRate(FrameSource & source, const TestConfig & test_config, const atomic<bool> & run,
+    double rate) {
+  milliseconds timeout = duration_cast<milliseconds>(duration<double, milli>(test_config.trigger_timeout));
+  nanoseconds interval = duration_cast<nanoseconds>(duration<double>(1 / rate));
+  uint64_t planned = uint64_t(llround(rate * test_config.trigger_rate_duration));
+  atomic<uint64_t> fired(0);
+  atomic<bool> firing(true);
+  exception_ptr error;
+
+  thread trigger_thread([&] {
+    try {
+      steady_clock::time_point next = steady_clock::now();
+
+      for (uint64_t i = 0; i < planned && run; i++) {
+        this_thread::sleep_until(next);
+        source.FireSoftwareTrigger();
+        fired++;
+
+        // a late trigger moves the schedule instead of being followed by a
+        // burst that would overtrigger the camera
+        next = max(next + interval, steady_clock::now());
+      }
+    }
+    catch (...) {
+      error = current_exception();
+    }
+    firing = false;
+  });
+
+  uint64_t frames = 0, incomplete = 0;
+  Frame frame;
+
+  // keep collecting until no frame follows the last trigger
+  try {
+    while (true) {
+      bool was_firing = firing;
+      if (source.TryGetNextFrame(frame, was_firing ? POLL_TIMEOUT : timeout)) {
+        frames++;
+        if (frame.incomplete)
+          incomplete++;
+        source.ReleaseFrame(frame);
+      }
+      else if (!was_firing) {
+        break;
+      }
+    }
+  }
+  catch (...) {
+    trigger_thread.join();
+    throw;
+  }
+
+  trigger_thread.join();
+  if (error)
+    rethrow_exception(error);
+
+  uint64_t missed = fired > frames ? fired - frames : 0;
+  bool passed = run && fired >= planned * RATE_TOLERANCE
+    && missed + incomplete <= test_config.loss_budget * double(fired);
+
+  ostringstream line;
+  line << fixed << setprecision(1) << rate << " Hz: fired " << fired << "  frames " << frames
+    << "  missed " << missed << "  incomplete " << incomplete << "  " << (passed ? "passed" : "failed");
+  cout << line.str() << endl;
+
+  return passed;
+}
+
+bool RunTriggerTest(FrameSource & source, const TestConfig & test_config, const atomic<bool> & run) {
+  bool initialized = false, triggered = false, acquiring = false;
+
+  try {
+    if (test_config.trigger_count <= 0 || test_config.trigger_timeout <= 0 || test_config.trigger_rate_duration <= 0)
+      throw runtime_error("Trigger test needs positive trigger_count, trigger_timeout and trigger_rate_duration");
+
+    source.Init();
+    initialized = true;
+
+    if (!source.SetSoftwareTrigger(true))
+      throw runtime_error("Source cannot be triggered in software");
+    triggered = true;
+
+    source.PrintInfo(cout);
+    source.BeginAcquisition();
+    acquiring = true;
+
+    cout << "Trigger latency over " << test_config.trigger_count << " round trips" << endl
+      << "===============" << endl;
+
+    double round_trip_rate = 0;
+    uint64_t lost = MeasureRoundTrips(source, test_config, run, round_trip_rate);
+    bool within_budget = lost <= test_config.loss_budget * test_config.trigger_count;
+
+    cout << endl << "Trigger rate search, " << test_config.trigger_rate_duration << "s each" << endl
+      << "===================" << endl;
+
+    // Double the rate from the round trip rate until triggers get lost, or
+    // halve it until they do not, then bisect between the highest rate
+    // passed and the lowest rate failed
+    double passed = 0, failed = 0;
+    double rate = round_trip_rate;
+    if (test_config.trigger_max_rate > 0)
+      rate = min(rate, test_config.trigger_max_rate);
+
+    for (int halvings = 0; run && rate > 0 && halvings <= MAX_HALVINGS;) {
+      if (MeasureRate(source, test_config, run, rate)) {
+        passed = rate;
+        if (failed > 0 || (test_config.trigger_max_rate > 0 && rate >= test_config.trigger_max_rate))
+          break;
+
+        rate *= 2;
+        if (test_config.trigger_max_rate > 0)
+          rate = min(rate, test_config.trigger_max_rate);
+      }
+      else {
+        failed = rate;
+        if (passed > 0)
+          break;
+
+        rate /= 2;
+        halvings++;
+      }
+    }
+
+    while (run && passed > 0 && failed > 0 && failed - passed > passed * RATE_RESOLUTION) {
+      rate = (passed + failed) / 2;
+
+      if (MeasureRate(source, test_config, run, rate))
+        passed = rate;
+      else
+        failed = rate;
+    }
+
+    acquiring = false;
+    source.EndAcquisition();
+    triggered = false;
+    source.SetSoftwareTrigger(false);
+    initialized = false;
+    source.DeInit();
+
+    ostringstream result;
+    result << fixed << setprecision(1) << endl;
+    if (!run)
+      result << Label("Max trigger rate") << "search interrupted" << endl;
+    else if (passed > 0)
+      result << Label("Max trigger rate") << passed << " Hz" << endl;
+    else
+      result << Label("Max trigger rate") << "no rate passed" << endl;
+    PrintLossBudget(result, test_config, within_budget);
+    cout << result.str() << endl;
+
+    return within_budget;
+  }
+  catch (std::exception &e) {
+    cout << "Error: " << e.what() << endl;
+
+    // leave the camera free running and released, the first error is the
+    // one reported
+    try {
+      if (acquiring)
+        source.EndAcquisition();
+      if (triggered)
+        source.SetSoftwareTrigger(false);
+      if (initialized)
+        source.DeInit();
+    }
+    catch (std::exception &e) {
+    }
+    return false;
+  }
+}
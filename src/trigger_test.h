@@ -0,0 +1,17 @@
+#ifndef TRIGGER_TEST_H
+#define TRIGGER_TEST_H
+
+#include <atomic>
+#include "config.h"
+#include "frame_source.h"
+
+// Put the source into software trigger mode and time test.trigger_count
+// round trips from firing TriggerSoftware to the triggered frame returning
+// from GetNextFrame, one trigger at a time. Then fire triggers at a fixed
+// rate for test.trigger_rate_duration seconds each, doubling the rate from
+// the round trip rate and bisecting, for the highest rate at which every
+// trigger yields a frame within the loss budget. Returns false when the
+// source failed or round trips were lost beyond the loss budget.
+bool RunTriggerTest(FrameSource & source, const TestConfig & test_config, const std::atomic<bool> & run);
+
+#endif
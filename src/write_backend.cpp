@@ -0,0 +1,310 @@
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "write_backend.h"
+
+using namespace std;
+
+// Writes on a pool of threads calling pwrite, for kernels without io_uring
+class PwriteBackend : public WriteBackend {
+ public:
+  PwriteBackend(size_t queue_depth, int threads)
+    : requests_(queue_depth), first_request_(0), request_count_(0), queued_(0), stop_(false) {
+    finished_.reserve(queue_depth);
+
+    for (int i = 0; i < max(1, threads); i++)
+      threads_.push_back(thread(&PwriteBackend::Work, this));
+  }
+
+  ~PwriteBackend() override {
+    {
+      lock_guard<mutex> lock(mutex_);
+      stop_ = true;
+    }
+    work_.notify_all();
+
+    for (thread & worker : threads_)
+      worker.join();
+  }
+
+  const char * Name() const override { return "pwrite"; }
+
+  void Submit(int fd, const uint8_t * data, size_t size, uint64_t offset, size_t tag) override {
+    lock_guard<mutex> lock(mutex_);
+
+    if (request_count_ + queued_ == requests_.size())
+      throw runtime_error("Write queue overflow");
+
+    Request & request = requests_[(first_request_ + request_count_ + queued_) % requests_.size()];
+    request.fd = fd;
+    request.data = data;
+    request.size = size;
+    request.offset = offset;
+    request.tag = tag;
+    queued_++;
+  }
+
+  void Flush() override {
+    {
+      lock_guard<mutex> lock(mutex_);
+      request_count_ += queued_;
+      queued_ = 0;
+    }
+    work_.notify_all();
+  }
+
+  void Complete(vector<WriteResult> & done, bool wait) override {
+    unique_lock<mutex> lock(mutex_);
+
+    if (wait)
+      finished_signal_.wait(lock, [this] { return !finished_.empty(); });
+
+    done.insert(done.end(), finished_.begin(), finished_.end());
+    finished_.clear();
+  }
+
+ private:
+  struct Request {
+    int fd;
+    const uint8_t * data;
+    size_t size;
+    uint64_t offset;
+    size_t tag;
+  };
+
+  void Work() {
+    unique_lock<mutex> lock(mutex_);
+
+    while (true) {
+      work_.wait(lock, [this] { return stop_ || request_count_ > 0; });
+      if (request_count_ == 0)
+        return;
+
+      Request request = requests_[first_request_];
+      first_request_ = (first_request_ + 1) % requests_.size();
+      request_count_--;
+      lock.unlock();
+
+      WriteResult result = { request.tag, 0 };
+      while (size_t(result.result) < request.size) {
+        ssize_t written = pwrite(request.fd, request.data + result.result, request.size - result.result,
+          request.offset + result.result);
+        if (written < 0 && errno == EINTR)
+          continue;
+        if (written <= 0) {
+          result.result = written < 0 ? -errno : -EIO;
+          break;
+        }
+        result.result += written;
+      }
+
+      lock.lock();
+      finished_.push_back(result);
+      finished_signal_.notify_one();
+    }
+  }
+
+  // requests waiting for a thread, followed by the ones not flushed yet
+  vector<Request> requests_;
+  size_t first_request_;
+  size_t request_count_;
+  size_t queued_;
+  vector<WriteResult> finished_;
+  bool stop_;
+
+  mutex mutex_;
+  condition_variable work_;
+  condition_variable finished_signal_;
+  vector<thread> threads_;
+};
+
+static int IoUringSetup(unsigned entries, io_uring_params & params) {
+  return int(syscall(__NR_io_uring_setup, entries, &params));
+}
+
+static int IoUringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return int(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+// Whether the ring takes IORING_OP_WRITE. Kernels before 5.6 know neither
+// the opcode nor the probe, and would fail every write.
+static bool IoUringSupportsWrite(int fd) {
+  const unsigned ops = 256;
+  vector<uint8_t> buffer(sizeof(io_uring_probe) + ops * sizeof(io_uring_probe_op), 0);
+  io_uring_probe * probe = reinterpret_cast<io_uring_probe *>(buffer.data());
+
+  if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, ops) < 0)
+    return false;
+
+  return IORING_OP_WRITE <= probe->last_op && (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+}
+
+// Writes through an io_uring set up with the raw system calls, so that no
+// library beyond the kernel headers is needed. Submission and completion
+// both happen on the calling thread, without copies or extra threads.
+class IoUringBackend : public WriteBackend {
+ public:
+  explicit IoUringBackend(size_t queue_depth) : to_submit_(0) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring_fd_ = IoUringSetup(unsigned(queue_depth), params);
+    if (ring_fd_ < 0)
+      throw runtime_error(string("io_uring_setup failed: ") + strerror(errno));
+
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+
+    // newer kernels map both rings at once
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+      sq_size_ = cq_size_ = max(sq_size_, cq_size_);
+
+    sq_ring_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    cq_ring_ = sq_ring_;
+    if (sq_ring_ != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP))
+      cq_ring_ = mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    sqes_ = static_cast<io_uring_sqe *>(mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+      ring_fd_, IORING_OFF_SQES));
+
+    if (sq_ring_ == MAP_FAILED || cq_ring_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+      Unmap();
+      throw runtime_error("Cannot map io_uring");
+    }
+
+    if (!IoUringSupportsWrite(ring_fd_)) {
+      Unmap();
+      throw runtime_error("io_uring lacks IORING_OP_WRITE, which needs Linux 5.6");
+    }
+
+    uint8_t * sq = static_cast<uint8_t *>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+    uint8_t * cq = static_cast<uint8_t *>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+  }
+
+  ~IoUringBackend() override {
+    Unmap();
+  }
+
+  const char * Name() const override { return "io_uring"; }
+
+  void Submit(int fd, const uint8_t * data, size_t size, uint64_t offset, size_t tag) override {
+    unsigned tail = *sq_tail_;
+
+    if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_)
+      throw runtime_error("Write queue overflow");
+
+    unsigned index = tail & sq_mask_;
+    io_uring_sqe & sqe = sqes_[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_WRITE;
+    sqe.fd = fd;
+    sqe.addr = uint64_t(reinterpret_cast<uintptr_t>(data));
+    sqe.len = unsigned(size);
+    sqe.off = offset;
+    sqe.user_data = tag;
+
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    to_submit_++;
+  }
+
+  void Flush() override {
+    while (to_submit_ > 0) {
+      int submitted = IoUringEnter(ring_fd_, to_submit_, 0, 0);
+      if (submitted < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY))
+        continue;
+      if (submitted < 0)
+        throw runtime_error(string("io_uring_enter failed: ") + strerror(errno));
+      to_submit_ -= unsigned(submitted);
+    }
+  }
+
+  void Complete(vector<WriteResult> & done, bool wait) override {
+    unsigned head = *cq_head_;
+
+    if (wait) {
+      Flush();
+      while (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+        if (IoUringEnter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+          throw runtime_error(string("io_uring_enter failed: ") + strerror(errno));
+      }
+    }
+
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      const io_uring_cqe & cqe = cqes_[head & cq_mask_];
+      done.push_back(WriteResult{ size_t(cqe.user_data), int64_t(cqe.res) });
+    }
+
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+
+ private:
+  void Unmap() {
+    if (sqes_ && sqes_ != MAP_FAILED)
+      munmap(sqes_, sqes_size_);
+    if (cq_ring_ && cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+      munmap(cq_ring_, cq_size_);
+    if (sq_ring_ && sq_ring_ != MAP_FAILED)
+      munmap(sq_ring_, sq_size_);
+    close(ring_fd_);
+  }
+
+  int ring_fd_;
+  unsigned to_submit_;
+
+  void * sq_ring_ = nullptr;
+  void * cq_ring_ = nullptr;
+  io_uring_sqe * sqes_ = nullptr;
+  size_t sq_size_;
+  size_t cq_size_;
+  size_t sqes_size_;
+
+  unsigned * sq_head_;
+  unsigned * sq_tail_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned * sq_array_;
+
+  unsigned * cq_head_;
+  unsigned * cq_tail_;
+  unsigned cq_mask_;
+  io_uring_cqe * cqes_;
+};
+
+unique_ptr<WriteBackend> CreateWriteBackend(const string & name, size_t queue_depth, int threads,
+    string & note) {
+  note.clear();
+
+  if (name == "io_uring") {
+    try {
+      return unique_ptr<WriteBackend>(new IoUringBackend(queue_depth));
+    }
+    catch (std::exception &e) {
+      // seccomp filters of containers often block io_uring
+      note = string("io_uring unavailable: ") + e.what();
+    }
+  }
+  else if (name != "pwrite") {
+    throw runtime_error("Unknown record_backend " + name + ", use io_uring or pwrite");
+  }
+
+  return unique_ptr<WriteBackend>(new PwriteBackend(queue_depth, threads));
+}
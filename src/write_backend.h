@@ -0,0 +1,43 @@
+#ifndef WRITE_BACKEND_H
+#define WRITE_BACKEND_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Outcome of one write, result is the number of bytes written or a
+// negative errno
+struct WriteResult {
+  size_t tag;
+  int64_t result;
+};
+
+// Asynchronous positional writes of whole buffers. Submitted writes are
+// queued until Flush, the buffer must stay untouched until its tag comes
+// back from Complete. All calls come from one thread.
+class WriteBackend {
+ public:
+  virtual ~WriteBackend() {}
+
+  virtual const char * Name() const = 0;
+
+  virtual void Submit(int fd, const uint8_t * data, size_t size, uint64_t offset, size_t tag) = 0;
+
+  // Hand queued writes to the kernel or the writer threads
+  virtual void Flush() = 0;
+
+  // Append finished writes to done. With wait set, block until at least
+  // one write finished.
+  virtual void Complete(std::vector<WriteResult> & done, bool wait) = 0;
+};
+
+// "io_uring" falls back to "pwrite" when the kernel refuses to set up a
+// ring or lacks IORING_OP_WRITE, before Linux 5.6, and note tells why.
+// queue_depth is the most writes in flight at once, threads the number of
+// pwrite threads.
+std::unique_ptr<WriteBackend> CreateWriteBackend(const std::string & name, size_t queue_depth, int threads,
+    std::string & note);
+
+#endif